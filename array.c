@@ -0,0 +1,182 @@
+#include "array.h"
+#include "script.h"
+#include "budget.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#define ARRAY_MIN_CAPACITY 8
+
+void arrayOutOfMemory() {
+    fwprintf(scriptErrors, L"Failed to allocate memory for array\n");
+    abortScript();
+}
+
+// Creates an empty array with a reference count of one.
+Array *newArray(int64_t capacity) {
+    if (capacity < ARRAY_MIN_CAPACITY) {
+        capacity = ARRAY_MIN_CAPACITY;
+    }
+    chargeMemory(MEMORY_ARRAY, sizeof(Array) + capacity * sizeof(int64_t));
+    Array *array = malloc(sizeof(Array));
+    if (!array) {
+        arrayOutOfMemory();
+    }
+    array->refCount = 1;
+    array->visit = 0;
+    array->kind = ARRAY_INT;
+    array->length = 0;
+    array->capacity = capacity;
+    array->ints = malloc(capacity * sizeof(int64_t)); // All element kinds are 8 bytes
+    if (!array->ints) {
+        arrayOutOfMemory();
+    }
+    return array;
+}
+
+// Creates an array of the given length whose unboxed elements the caller fills in.
+Array *newArrayOfKind(ArrayKind kind, int64_t length) {
+    Array *array = newArray(length);
+    array->kind = kind;
+    array->length = length;
+    return array;
+}
+
+// The storage kind that can hold the value unboxed
+ArrayKind arrayKindFor(Value value) {
+    switch (valueType(value)) {
+        case TYPE_INT:
+            return ARRAY_INT;
+        case TYPE_DOUBLE:
+            return ARRAY_DOUBLE;
+        default:
+            return ARRAY_BOXED;
+    }
+}
+
+// Converts unboxed storage to boxed Values in place; elements keep their type.
+void arrayBox(Array *array) {
+    Value *values = (Value *)array->ints;
+    for (int64_t i = 0; i < array->length; i++) {
+        if (array->kind == ARRAY_INT) {
+            values[i] = valueCopy(valueFromInt(array->ints[i]));
+        } else {
+            values[i] = valueFromDouble(array->doubles[i]);
+        }
+    }
+    array->kind = ARRAY_BOXED;
+}
+
+// Makes sure the storage can hold the value, boxing it if the value does not
+// match the current element kind.
+void arrayPrepare(Array *array, Value value) {
+    ArrayKind kind = arrayKindFor(value);
+    if (array->length == 0) {
+        array->kind = kind; // An empty array takes the kind of its first element
+    } else if (array->kind != kind && array->kind != ARRAY_BOXED) {
+        arrayBox(array);
+    }
+}
+
+void arrayStore(Array *array, int64_t index, Value value) {
+    switch (array->kind) {
+        case ARRAY_INT:
+            array->ints[index] = valueAsInt(value);
+            break;
+        case ARRAY_DOUBLE:
+            array->doubles[index] = valueAsDouble(value);
+            break;
+        case ARRAY_BOXED:
+            array->values[index] = valueCopy(value);
+            break;
+    }
+}
+
+void checkArrayIndex(Array *array, int64_t index) {
+    if (index < 0 || index >= array->length) {
+        fwprintf(scriptErrors, L"Runtime error: Array index %" PRId64 L" out of range (length %" PRId64 L").\n",
+                 index, array->length);
+        abortScript();
+    }
+}
+
+// Returns the element, borrowed from the array if it is boxed.
+Value arrayGet(Array *array, int64_t index) {
+    checkArrayIndex(array, index);
+    switch (array->kind) {
+        case ARRAY_INT:
+            return valueFromInt(array->ints[index]);
+        case ARRAY_DOUBLE:
+            return valueFromDouble(array->doubles[index]);
+        default:
+            return array->values[index];
+    }
+}
+
+void arraySet(Array *array, int64_t index, Value value) {
+    checkArrayIndex(array, index);
+    arrayPrepare(array, value);
+    if (array->kind == ARRAY_BOXED) {
+        Value previous = array->values[index];
+        array->values[index] = valueCopy(value); // Copy first in case the new value refers to the old one
+        valueFree(previous);
+        return;
+    }
+    arrayStore(array, index, value);
+}
+
+// Appends an element, doubling the capacity when the buffer is full.
+void arrayAppend(Array *array, Value value) {
+    if (array->length == array->capacity) {
+        int64_t capacity = array->capacity * 2;
+        chargeMemory(MEMORY_ARRAY, (capacity - array->capacity) * sizeof(int64_t));
+        int64_t *storage = realloc(array->ints, capacity * sizeof(int64_t));
+        if (!storage) {
+            arrayOutOfMemory();
+        }
+        array->ints = storage;
+        array->capacity = capacity;
+    }
+    arrayPrepare(array, value);
+    arrayStore(array, array->length++, value);
+}
+
+// Drops one reference, freeing the array and its elements with the last one.
+void arrayRelease(Array *array) {
+    if (--array->refCount > 0) {
+        return;
+    }
+    if (array->kind == ARRAY_BOXED) {
+        for (int64_t i = 0; i < array->length; i++) {
+            valueFree(array->values[i]);
+        }
+    }
+    releaseMemory(MEMORY_ARRAY, sizeof(Array) + array->capacity * sizeof(int64_t));
+    free(array->ints);
+    free(array);
+}
+
+void printArray(Array *array) {
+    fwprintf(scriptOutput, L"[");
+    for (int64_t i = 0; i < array->length; i++) {
+        if (i > 0) {
+            fwprintf(scriptOutput, L", ");
+        }
+        switch (array->kind) {
+            case ARRAY_INT:
+                fwprintf(scriptOutput, L"%" PRId64, array->ints[i]);
+                break;
+            case ARRAY_DOUBLE:
+                fwprintf(scriptOutput, L"%lf", array->doubles[i]);
+                break;
+            case ARRAY_BOXED:
+                if (valueType(array->values[i]) == TYPE_CHAR) {
+                    fwprintf(scriptOutput, L"\"%ls\"", valueAsString(array->values[i]));
+                } else {
+                    printValueInline(array->values[i]);
+                }
+                break;
+        }
+    }
+    fwprintf(scriptOutput, L"]");
+}
@@ -0,0 +1,39 @@
+// array.h
+#ifndef ARRAY_H
+#define ARRAY_H
+
+#include <stdint.h>
+#include "value.h"
+
+// Element storage of an array. Arrays whose elements are all integers or all
+// doubles keep them unboxed in a contiguous buffer; storing an element of
+// another type converts the array to boxed Values.
+typedef enum {
+    ARRAY_INT,
+    ARRAY_DOUBLE,
+    ARRAY_BOXED
+} ArrayKind;
+
+typedef struct Array {
+    int refCount;
+    ArrayKind kind;
+    int64_t length;
+    int64_t capacity;
+    union {
+        int64_t *ints;    // ARRAY_INT
+        double *doubles;  // ARRAY_DOUBLE
+        Value *values;    // ARRAY_BOXED, each one owned by the array
+    };
+    uint32_t visit; // The last valueContains search that reached it
+} Array;
+
+Array *newArray(int64_t capacity);
+Array *newArrayOfKind(ArrayKind kind, int64_t length);
+void checkArrayIndex(Array *array, int64_t index);
+Value arrayGet(Array *array, int64_t index);
+void arraySet(Array *array, int64_t index, Value value);
+void arrayAppend(Array *array, Value value);
+void arrayRelease(Array *array);
+void printArray(Array *array);
+
+#endif // ARRAY_H
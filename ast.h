@@ -0,0 +1,60 @@
+// ast.h
+#ifndef AST_H
+#define AST_H
+
+#include "lexer.h"
+#include "value.h"
+
+typedef enum {
+    NODE_LITERAL,     // value
+    NODE_GLOBAL,      // name, looked up in the symbol table
+    NODE_LOCAL,       // slot in the current frame
+    NODE_BINARY,      // left op right
+    NODE_CALL,        // function(args)
+    NODE_BUILTIN,     // builtin(args)
+    NODE_ARRAY,       // [args]
+    NODE_INDEX,       // left[right]
+    NODE_ASSIGN,      // target op= left; target is a NODE_GLOBAL, NODE_LOCAL or NODE_INDEX
+    NODE_PRINT,       // print(left)
+    NODE_RETURN,      // return left
+    NODE_EXPRESSION,  // left evaluated for its side effects
+    NODE_FOR,         // parallel loop: name from left to right, body; args are the variables body uses
+    NODE_LOOP_INDEX,  // the enclosing NODE_FOR's variable
+    NODE_CAPTURED,    // the variable the enclosing NODE_FOR has in args[slot]
+
+    // The interpreter rewrites a node to one of these after running it, to
+    // specialize it for what it saw. Each guards that assumption and turns
+    // back into the kind above when it fails.
+    NODE_GLOBAL_CACHED, // NODE_GLOBAL whose symbol is symbolTable[slot]
+    NODE_BINARY_INT,    // NODE_BINARY whose operands were both integers
+    NODE_BINARY_DOUBLE, // NODE_BINARY whose operands were both doubles
+
+    // Statements of the commonest shapes, which the interpreter fuses into one
+    // operation the first time it runs them. Their shape cannot change, so they
+    // need no guard; values the fast path does not cover take the general one.
+    // Statements of other shapes are rewritten too, so they are looked at once.
+    NODE_ASSIGN_OPERATION, // NODE_ASSIGN of variable = variable op number
+    NODE_UPDATE_NUMBER,    // NODE_ASSIGN of variable op= number
+    NODE_PRINT_VARIABLE,   // NODE_PRINT of a variable
+    NODE_ASSIGN_GENERAL,   // NODE_ASSIGN of any other shape
+    NODE_PRINT_GENERAL,    // NODE_PRINT of any other expression
+} NodeKind;
+
+typedef struct Node {
+    NodeKind kind;
+    TokenType op;          // Operator for NODE_BINARY and NODE_ASSIGN
+    int slot;              // Frame slot for NODE_LOCAL, function index for NODE_CALL, builtin index for NODE_BUILTIN,
+                           // capture index for NODE_CAPTURED
+    int offset;            // Where the node starts in the lexed text, for error positions
+    wchar_t *name;         // Variable name, borrowed from the token array
+    Value value;           // Literal value for NODE_LITERAL
+    struct Node *target;   // Assigned variable for NODE_ASSIGN
+    struct Node *left;
+    struct Node *right;
+    struct Node **args;    // Call arguments, array elements or a loop's captured variables
+    int argCount;
+    struct Node *body;     // Statement list of a NODE_FOR
+    struct Node *next;     // Next statement in a statement list
+} Node;
+
+#endif // AST_H
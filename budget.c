@@ -0,0 +1,123 @@
+#include "budget.h"
+#include "interpreter.h"
+#include "value.h"
+#include <inttypes.h>
+#include <time.h>
+
+int64_t stepLimit = 0;
+double timeLimit = 0;
+int64_t memoryLimit = 0;
+
+_Thread_local int64_t stepCountdown = INT64_MAX;
+_Thread_local int64_t allocatedBytes = 0;
+_Thread_local int64_t reusedBlocks[MEMORY_KIND_COUNT];
+
+int memoryStats = 0;
+
+// What --mem-stats reports besides allocatedBytes
+_Thread_local int64_t peakBytes = 0;
+_Thread_local int64_t allocations[MEMORY_KIND_COUNT]; // Allocations and reallocations
+_Thread_local int64_t liveBytes[MEMORY_KIND_COUNT];
+
+_Thread_local int64_t stepsTaken = 0;  // Before the current countdown
+_Thread_local int64_t stepBatch = 0;   // What the countdown started from
+_Thread_local struct timespec budgetStart;
+
+double secondsSince(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+double monotonicSeconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + now.tv_nsec / 1e9;
+}
+
+double budgetDeadline(void) {
+    if (!(timeLimit > 0)) {
+        return 0;
+    }
+    return (double)budgetStart.tv_sec + budgetStart.tv_nsec / 1e9 + timeLimit;
+}
+
+// Counts down to the next check: the end of the step limit, or the next look
+// at the clock if that comes first
+void refillSteps(void) {
+    int64_t batch = timeLimit > 0 ? BUDGET_CHECK_INTERVAL : INT64_MAX / 2;
+    if (stepLimit > 0 && stepLimit - stepsTaken < batch) {
+        batch = stepLimit - stepsTaken;
+    }
+    stepBatch = batch;
+    stepCountdown = batch;
+}
+
+void startBudget(void) {
+    stepsTaken = 0;
+    if (timeLimit > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &budgetStart);
+    }
+    refillSteps();
+}
+
+// Called by countStep when the countdown has run out, on the step after the
+// batch it was given
+void chargeSteps(void) {
+    stepsTaken += stepBatch - stepCountdown;
+    if (stepLimit > 0 && stepsTaken > stepLimit) {
+        runtimeError(L"Runtime error: Step limit exceeded.");
+    }
+    if (timeLimit > 0 && secondsSince(&budgetStart) > timeLimit) {
+        runtimeError(L"Runtime error: Time limit exceeded.");
+    }
+    refillSteps();
+}
+
+int takeSteps(int64_t steps) {
+    if (stepCountdown < steps) {
+        return 0;
+    }
+    stepCountdown -= steps;
+    return 1;
+}
+
+void chargeMemory(MemoryKind kind, size_t bytes) {
+    allocatedBytes += (int64_t)bytes;
+    if (memoryLimit > 0 && allocatedBytes > memoryLimit) {
+        allocatedBytes -= (int64_t)bytes; // Never allocated
+        runtimeError(L"Runtime error: Memory limit exceeded.");
+    }
+    if (allocatedBytes > peakBytes) {
+        peakBytes = allocatedBytes;
+    }
+    allocations[kind]++;
+    liveBytes[kind] += (int64_t)bytes;
+}
+
+void releaseMemory(MemoryKind kind, size_t bytes) {
+    allocatedBytes -= (int64_t)bytes;
+    liveBytes[kind] -= (int64_t)bytes;
+}
+
+void resetMemoryCounts(void) {
+    allocatedBytes = 0;
+    peakBytes = 0;
+    for (int kind = 0; kind < MEMORY_KIND_COUNT; kind++) {
+        allocations[kind] = 0;
+        reusedBlocks[kind] = 0;
+        liveBytes[kind] = 0;
+    }
+}
+
+void printMemoryStats(FILE *stream, const char *name) {
+    static const wchar_t *kindNames[MEMORY_KIND_COUNT] = {
+        L"strings", L"wide integers", L"arrays", L"maps", L"input streams"
+    };
+    fwprintf(stream, L"%s: %" PRId64 L" bytes live, %" PRId64 L" at peak, %zu in free lists\n",
+             name, allocatedBytes, peakBytes, freeListBytes());
+    for (int kind = 0; kind < MEMORY_KIND_COUNT; kind++) {
+        fwprintf(stream, L"  %-14ls %10" PRId64 L" allocations %10" PRId64 L" reused %12" PRId64 L" bytes live\n",
+                 kindNames[kind], allocations[kind], reusedBlocks[kind], liveBytes[kind]);
+    }
+}
@@ -0,0 +1,78 @@
+// budget.h
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Limits on what one script may use, set by --max-steps, --max-time and
+// --max-memory; 0 means no limit. A script that goes over one stops with a
+// runtime error like any other, and the next script runs as usual.
+extern int64_t stepLimit;   // Statements executed plus calls made
+extern double timeLimit;    // Seconds of wall time
+extern int64_t memoryLimit; // Bytes held by strings, arrays and wide integers
+
+// Steps the running script may take before chargeSteps has to look at the
+// limits. Taking a step is a decrement and a branch; the clock is read once
+// every BUDGET_CHECK_INTERVAL steps, and not at all without a time limit.
+extern _Thread_local int64_t stepCountdown;
+extern _Thread_local int64_t allocatedBytes;
+
+#define BUDGET_CHECK_INTERVAL 4096
+
+// Starts counting steps and time for a script or an interactive entry
+void startBudget(void);
+void chargeSteps(void);
+
+static inline void countStep(void) {
+    if (--stepCountdown < 0) {
+        chargeSteps();
+    }
+}
+
+// Takes several steps at once, checking the limits if they run out
+static inline void countSteps(int64_t steps) {
+    stepCountdown -= steps;
+    if (stepCountdown < 0) {
+        chargeSteps();
+    }
+}
+
+// Takes several steps at once if that needs no check, for compiled code that
+// runs them without counting. Returns 0, taking none, otherwise.
+int takeSteps(int64_t steps);
+
+// When the running script's time runs out, in seconds of CLOCK_MONOTONIC, for
+// threads working on its behalf to compare monotonicSeconds() with; 0 without
+// a time limit
+double budgetDeadline(void);
+double monotonicSeconds(void);
+
+// What value storage holds, for the counts --mem-stats reports
+typedef enum {
+    MEMORY_STRING,
+    MEMORY_WIDE_INT,
+    MEMORY_ARRAY,
+    MEMORY_MAP,
+    MEMORY_STREAM,
+    MEMORY_KIND_COUNT
+} MemoryKind;
+
+extern int memoryStats; // Set by --mem-stats
+
+// Blocks of each kind handed out again from a free list instead of malloc
+extern _Thread_local int64_t reusedBlocks[MEMORY_KIND_COUNT];
+
+// Accounts for value storage before it is allocated and after it is freed
+void chargeMemory(MemoryKind kind, size_t bytes);
+void releaseMemory(MemoryKind kind, size_t bytes);
+
+// Starts the byte and allocation counts of a script from nothing
+void resetMemoryCounts(void);
+
+// Writes the bytes the running script holds, the most it has held and its
+// allocations of each kind, headed by its name
+void printMemoryStats(FILE *stream, const char *name);
+
+#endif // BUDGET_H
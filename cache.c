@@ -0,0 +1,253 @@
+#include "cache.h"
+#include "script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INTERN_TABLE_MIN_SIZE 64
+
+// FNV-1a over the raw script bytes
+uint64_t hashSource(const char *bytes, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+int tokenHasString(TokenType type) {
+    return type == TOKEN_VARIABLE || type == TOKEN_CHAR;
+}
+
+// String table built while writing. Each distinct string is stored once and
+// tokens refer to it by byte offset; a variable used a thousand times costs
+// one entry.
+typedef struct {
+    wchar_t *data;
+    size_t length;      // In wchar_t units
+    size_t capacity;
+    uint64_t *slots;    // Offset + 1 of each interned string, 0 when empty
+    size_t slotCount;
+    size_t used;
+} InternTable;
+
+uint64_t hashString(const wchar_t *string) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *string; string++) {
+        hash ^= (uint64_t)*string;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void internGrowSlots(InternTable *table) {
+    size_t slotCount = table->slotCount ? table->slotCount * 2 : INTERN_TABLE_MIN_SIZE;
+    uint64_t *slots = calloc(slotCount, sizeof(uint64_t));
+    if (!slots) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for cache strings\n");
+        abortScript();
+    }
+    for (size_t i = 0; i < table->slotCount; i++) {
+        if (table->slots[i]) {
+            size_t slot = hashString(table->data + table->slots[i] - 1) & (slotCount - 1);
+            while (slots[slot]) {
+                slot = (slot + 1) & (slotCount - 1);
+            }
+            slots[slot] = table->slots[i];
+        }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slotCount = slotCount;
+}
+
+// Returns the offset of the string in the table in wchar_t units, adding it if needed.
+uint64_t internString(InternTable *table, const wchar_t *string) {
+    if ((table->used + 1) * 2 > table->slotCount) {
+        internGrowSlots(table);
+    }
+    size_t slot = hashString(string) & (table->slotCount - 1);
+    while (table->slots[slot]) {
+        if (wcscmp(table->data + table->slots[slot] - 1, string) == 0) {
+            return table->slots[slot] - 1;
+        }
+        slot = (slot + 1) & (table->slotCount - 1);
+    }
+
+    size_t length = wcslen(string) + 1;
+    if (table->length + length > table->capacity) {
+        size_t capacity = table->capacity ? table->capacity * 2 : 256;
+        while (capacity < table->length + length) {
+            capacity *= 2;
+        }
+        wchar_t *data = realloc(table->data, capacity * sizeof(wchar_t));
+        if (!data) {
+            fwprintf(scriptErrors, L"Failed to allocate memory for cache strings\n");
+            abortScript();
+        }
+        table->data = data;
+        table->capacity = capacity;
+    }
+    uint64_t offset = table->length;
+    wmemcpy(table->data + offset, string, length);
+    table->length += length;
+    table->slots[slot] = offset + 1;
+    table->used++;
+    return offset;
+}
+
+// Writes count records, which may be none, from a buffer that is then NULL
+int writeRecords(const void *records, size_t size, size_t count, FILE *file) {
+    return count == 0 || fwrite(records, size, count, file) == count;
+}
+
+// Writes the tokens to a temporary file and renames it over the cache, so a
+// reader never sees a half-written cache. Returns 0 if the cache could not be
+// written; the script still runs, it is just lexed again next time.
+int writeTokenCache(const char *path, uint64_t sourceHash, Token *tokens) {
+    size_t tokenCount = 0;
+    while (tokens[tokenCount].type != TOKEN_EOF) {
+        tokenCount++;
+    }
+    tokenCount++;
+
+    Token *records = malloc(tokenCount * sizeof(Token));
+    if (!records) {
+        return 0;
+    }
+    InternTable strings = {0};
+    for (size_t i = 0; i < tokenCount; i++) {
+        memset(&records[i], 0, sizeof(Token)); // Keep padding bytes out of the file
+        records[i].type = tokens[i].type;
+        records[i].offset = tokens[i].offset;
+        if (tokenHasString(tokens[i].type)) {
+            records[i].intValue = (int64_t)(internString(&strings, tokens[i].varName) * sizeof(wchar_t));
+        } else {
+            records[i].intValue = tokens[i].intValue; // Also copies doubleValue
+        }
+    }
+
+    CacheHeader header = {0};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.tokenSize = sizeof(Token);
+    header.wcharSize = sizeof(wchar_t);
+    header.sourceHash = sourceHash;
+    header.tokenCount = tokenCount;
+    header.stringsOffset = sizeof(CacheHeader) + tokenCount * sizeof(Token);
+    header.stringsSize = strings.length * sizeof(wchar_t);
+
+    size_t pathLength = strlen(path);
+    char *temporaryPath = malloc(pathLength + sizeof(".XXXXXX"));
+    int written = 0;
+    if (temporaryPath) {
+        sprintf(temporaryPath, "%s.XXXXXX", path); // Unique even when several workers cache one script
+        int descriptor = mkstemp(temporaryPath);
+        FILE *file = descriptor >= 0 ? fdopen(descriptor, "wb") : NULL;
+        if (file) {
+            written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                      fwrite(records, sizeof(Token), tokenCount, file) == tokenCount &&
+                      writeRecords(strings.data, sizeof(wchar_t), strings.length, file);
+            written = fclose(file) == 0 && written;
+            if (written) {
+                written = rename(temporaryPath, path) == 0;
+            }
+        } else if (descriptor >= 0) {
+            close(descriptor);
+        }
+        if (descriptor >= 0 && !written) {
+            remove(temporaryPath);
+        }
+        free(temporaryPath);
+    }
+
+    free(records);
+    free(strings.data);
+    free(strings.slots);
+    return written;
+}
+
+// A token a cache may hold: any the lexer makes except TOKEN_ERROR, since
+// scripts with lexer errors are not cached, and TOKEN_EOF only at the end
+int cachedTokenValid(Token token, int last, size_t stringsLength) {
+    if ((unsigned)token.type > TOKEN_RIGHT_BRACE || token.type == TOKEN_ERROR ||
+        (token.type == TOKEN_EOF) != last || token.offset < 0) {
+        return 0;
+    }
+    if (tokenHasString(token.type)) {
+        uint64_t offset = (uint64_t)token.intValue;
+        return offset % sizeof(wchar_t) == 0 && offset / sizeof(wchar_t) < stringsLength;
+    }
+    return 1;
+}
+
+wchar_t *cachedString(wchar_t *strings, Token token) {
+    return strings + (uint64_t)token.intValue / sizeof(wchar_t);
+}
+
+// Maps the cache and returns its tokens, or NULL if there is no usable cache
+// for this source. Every token is checked before it is handed out, so a
+// damaged or stale file is rejected rather than parsed. The mapping is
+// read-only: string tokens keep their offsets and are resolved with
+// cachedString as they are read.
+Token *loadTokenCache(const char *path, uint64_t sourceHash, CacheImage *image) {
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return NULL;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || (size_t)status.st_size < sizeof(CacheHeader)) {
+        close(descriptor);
+        return NULL;
+    }
+    size_t size = (size_t)status.st_size;
+    char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    CacheHeader *header = (CacheHeader *)base;
+    int valid = memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+                header->version == CACHE_VERSION &&
+                header->tokenSize == sizeof(Token) &&
+                header->wcharSize == sizeof(wchar_t) &&
+                header->sourceHash == sourceHash &&
+                header->tokenCount > 0 &&
+                header->tokenCount <= (size - sizeof(CacheHeader)) / sizeof(Token) &&
+                header->stringsOffset == sizeof(CacheHeader) + header->tokenCount * sizeof(Token) &&
+                header->stringsSize == size - header->stringsOffset &&
+                header->stringsSize % sizeof(wchar_t) == 0;
+
+    Token *tokens = (Token *)(base + sizeof(CacheHeader));
+    wchar_t *strings = (wchar_t *)(base + header->stringsOffset);
+    size_t stringsLength = valid ? header->stringsSize / sizeof(wchar_t) : 0;
+    if (valid && (stringsLength > 0 && strings[stringsLength - 1] != L'\0')) {
+        valid = 0; // Every string must end inside the table
+    }
+    for (uint64_t i = 0; valid && i < header->tokenCount; i++) {
+        valid = cachedTokenValid(tokens[i], i == header->tokenCount - 1, stringsLength);
+    }
+    if (!valid) {
+        munmap(base, size);
+        return NULL;
+    }
+
+    image->base = base;
+    image->size = size;
+    image->strings = strings;
+    return tokens;
+}
+
+void releaseTokenCache(CacheImage *image) {
+    if (image->base) {
+        munmap(image->base, image->size);
+        image->base = NULL;
+        image->strings = NULL;
+    }
+}
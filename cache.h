@@ -0,0 +1,46 @@
+// cache.h
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lexer.h"
+
+// A lexed script saved next to its source as <script>.hbc. The file holds a
+// header, the token array with string pointers replaced by offsets, and an
+// interned string table. It is mapped read-only and the parser resolves each
+// offset against the string table as it reads the token, so loading copies
+// and writes nothing.
+#define CACHE_MAGIC "HBBCACHE"
+#define CACHE_VERSION 3
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t tokenSize;      // sizeof(Token) of the writer
+    uint32_t wcharSize;      // sizeof(wchar_t) of the writer
+    uint32_t reserved;
+    uint64_t sourceHash;     // hashSource of the script bytes
+    uint64_t tokenCount;     // Including the final TOKEN_EOF
+    uint64_t stringsOffset;  // Byte offset of the string table
+    uint64_t stringsSize;    // Size of the string table in bytes
+} CacheHeader;
+
+// A mapped cache file
+typedef struct {
+    void *base;
+    size_t size;
+    wchar_t *strings; // The string table the tokens' offsets point into
+} CacheImage;
+
+uint64_t hashSource(const char *bytes, size_t length);
+Token *loadTokenCache(const char *path, uint64_t sourceHash, CacheImage *image);
+int writeTokenCache(const char *path, uint64_t sourceHash, Token *tokens);
+void releaseTokenCache(CacheImage *image);
+
+int tokenHasString(TokenType type);
+
+// The string of a cached TOKEN_VARIABLE or TOKEN_CHAR
+wchar_t *cachedString(wchar_t *strings, Token token);
+
+#endif // CACHE_H
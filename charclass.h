@@ -0,0 +1,36 @@
+// charclass.h
+#ifndef CHARCLASS_H
+#define CHARCLASS_H
+
+#include <stdint.h>
+#include <wchar.h>
+
+// What the lexer may do with a character. Its class byte holds these bits,
+// and a digit's value in the top four.
+#define CHAR_NAME_START 0x01 // Starts a name: the letters of the Arabic blocks
+#define CHAR_NAME       0x02 // Continues a name: letters, marks, digits, '_', joiners
+#define CHAR_DIGIT      0x04 // ASCII, Arabic-Indic or Eastern Arabic-Indic digit
+#define CHAR_SPACE      0x08 // Skipped between tokens
+#define CHAR_DIGIT_SHIFT 4
+
+// The classes are kept in blocks of 128 characters, and identical blocks are
+// stored once. charBlocks gives the block of each range of 128 characters in
+// the Basic Multilingual Plane; characters above it have class 0. Both tables
+// are generated by tools/charclass.py into charclass.c.
+#define CHAR_BLOCK_BITS 7
+#define CHAR_BLOCK_SIZE (1 << CHAR_BLOCK_BITS)
+#define CHAR_BLOCK_COUNT (0x10000 >> CHAR_BLOCK_BITS)
+
+extern const uint8_t charBlocks[CHAR_BLOCK_COUNT];
+extern const uint8_t charClasses[][CHAR_BLOCK_SIZE];
+
+static inline unsigned charClass(wchar_t ch) {
+    uint32_t code = (uint32_t)ch;
+    return code < 0x10000 ? charClasses[charBlocks[code >> CHAR_BLOCK_BITS]][code & (CHAR_BLOCK_SIZE - 1)] : 0;
+}
+
+static inline int digitValue(unsigned kind) {
+    return kind >> CHAR_DIGIT_SHIFT;
+}
+
+#endif // CHARCLASS_H
@@ -0,0 +1,384 @@
+#include "checker.h"
+#include "diagnostic.h"
+#include "interpreter.h"
+#include "parallel.h"
+#include "script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+#define TYPE_BIT(type) (1u << (type))
+#define TYPES_NUMBER (TYPE_BIT(TYPE_INT) | TYPE_BIT(TYPE_DOUBLE))
+
+// A global assigned by a top-level statement checked so far
+typedef struct {
+    wchar_t *name; // Borrowed from the token array
+    TypeSet types;
+} CheckedGlobal;
+
+_Thread_local CheckedGlobal *checkedGlobals = NULL;
+_Thread_local int checkedGlobalCount = 0;
+_Thread_local int checkedGlobalCapacity = 0;
+
+// Variables of assignments that did not parse. Whether they are assigned is
+// unknown, so they are never reported as undefined.
+_Thread_local wchar_t **uncheckedNames = NULL;
+_Thread_local int uncheckedNameCount = 0;
+_Thread_local int uncheckedNameCapacity = 0;
+
+// Types of the frame slots of the function being checked, or NULL at top level
+_Thread_local TypeSet *checkedLocals = NULL;
+
+// Types of the variables the parallel loop being checked captures
+_Thread_local TypeSet *checkedCaptures = NULL;
+
+void checkError(Node *node, const wchar_t *message) {
+    addDiagnostic(diagnosticList, node->offset, message);
+}
+
+// Adds a message whose format has one %ls for a name
+void checkNameError(Node *node, const wchar_t *format, const wchar_t *name) {
+    size_t length = wcslen(format) + wcslen(name) + 1;
+    wchar_t message[length];
+    swprintf(message, length, format, name);
+    checkError(node, message);
+}
+
+CheckedGlobal *findCheckedGlobal(wchar_t *name) {
+    for (int i = 0; i < checkedGlobalCount; i++) {
+        if (wcscmp(checkedGlobals[i].name, name) == 0) {
+            return &checkedGlobals[i];
+        }
+    }
+    return NULL;
+}
+
+void setCheckedGlobal(wchar_t *name, TypeSet types) {
+    CheckedGlobal *global = findCheckedGlobal(name);
+    if (global) {
+        global->types = types;
+        return;
+    }
+    if (checkedGlobalCount == checkedGlobalCapacity) {
+        int capacity = checkedGlobalCapacity ? checkedGlobalCapacity * 2 : 16;
+        CheckedGlobal *globals = realloc(checkedGlobals, capacity * sizeof(CheckedGlobal));
+        if (!globals) {
+            fwprintf(scriptErrors, L"Failed to allocate memory for the checker\n");
+            abortScript();
+        }
+        checkedGlobals = globals;
+        checkedGlobalCapacity = capacity;
+    }
+    checkedGlobals[checkedGlobalCount++] = (CheckedGlobal){name, types};
+}
+
+void skipAssignment(wchar_t *name) {
+    if (uncheckedNameCount == uncheckedNameCapacity) {
+        int capacity = uncheckedNameCapacity ? uncheckedNameCapacity * 2 : 16;
+        wchar_t **names = realloc(uncheckedNames, capacity * sizeof(wchar_t *));
+        if (!names) {
+            fwprintf(scriptErrors, L"Failed to allocate memory for the checker\n");
+            abortScript();
+        }
+        uncheckedNames = names;
+        uncheckedNameCapacity = capacity;
+    }
+    uncheckedNames[uncheckedNameCount++] = name;
+}
+
+int isUnchecked(wchar_t *name) {
+    for (int i = 0; i < uncheckedNameCount; i++) {
+        if (wcscmp(uncheckedNames[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Where a variable may be unassigned, returns the types it has when it is
+// assigned; TypeSet 0 means it is never assigned when the node runs.
+TypeSet variableTypes(Node *variable) {
+    if (variable->kind == NODE_LOCAL) {
+        // Slots that are not parameters start out as missing values, which
+        // reading treats as unassigned
+        TypeSet types = checkedLocals[variable->slot];
+        if (types == TYPE_BIT(TYPE_ERROR)) {
+            return isUnchecked(variable->name) ? TYPES_ANY : 0;
+        }
+        return types;
+    }
+    CheckedGlobal *global = findCheckedGlobal(variable->name);
+    if (!global) {
+        return isUnchecked(variable->name) ? TYPES_ANY : 0;
+    }
+    // A function body may run whenever its globals hold anything
+    return checkedLocals ? TYPES_ANY : global->types;
+}
+
+int isZeroLiteral(Node *node) {
+    return node->kind == NODE_LITERAL && valueIsNumber(node->value) &&
+           (valueIsInt(node->value) ? valueAsInt(node->value) == 0 : valueAsDouble(node->value) == 0);
+}
+
+void checkArithmeticOperand(Node *node, TypeSet types) {
+    if (types & TYPES_NUMBER) {
+        return;
+    }
+    if (types & TYPE_BIT(TYPE_CHAR)) {
+        checkError(node, L"Type error: arithmetic on a string value");
+    } else if (types & TYPE_BIT(TYPE_ARRAY)) {
+        checkError(node, L"Type error: arithmetic on an array value");
+    } else {
+        checkError(node, L"Type error: arithmetic on a missing value");
+    }
+}
+
+TypeSet checkExpression(Node *node);
+
+void checkArguments(Node *node) {
+    for (int i = 0; i < node->argCount; i++) {
+        checkExpression(node->args[i]);
+    }
+}
+
+void checkCall(Node *node) {
+    checkArguments(node);
+    Function *function = &functions[node->slot];
+    if (function->paramCount < 0) {
+        checkNameError(node, L"Undefined function: %ls", function->name);
+    } else if (function->paramCount != node->argCount) {
+        // Calls parsed before the definition; the parser checks the others
+        size_t length = wcslen(function->name) + 80;
+        wchar_t message[length];
+        swprintf(message, length, L"Wrong number of arguments to %ls: expected %d, got %d",
+                 function->name, function->paramCount, node->argCount);
+        checkError(node, message);
+    }
+}
+
+// Returns the types the expression may have. Only errors that happen
+// whatever the script's input are added; anything uncertain is let through.
+TypeSet checkExpression(Node *node) {
+    switch (node->kind) {
+        case NODE_LITERAL:
+            return TYPE_BIT(valueType(node->value));
+        case NODE_GLOBAL:
+        case NODE_LOCAL:
+            {
+                TypeSet types = variableTypes(node);
+                if (!types) {
+                    checkNameError(node, L"Undefined variable: %ls", node->name);
+                    return TYPES_ANY;
+                }
+                return types;
+            }
+        case NODE_LOOP_INDEX:
+            return TYPE_BIT(TYPE_INT);
+        case NODE_CAPTURED:
+            return checkedCaptures[node->slot];
+        case NODE_BINARY:
+            {
+                TypeSet left = checkExpression(node->left);
+                TypeSet right = checkExpression(node->right);
+                checkArithmeticOperand(node, (left & TYPES_NUMBER) ? right : left);
+                if (node->op == TOKEN_SLASH && isZeroLiteral(node->right)) {
+                    checkError(node, L"Runtime error: Division by zero in expression.");
+                }
+                // Two integers stay an integer; any other pair of numbers is a double
+                TypeSet result = 0;
+                if ((left & TYPE_BIT(TYPE_INT)) && (right & TYPE_BIT(TYPE_INT))) {
+                    result |= TYPE_BIT(TYPE_INT);
+                }
+                if (((left | right) & TYPE_BIT(TYPE_DOUBLE)) && (left & TYPES_NUMBER) && (right & TYPES_NUMBER)) {
+                    result |= TYPE_BIT(TYPE_DOUBLE);
+                }
+                return result ? result : TYPES_NUMBER;
+            }
+        case NODE_CALL:
+            checkCall(node);
+            return TYPES_ANY;
+        case NODE_BUILTIN:
+            if (wcscmp(builtins[node->slot].name, L"طول") == 0) {
+                if (!(checkExpression(node->args[0]) &
+                      (TYPE_BIT(TYPE_ARRAY) | TYPE_BIT(TYPE_CHAR) | TYPE_BIT(TYPE_MAP)))) {
+                    checkError(node, L"Type error: length of a value that is not an array, a string or a map");
+                }
+                return TYPE_BIT(TYPE_INT);
+            }
+            if (wcscmp(builtins[node->slot].name, L"قاموس") == 0) {
+                return TYPE_BIT(TYPE_MAP);
+            }
+            checkArguments(node);
+            return TYPES_ANY;
+        case NODE_ARRAY:
+            checkArguments(node);
+            return TYPE_BIT(TYPE_ARRAY);
+        case NODE_INDEX:
+            {
+                TypeSet container = checkExpression(node->left);
+                TypeSet index = checkExpression(node->right);
+                if (!(container & (TYPE_BIT(TYPE_ARRAY) | TYPE_BIT(TYPE_MAP)))) {
+                    checkError(node, L"Type error: indexing a value that is not an array");
+                }
+                if (!(container & TYPE_BIT(TYPE_MAP)) && !(index & TYPE_BIT(TYPE_INT))) {
+                    checkError(node, L"Type error: array index is not an integer");
+                }
+                if (container == TYPE_BIT(TYPE_MAP) && !(index & (TYPE_BIT(TYPE_INT) | TYPE_BIT(TYPE_CHAR)))) {
+                    checkError(node, L"Type error: map key is not a string or an integer");
+                }
+                return TYPES_ANY; // Elements are not tracked
+            }
+        default:
+            return TYPES_ANY;
+    }
+}
+
+// Checks a compound assignment to a value of the given types and returns the
+// types of the result
+TypeSet checkCompoundAssignment(Node *node, const wchar_t *name, TypeSet current, TypeSet operand) {
+    if (!(operand & TYPES_NUMBER)) {
+        checkError(node, L"Invalid right-hand side in assignment");
+    } else if (node->op == TOKEN_MOD_BY && !(operand & TYPE_BIT(TYPE_INT))) {
+        checkError(node, L"Modulo operation not supported for double");
+    }
+    if (!(current & TYPES_NUMBER)) {
+        checkNameError(node, L"Type error: %ls is not a number", name);
+        return TYPES_NUMBER;
+    }
+    // Only an integer divides by a zero operand with an error
+    if ((node->op == TOKEN_DIVIDE_BY || node->op == TOKEN_MOD_BY) && current == TYPE_BIT(TYPE_INT) &&
+        isZeroLiteral(node->left)) {
+        checkError(node, L"Runtime error: Division by zero in expression.");
+    }
+    return current & TYPES_NUMBER; // Integers stay integers and doubles stay doubles
+}
+
+void checkAssignment(Node *node) {
+    Node *target = node->target;
+    TypeSet value = checkExpression(node->left);
+    if (target->kind == NODE_INDEX) {
+        checkExpression(target);
+        if (node->op != TOKEN_ASSIGNMENT) {
+            checkCompoundAssignment(node, L"array element", TYPES_ANY, value);
+        }
+        return;
+    }
+
+    if (target->kind == NODE_CAPTURED) {
+        return; // A loop's reductions are checked before its body
+    }
+
+    if (node->op != TOKEN_ASSIGNMENT) {
+        TypeSet current = variableTypes(target);
+        if (!current) {
+            checkNameError(node, L"Variable not found for update: %ls", target->name);
+            current = TYPES_ANY;
+        }
+        value = checkCompoundAssignment(node, target->name, current, value);
+    }
+    if (target->kind == NODE_LOCAL) {
+        checkedLocals[target->slot] = value;
+    } else if (!checkedLocals) {
+        setCheckedGlobal(target->name, value);
+    }
+}
+
+int isIntLiteral(Node *node) {
+    return node->kind == NODE_LITERAL && valueIsInt(node->value);
+}
+
+// Checks the bounds and the variables of a parallel loop, then its body once
+// with the types they have before it; += and *= keep a number's type
+void checkLoop(Node *loop) {
+    TypeSet start = checkExpression(loop->left);
+    TypeSet end = checkExpression(loop->right);
+    if (!(start & TYPE_BIT(TYPE_INT)) || !(end & TYPE_BIT(TYPE_INT))) {
+        checkError(loop, L"Type error: loop bounds are not integers");
+        return;
+    }
+    // Nothing in a loop that never runs is looked at
+    if (isIntLiteral(loop->left) && isIntLiteral(loop->right) &&
+        valueAsInt(loop->right->value) <= valueAsInt(loop->left->value)) {
+        return;
+    }
+
+    unsigned roles[loop->argCount + 1];
+    TypeSet captures[loop->argCount + 1];
+    loopRoles(loop, roles);
+    for (int i = 0; i < loop->argCount; i++) {
+        Node *capture = loop->args[i];
+        if (!(roles[i] & LOOP_REDUCED)) {
+            captures[i] = checkExpression(capture);
+            continue;
+        }
+        captures[i] = variableTypes(capture);
+        if (!captures[i]) {
+            checkNameError(loop, L"Variable not found for update: %ls", capture->name);
+            captures[i] = TYPES_ANY;
+        } else if (!(captures[i] & TYPES_NUMBER)) {
+            checkNameError(loop, L"Type error: %ls is not a number", capture->name);
+            captures[i] = TYPES_NUMBER;
+        }
+    }
+    checkedCaptures = captures;
+    for (Node *statement = loop->body; statement; statement = statement->next) {
+        checkAssignment(statement);
+    }
+    checkedCaptures = NULL;
+}
+
+void checkStatement(Node *statement) {
+    switch (statement->kind) {
+        case NODE_ASSIGN:
+            checkAssignment(statement);
+            break;
+        case NODE_PRINT:
+        case NODE_EXPRESSION:
+            checkExpression(statement->left);
+            break;
+        case NODE_RETURN:
+            if (statement->left) {
+                checkExpression(statement->left);
+            }
+            break;
+        case NODE_FOR:
+            checkLoop(statement);
+            break;
+        default:
+            break;
+    }
+}
+
+// Function bodies have no branches, and a loop in one changes the type of
+// nothing it updates, so their statements are checked in order like the top
+// level, with every global the script assigns defined.
+void checkFunctions() {
+    for (int i = 0; i < functionCount; i++) {
+        Function *function = &functions[i];
+        if (function->paramCount < 0) {
+            continue;
+        }
+        TypeSet locals[function->localCount + 1];
+        for (int slot = 0; slot < function->localCount; slot++) {
+            locals[slot] = slot < function->paramCount ? TYPES_ANY : TYPE_BIT(TYPE_ERROR);
+        }
+        checkedLocals = locals;
+        for (Node *statement = function->body; statement; statement = statement->next) {
+            checkStatement(statement);
+        }
+        checkedLocals = NULL;
+    }
+}
+
+void clearChecker() {
+    free(checkedGlobals);
+    checkedGlobals = NULL;
+    checkedGlobalCount = 0;
+    checkedGlobalCapacity = 0;
+    free(uncheckedNames);
+    uncheckedNames = NULL;
+    uncheckedNameCount = 0;
+    uncheckedNameCapacity = 0;
+    checkedLocals = NULL;
+    checkedCaptures = NULL;
+}
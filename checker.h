@@ -0,0 +1,26 @@
+// checker.h
+#ifndef CHECKER_H
+#define CHECKER_H
+
+#include "ast.h"
+
+// The types a value may have, one bit per ValueType. A value nothing is known
+// about may have any of them.
+typedef unsigned TypeSet;
+#define TYPES_ANY ((1u << (TYPE_ERROR + 1)) - 1)
+
+// Checks a top-level statement without running it and adds the errors it is
+// certain to stop with to diagnosticList. Globals it assigns are remembered
+// for the statements after it.
+void checkStatement(Node *statement);
+
+// Checks the bodies of the functions defined, once the whole script has been
+// parsed. A body is checked even if nothing calls it.
+void checkFunctions();
+
+// Records the variable of an assignment that could not be parsed, which
+// reads after it then take to be defined
+void skipAssignment(wchar_t *name);
+void clearChecker();
+
+#endif // CHECKER_H
@@ -0,0 +1,91 @@
+#include "diagnostic.h"
+#include "script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Thread_local DiagnosticList *diagnosticList = NULL;
+
+void addDiagnostic(DiagnosticList *list, int offset, const wchar_t *message) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 8;
+        Diagnostic *items = realloc(list->items, capacity * sizeof(Diagnostic));
+        if (!items) {
+            fwprintf(scriptErrors, L"Failed to allocate memory for diagnostics\n");
+            abortScript();
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    wchar_t *copy = wcsdup(message);
+    if (!copy) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for diagnostics\n");
+        abortScript();
+    }
+    list->items[list->count].offset = offset;
+    list->items[list->count].message = copy;
+    list->count++;
+}
+
+// Drops the diagnostics after the first count. The list keeps its storage for reuse.
+void truncateDiagnostics(DiagnosticList *list, int count) {
+    for (int i = count; i < list->count; i++) {
+        free(list->items[i].message);
+    }
+    if (count < list->count) {
+        list->count = count;
+    }
+}
+
+void clearDiagnostics(DiagnosticList *list) {
+    truncateDiagnostics(list, 0);
+}
+
+void sortDiagnostics(DiagnosticList *list) {
+    // Merge sort, which is stable; diagnostics are mostly in order already
+    Diagnostic *buffer = malloc(list->count * sizeof(Diagnostic));
+    if (!buffer) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for diagnostics\n");
+        abortScript();
+    }
+    Diagnostic *from = list->items;
+    Diagnostic *to = buffer;
+    for (int width = 1; width < list->count; width *= 2) {
+        for (int start = 0; start < list->count; start += 2 * width) {
+            int middle = start + width < list->count ? start + width : list->count;
+            int end = middle + width < list->count ? middle + width : list->count;
+            int left = start;
+            int right = middle;
+            for (int i = start; i < end; i++) {
+                if (left < middle && (right == end || from[left].offset <= from[right].offset)) {
+                    to[i] = from[left++];
+                } else {
+                    to[i] = from[right++];
+                }
+            }
+        }
+        Diagnostic *swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != list->items) {
+        memcpy(list->items, from, list->count * sizeof(Diagnostic));
+    }
+    free(buffer);
+}
+
+void printDiagnostics(FILE *stream, const char *name, const wchar_t *text, DiagnosticList *list) {
+    int line = 1;
+    int lineStart = 0;
+    int position = 0;
+    for (int i = 0; i < list->count; i++) {
+        for (; position < list->items[i].offset && text[position]; position++) {
+            if (text[position] == L'\n') {
+                line++;
+                lineStart = position + 1;
+            }
+        }
+        fwprintf(stream, L"%s:%d:%d: %ls\n", name, line, list->items[i].offset - lineStart + 1,
+                 list->items[i].message);
+    }
+}
@@ -0,0 +1,35 @@
+// diagnostic.h
+#ifndef DIAGNOSTIC_H
+#define DIAGNOSTIC_H
+
+#include <stdio.h>
+#include <wchar.h>
+
+// An error found while lexing or parsing, at a position in the lexed text
+typedef struct {
+    int offset;
+    wchar_t *message;
+} Diagnostic;
+
+typedef struct {
+    Diagnostic *items;
+    int count;
+    int capacity;
+} DiagnosticList;
+
+// When set, the lexer and parser add their errors to this list instead of
+// printing them. Errors that stop the lexer or parser still abort the script.
+extern _Thread_local DiagnosticList *diagnosticList;
+
+void addDiagnostic(DiagnosticList *list, int offset, const wchar_t *message);
+void truncateDiagnostics(DiagnosticList *list, int count);
+void clearDiagnostics(DiagnosticList *list);
+
+// Orders the list by offset, keeping the order of diagnostics at one offset
+void sortDiagnostics(DiagnosticList *list);
+
+// Prints a sorted list as name:line:column: message, one per line, with
+// positions counted in characters of text from 1
+void printDiagnostics(FILE *stream, const char *name, const wchar_t *text, DiagnosticList *list);
+
+#endif // DIAGNOSTIC_H
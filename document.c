@@ -0,0 +1,528 @@
+#include "document.h"
+#include "script.h"
+#include "parser.h"
+#include "interpreter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CONTEXT_HASH_START 14695981039346656037ULL
+#define BLOCK_UNITS 64 // Units in a block after a split; blocks split at twice this
+
+void documentOutOfMemory() {
+    fwprintf(stderr, L"Failed to allocate memory for document\n");
+    exit(EXIT_FAILURE);
+}
+
+// Width of a character in UTF-16 code units
+int characterWidth(wchar_t character) {
+    return (uint32_t)character > 0xFFFF ? 2 : 1;
+}
+
+// Offset just past the unit that starts at position: after a ';' outside
+// braces, or after the '}' that closes the outermost brace. Neither counts
+// inside a string literal. complete is cleared when the text ends first.
+int unitEnd(const wchar_t *text, int position, int length, int *complete) {
+    int depth = 0;
+    int inString = 0;
+    *complete = 1;
+    for (; position < length; position++) {
+        wchar_t character = text[position];
+        if (character == L'"') {
+            inString = !inString;
+        } else if (inString) {
+            continue;
+        } else if (character == L'{') {
+            depth++;
+        } else if (character == L'}') {
+            if (depth > 0) {
+                depth--;
+            }
+            if (depth == 0) {
+                return position + 1;
+            }
+        } else if (character == L';' && depth == 0) {
+            return position + 1;
+        }
+    }
+    *complete = 0;
+    return length;
+}
+
+// Moves a line and column past text with the given line breaks and tail
+void advancePosition(int *line, int *column, int newlines, int tailWidth) {
+    *line += newlines;
+    *column = newlines ? tailWidth : *column + tailWidth;
+}
+
+void measureUnit(const wchar_t *text, DocumentUnit *unit) {
+    unit->newlines = 0;
+    unit->tailWidth = 0;
+    for (int i = unit->start; i < unit->start + unit->length; i++) {
+        if (text[i] == L'\n') {
+            unit->newlines++;
+            unit->tailWidth = 0;
+        } else {
+            unit->tailWidth += characterWidth(text[i]);
+        }
+    }
+}
+
+// Recomputes the block's totals after its units changed
+void measureBlock(DocumentBlock *block) {
+    block->newlines = 0;
+    block->tailWidth = 0;
+    for (int i = 0; i < block->unitCount; i++) {
+        advancePosition(&block->newlines, &block->tailWidth, block->units[i].newlines, block->units[i].tailWidth);
+    }
+    block->analyzed = 0;
+}
+
+void clearDefinitions(DocumentUnit *unit) {
+    for (int i = 0; i < unit->definitionCount; i++) {
+        free(unit->definitions[i].name);
+    }
+    free(unit->definitions);
+    unit->definitions = NULL;
+    unit->definitionCount = 0;
+}
+
+void releaseUnit(DocumentUnit *unit) {
+    if (unit->tokens) {
+        freeTokens(unit->tokens);
+    }
+    clearDiagnostics(&unit->diagnostics);
+    free(unit->diagnostics.items);
+    clearDefinitions(unit);
+}
+
+void releaseBlock(DocumentBlock *block) {
+    for (int i = 0; i < block->unitCount; i++) {
+        releaseUnit(&block->units[i]);
+    }
+    free(block->units);
+    free(block->text);
+}
+
+// Makes room for length characters and the terminating null
+void reserveText(DocumentBlock *block, int length) {
+    if (length + 1 <= block->capacity) {
+        return;
+    }
+    int capacity = block->capacity ? block->capacity : 256;
+    while (capacity < length + 1) {
+        capacity *= 2;
+    }
+    wchar_t *text = realloc(block->text, capacity * sizeof(wchar_t));
+    if (!text) {
+        documentOutOfMemory();
+    }
+    block->text = text;
+    block->capacity = capacity;
+}
+
+void reserveUnits(DocumentBlock *block, int count) {
+    if (count <= block->unitCapacity) {
+        return;
+    }
+    int capacity = block->unitCapacity ? block->unitCapacity : 16;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    DocumentUnit *units = realloc(block->units, capacity * sizeof(DocumentUnit));
+    if (!units) {
+        documentOutOfMemory();
+    }
+    block->units = units;
+    block->unitCapacity = capacity;
+}
+
+void reserveBlocks(Document *document, int count) {
+    if (count <= document->blockCapacity) {
+        return;
+    }
+    int capacity = document->blockCapacity ? document->blockCapacity : 16;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    DocumentBlock *blocks = realloc(document->blocks, capacity * sizeof(DocumentBlock));
+    if (!blocks) {
+        documentOutOfMemory();
+    }
+    document->blocks = blocks;
+    document->blockCapacity = capacity;
+}
+
+// Appends the next block's text and units to the block. The appended units
+// start at base, which during an edit is where the next block began before
+// the edit changed this block's length.
+void mergeNextBlock(Document *document, int index, int base) {
+    DocumentBlock *block = &document->blocks[index];
+    DocumentBlock *next = &document->blocks[index + 1];
+    reserveText(block, block->length + next->length);
+    wmemcpy(block->text + block->length, next->text, next->length + 1);
+    block->length += next->length;
+    reserveUnits(block, block->unitCount + next->unitCount);
+    for (int i = 0; i < next->unitCount; i++) {
+        block->units[block->unitCount] = next->units[i];
+        block->units[block->unitCount++].start += base;
+    }
+    free(next->text);
+    free(next->units);
+    memmove(next, next + 1, (document->blockCount - index - 2) * sizeof(DocumentBlock));
+    document->blockCount--;
+    block->analyzed = 0;
+}
+
+// Cuts a block that has grown past twice BLOCK_UNITS into blocks of BLOCK_UNITS
+void splitBlock(Document *document, int index) {
+    if (document->blocks[index].unitCount <= 2 * BLOCK_UNITS) {
+        return;
+    }
+    int pieces = (document->blocks[index].unitCount + BLOCK_UNITS - 1) / BLOCK_UNITS;
+    reserveBlocks(document, document->blockCount + pieces - 1);
+    DocumentBlock *block = &document->blocks[index];
+    memmove(block + pieces, block + 1, (document->blockCount - index - 1) * sizeof(DocumentBlock));
+    document->blockCount += pieces - 1;
+
+    for (int i = 1; i < pieces; i++) {
+        DocumentBlock *piece = &block[i];
+        memset(piece, 0, sizeof(DocumentBlock));
+        DocumentUnit *units = &block->units[i * BLOCK_UNITS];
+        int count = block->unitCount - i * BLOCK_UNITS < BLOCK_UNITS ? block->unitCount - i * BLOCK_UNITS : BLOCK_UNITS;
+        int start = units[0].start;
+        int end = units[count - 1].start + units[count - 1].length;
+        reserveText(piece, end - start);
+        wmemcpy(piece->text, block->text + start, end - start);
+        piece->text[end - start] = L'\0';
+        piece->length = end - start;
+        reserveUnits(piece, count);
+        memcpy(piece->units, units, count * sizeof(DocumentUnit));
+        for (int j = 0; j < count; j++) {
+            piece->units[j].start -= start;
+        }
+        piece->unitCount = count;
+        measureBlock(piece);
+    }
+    block->length = block->units[BLOCK_UNITS].start;
+    block->text[block->length] = L'\0';
+    block->unitCount = BLOCK_UNITS;
+    measureBlock(block);
+}
+
+void initDocument(Document *document, const wchar_t *text, int length) {
+    memset(document, 0, sizeof(Document));
+    editDocument(document, 0, 0, text, length);
+}
+
+void freeDocument(Document *document) {
+    for (int i = 0; i < document->blockCount; i++) {
+        releaseBlock(&document->blocks[i]);
+    }
+    free(document->blocks);
+    memset(document, 0, sizeof(Document));
+}
+
+void editDocument(Document *document, int start, int end, const wchar_t *text, int length) {
+    if (start < 0) {
+        start = 0;
+    }
+    if (end > document->length) {
+        end = document->length;
+    }
+    if (end < start) {
+        end = start;
+    }
+    if (document->blockCount == 0) {
+        reserveBlocks(document, 1);
+        memset(&document->blocks[0], 0, sizeof(DocumentBlock));
+        reserveText(&document->blocks[0], 0);
+        document->blocks[0].text[0] = L'\0';
+        document->blockCount = 1;
+    }
+
+    // Find the block holding the edit, folding in the blocks it spans
+    int index = 0;
+    int blockStart = 0;
+    while (index < document->blockCount - 1 && blockStart + document->blocks[index].length <= start) {
+        blockStart += document->blocks[index++].length;
+    }
+    while (index < document->blockCount - 1 && blockStart + document->blocks[index].length < end) {
+        mergeNextBlock(document, index, document->blocks[index].length);
+    }
+    DocumentBlock *block = &document->blocks[index];
+    start -= blockStart;
+    end -= blockStart;
+    int delta = length - (end - start);
+
+    // Splice the new text in, keeping the terminating null
+    reserveText(block, block->length + delta);
+    wmemmove(block->text + start + length, block->text + end, block->length - end + 1);
+    wmemcpy(block->text + start, text, length);
+    block->length += delta;
+    document->length += delta;
+
+    // The first unit the edit touches; text added at the very end joins the last unit
+    int first = 0;
+    while (first < block->unitCount && block->units[first].start + block->units[first].length <= start) {
+        first++;
+    }
+    if (first == block->unitCount && first > 0) {
+        first--;
+    }
+    // Units from here on lie after the edit and still hold the same text
+    int kept = first;
+    while (kept < block->unitCount && block->units[kept].start < end) {
+        kept++;
+    }
+
+    // Cut new units until one ends where a kept unit now starts
+    DocumentUnit *fresh = NULL;
+    int freshCount = 0;
+    int freshCapacity = 0;
+    int position = first < block->unitCount ? block->units[first].start : 0;
+    int resynced = 0;
+    while (position < block->length && !resynced) {
+        int complete;
+        int next = unitEnd(block->text, position, block->length, &complete);
+        if (!complete && index + 1 < document->blockCount) {
+            // The unit runs on into the next block
+            mergeNextBlock(document, index, block->length - delta);
+            continue;
+        }
+        if (freshCount == freshCapacity) {
+            freshCapacity = freshCapacity ? freshCapacity * 2 : 4;
+            fresh = realloc(fresh, freshCapacity * sizeof(DocumentUnit));
+            if (!fresh) {
+                documentOutOfMemory();
+            }
+        }
+        DocumentUnit *unit = &fresh[freshCount++];
+        memset(unit, 0, sizeof(DocumentUnit));
+        unit->start = position;
+        unit->length = next - position;
+        measureUnit(block->text, unit);
+        position = next;
+
+        while (kept < block->unitCount && block->units[kept].start + delta < position) {
+            kept++;
+        }
+        resynced = kept < block->unitCount && block->units[kept].start + delta == position;
+    }
+    if (!resynced) {
+        kept = block->unitCount;
+    }
+
+    // Replace the units in [first, kept) with the new ones
+    for (int i = first; i < kept; i++) {
+        releaseUnit(&block->units[i]);
+    }
+    int tail = block->unitCount - kept;
+    reserveUnits(block, first + freshCount + tail);
+    memmove(&block->units[first + freshCount], &block->units[kept], tail * sizeof(DocumentUnit));
+    memcpy(&block->units[first], fresh, freshCount * sizeof(DocumentUnit));
+    block->unitCount = first + freshCount + tail;
+    for (int i = first + freshCount; i < block->unitCount; i++) {
+        block->units[i].start += delta;
+    }
+    free(fresh);
+    measureBlock(block);
+
+    if (block->unitCount == 0 && document->blockCount > 1) {
+        releaseBlock(block);
+        memmove(block, block + 1, (document->blockCount - index - 1) * sizeof(DocumentBlock));
+        document->blockCount--;
+    } else {
+        splitBlock(document, index);
+    }
+}
+
+uint64_t hashDefinition(uint64_t hash, const wchar_t *name, int paramCount) {
+    for (; *name; name++) {
+        hash = (hash ^ (uint64_t)*name) * 1099511628211ULL;
+    }
+    return (hash ^ (uint64_t)(paramCount + 1)) * 1099511628211ULL;
+}
+
+// Remembers the functions the unit defined, so that a later analysis can
+// reuse the unit without parsing it again.
+void recordDefinitions(DocumentUnit *unit) {
+    clearDefinitions(unit);
+    for (int i = 0; unit->tokens && i + 1 < unit->tokenCount; i++) {
+        if (unit->tokens[i].type != TOKEN_FUNCTION || unit->tokens[i + 1].type != TOKEN_VARIABLE) {
+            continue;
+        }
+        for (int j = 0; j < functionCount; j++) {
+            if (functions[j].paramCount >= 0 && wcscmp(functions[j].name, unit->tokens[i + 1].varName) == 0) {
+                UnitDefinition *definitions = realloc(unit->definitions, (unit->definitionCount + 1) * sizeof(UnitDefinition));
+                wchar_t *name = wcsdup(functions[j].name);
+                if (!definitions || !name) {
+                    documentOutOfMemory();
+                }
+                unit->definitions = definitions;
+                unit->definitions[unit->definitionCount].name = name;
+                unit->definitions[unit->definitionCount].paramCount = functions[j].paramCount;
+                unit->definitionCount++;
+                break;
+            }
+        }
+    }
+}
+
+// The text being lexed, freed if an error cuts lexing short
+wchar_t *unitText = NULL;
+
+void parseUnit(DocumentBlock *block, DocumentUnit *unit) {
+    truncateDiagnostics(&unit->diagnostics, unit->tokens ? unit->lexerDiagnosticCount : 0);
+    diagnosticList = &unit->diagnostics;
+    tokens = NULL;
+    scriptRunning = 1;
+    if (setjmp(scriptRecovery) == 0) {
+        if (!unit->tokens) {
+            // The lexer looks ahead up to a null, so it gets the unit on its own
+            unitText = malloc((unit->length + 1) * sizeof(wchar_t));
+            if (!unitText) {
+                documentOutOfMemory();
+            }
+            wmemcpy(unitText, block->text + unit->start, unit->length);
+            unitText[unit->length] = L'\0';
+            unit->tokens = tokenizeRange(unitText, NULL, &unit->tokenCount);
+            unit->lexerDiagnosticCount = unit->diagnostics.count;
+            free(unitText);
+            unitText = NULL;
+        }
+        tokens = unit->tokens;
+        resetParser();
+        collectParseErrors(NULL);
+    } else {
+        // Only running out of memory ends up here
+        free(unitText);
+        unitText = NULL;
+        discardParsedNodes();
+        if (unit->diagnostics.count == 0) {
+            scriptRunning = 0;
+            addDiagnostic(&unit->diagnostics, 0, L"Statement could not be checked");
+        }
+    }
+    scriptRunning = 0;
+    diagnosticList = NULL;
+    recordDefinitions(unit);
+    unit->parsed = 1;
+}
+
+void replayDefinition(UnitDefinition *definition) {
+    scriptRunning = 1;
+    if (setjmp(scriptRecovery) == 0) {
+        functions[declareFunction(definition->name)].paramCount = definition->paramCount;
+    }
+    scriptRunning = 0;
+}
+
+// Makes the unit's functions known to the units after it, as parsing it would
+void replayDefinitions(DocumentUnit *unit) {
+    for (int i = 0; i < unit->definitionCount; i++) {
+        replayDefinition(&unit->definitions[i]);
+    }
+}
+
+void analyzeDocument(Document *document) {
+    freeFunctions();
+    uint64_t context = CONTEXT_HASH_START;
+    for (int i = 0; i < document->blockCount; i++) {
+        DocumentBlock *block = &document->blocks[i];
+        if (block->analyzed && block->contextIn == context) {
+            for (int j = 0; j < block->unitCount && block->definitionCount > 0; j++) {
+                replayDefinitions(&block->units[j]);
+            }
+            context = block->contextOut;
+            continue;
+        }
+
+        block->contextIn = context;
+        block->diagnosticCount = 0;
+        block->definitionCount = 0;
+        for (int j = 0; j < block->unitCount; j++) {
+            DocumentUnit *unit = &block->units[j];
+            if (unit->parsed && unit->context == context) {
+                replayDefinitions(unit);
+            } else {
+                parseUnit(block, unit);
+                unit->context = context;
+            }
+            for (int k = 0; k < unit->definitionCount; k++) {
+                context = hashDefinition(context, unit->definitions[k].name, unit->definitions[k].paramCount);
+            }
+            block->diagnosticCount += unit->diagnostics.count;
+            block->definitionCount += unit->definitionCount;
+        }
+        block->contextOut = context;
+        block->analyzed = 1;
+    }
+    tokens = NULL;
+}
+
+int documentOffset(Document *document, int line, int column) {
+    int currentLine = 0;
+    int currentColumn = 0;
+    int offset = 0;
+    for (int i = 0; i < document->blockCount; i++) {
+        DocumentBlock *block = &document->blocks[i];
+        // Skip the blocks, then the units, that end on an earlier line
+        if (currentLine + block->newlines < line) {
+            advancePosition(&currentLine, &currentColumn, block->newlines, block->tailWidth);
+            offset += block->length;
+            continue;
+        }
+        int position = 0;
+        for (int j = 0; j < block->unitCount && currentLine + block->units[j].newlines < line; j++) {
+            advancePosition(&currentLine, &currentColumn, block->units[j].newlines, block->units[j].tailWidth);
+            position = block->units[j].start + block->units[j].length;
+        }
+        for (; position < block->length; position++) {
+            if (currentLine == line && currentColumn >= column) {
+                return offset + position;
+            }
+            if (block->text[position] == L'\n') {
+                if (currentLine == line) {
+                    return offset + position; // Columns past the end of a line mean its end
+                }
+                currentLine++;
+                currentColumn = 0;
+            } else {
+                currentColumn += characterWidth(block->text[position]);
+            }
+        }
+        offset += block->length;
+    }
+    return document->length;
+}
+
+void forEachDiagnostic(Document *document, DiagnosticVisitor visit, void *context) {
+    int line = 0;
+    int column = 0;
+    for (int i = 0; i < document->blockCount; i++) {
+        DocumentBlock *block = &document->blocks[i];
+        int unitLine = line;
+        int unitColumn = column;
+        for (int j = 0; j < block->unitCount && block->diagnosticCount > 0; j++) {
+            DocumentUnit *unit = &block->units[j];
+            const wchar_t *text = block->text + unit->start;
+            for (int k = 0; k < unit->diagnostics.count; k++) {
+                Diagnostic *diagnostic = &unit->diagnostics.items[k];
+                int lines = 0;
+                int width = 0;
+                for (int n = 0; n < diagnostic->offset && n < unit->length; n++) {
+                    if (text[n] == L'\n') {
+                        lines++;
+                        width = 0;
+                    } else {
+                        width += characterWidth(text[n]);
+                    }
+                }
+                visit(context, unitLine + lines, lines ? width : unitColumn + width, diagnostic->message);
+            }
+            advancePosition(&unitLine, &unitColumn, unit->newlines, unit->tailWidth);
+        }
+        advancePosition(&line, &column, block->newlines, block->tailWidth);
+    }
+}
@@ -0,0 +1,80 @@
+// document.h
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <stdint.h>
+#include <wchar.h>
+#include "lexer.h"
+#include "diagnostic.h"
+
+// A function a unit defines, replayed when the unit's parse is reused
+typedef struct {
+    wchar_t *name;
+    int paramCount;
+} UnitDefinition;
+
+// A document is cut into units: top-level statements ending in ';', or
+// function definitions ending in their closing '}'. Each unit is lexed and
+// parsed on its own, so an edit only redoes the units it touches.
+typedef struct {
+    int start;          // Offset of the unit in its block's text
+    int length;
+    int newlines;       // Line breaks inside the unit
+    int tailWidth;      // UTF-16 units after the last line break, or in the whole unit
+    Token *tokens;      // NULL until lexed
+    int tokenCount;
+    int parsed;         // diagnostics and definitions are up to date
+    uint64_t context;   // Hash of the functions defined before the unit when it was parsed
+    DiagnosticList diagnostics; // Offsets relative to the unit
+    int lexerDiagnosticCount;   // The first ones, which stay with the tokens
+    UnitDefinition *definitions;
+    int definitionCount;
+} DocumentUnit;
+
+// Units are grouped into blocks that own their text. An edit only moves the
+// text of its own block, and walks over the document skip whole blocks by
+// their totals.
+typedef struct {
+    wchar_t *text;      // Null-terminated
+    int length;
+    int capacity;
+    DocumentUnit *units;
+    int unitCount;
+    int unitCapacity;
+    int newlines;
+    int tailWidth;
+    int analyzed;       // Every unit was parsed with contextIn before it
+    uint64_t contextIn;
+    uint64_t contextOut;
+    int diagnosticCount;
+    int definitionCount;
+} DocumentBlock;
+
+typedef struct {
+    DocumentBlock *blocks;
+    int blockCount;
+    int blockCapacity;
+    int length;
+} Document;
+
+void initDocument(Document *document, const wchar_t *text, int length);
+void freeDocument(Document *document);
+
+// Replaces the characters in [start, end) with text. Units before the edit
+// are kept, units after it are kept and shifted once the new text reaches
+// one of their boundaries again, and only the units in between are redone.
+void editDocument(Document *document, int start, int end, const wchar_t *text, int length);
+
+// Lexes and parses the units that changed, or whose earlier function
+// definitions changed, without running anything.
+void analyzeDocument(Document *document);
+
+// Positions are zero-based lines and UTF-16 columns, as editors count them
+int documentOffset(Document *document, int line, int column);
+
+typedef void (*DiagnosticVisitor)(void *context, int line, int column, const wchar_t *message);
+
+// Calls visit for every diagnostic of the last analysis, unit by unit
+void forEachDiagnostic(Document *document, DiagnosticVisitor visit, void *context);
+
+#endif // DOCUMENT_H
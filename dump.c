@@ -0,0 +1,545 @@
+#include "dump.h"
+#include "json.h"
+#include "cache.h"
+#include "diagnostic.h"
+#include "interpreter.h"
+#include "parser.h"
+#include <inttypes.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DUMP_FLUSH_SIZE 65536
+
+DumpFormat dumpFormat = DUMP_NONE;
+
+// Names used in JSON dumps, by TokenType and NodeKind
+const char *dumpTokenNames[] = {
+    "INT", "DOUBLE", "PLUS", "MINUS", "STAR", "SLASH", "LPAREN", "RPAREN", "VARIABLE", "STRING",
+    "EOF", "FOR", "IF", "ELSE", "WHILE", "RETURN", "MODULUS", "EXPONENT", "EQUAL_TO", "LESS_THAN",
+    "GREATER_THAN", "AND", "OR", "INCREMENT_BY", "MULTIPLY_BY", "DECREASE_BY", "DIVIDE_BY", "MOD_BY",
+    "NOT_EQUAL_TO", "LESS_THAN_OR_EQUAL_TO", "GREATER_THAN_OR_EQUAL_TO", "COMMA", "SEMICOLON", "PERIOD",
+    "COLON", "QUESTION_MARK", "EXCLAMATION_MARK", "LEFT_BRACKET", "RIGHT_BRACKET", "COMMENT", "PRINT",
+    "ERROR", "ASSIGNMENT", "FUNCTION", "LEFT_BRACE", "RIGHT_BRACE"
+};
+
+const char *dumpNodeNames[] = {
+    "LITERAL", "GLOBAL", "LOCAL", "BINARY", "CALL", "BUILTIN", "ARRAY", "INDEX", "ASSIGN", "PRINT",
+    "RETURN", "EXPRESSION", "FOR", "LOOP_INDEX", "CAPTURED"
+};
+
+// Strings of a binary dump, numbered in the order they first appear. The
+// intern table finds repeats; its offsets grow with each new string, so a
+// string's number is found by searching them.
+typedef struct {
+    InternTable table;
+    uint64_t *offsets;
+    size_t count;
+    size_t capacity;
+    JsonWriter bytes;
+} DumpStrings;
+
+// State of the dump being written, for the statements the parser hands over
+_Thread_local JsonWriter dumpText = {0};        // JSON lines, flushed as they grow
+_Thread_local DumpStrings dumpStrings = {0};
+_Thread_local JsonWriter dumpStatements = {0};   // Binary sections
+_Thread_local uint64_t dumpStatementCount = 0;
+
+void dumpOutOfMemory() {
+    fwprintf(scriptErrors, L"Failed to allocate memory for the dump\n");
+    abortScript();
+}
+
+void flushDump(JsonWriter *writer) {
+    fwrite(writer->data, 1, writer->length, stdout);
+    writer->length = 0;
+}
+
+void writeVarint(JsonWriter *writer, uint64_t number) {
+    char bytes[10];
+    int length = 0;
+    do {
+        bytes[length] = (char)(number & 0x7F);
+        number >>= 7;
+        if (number) {
+            bytes[length] |= (char)0x80;
+        }
+        length++;
+    } while (number);
+    writeBytes(writer, bytes, length);
+}
+
+void writeSignedVarint(JsonWriter *writer, int64_t number) {
+    writeVarint(writer, ((uint64_t)number << 1) ^ (uint64_t)(number >> 63));
+}
+
+void writeByte(JsonWriter *writer, int byte) {
+    char value = (char)byte;
+    writeBytes(writer, &value, 1);
+}
+
+void writeDouble(JsonWriter *writer, double number) {
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    char bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (char)(bits >> (8 * i));
+    }
+    writeBytes(writer, bytes, sizeof(bytes));
+}
+
+void writeDumpString(JsonWriter *writer, const wchar_t *string) {
+    size_t used = dumpStrings.table.used;
+    uint64_t offset = internString(&dumpStrings.table, string);
+    if (dumpStrings.table.used > used) {
+        if (dumpStrings.count == dumpStrings.capacity) {
+            dumpStrings.capacity = dumpStrings.capacity ? dumpStrings.capacity * 2 : 64;
+            dumpStrings.offsets = realloc(dumpStrings.offsets, dumpStrings.capacity * sizeof(uint64_t));
+            if (!dumpStrings.offsets) {
+                dumpOutOfMemory();
+            }
+        }
+        dumpStrings.offsets[dumpStrings.count] = offset;
+        writeVarint(writer, dumpStrings.count++);
+
+        char bytes[4];
+        uint64_t length = 0;
+        for (const wchar_t *c = string; *c; c++) {
+            length += encodeUtf8((uint32_t)*c, bytes);
+        }
+        writeVarint(&dumpStrings.bytes, length);
+        for (const wchar_t *c = string; *c; c++) {
+            writeBytes(&dumpStrings.bytes, bytes, encodeUtf8((uint32_t)*c, bytes));
+        }
+        return;
+    }
+    size_t low = 0;
+    size_t high = dumpStrings.count;
+    while (low + 1 < high) {
+        size_t middle = (low + high) / 2;
+        if (dumpStrings.offsets[middle] <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    writeVarint(writer, low);
+}
+
+void writeJsonInt64(JsonWriter *writer, int64_t number) {
+    char digits[24];
+    writeBytes(writer, digits, snprintf(digits, sizeof(digits), "%" PRId64, number));
+}
+
+void writeJsonDouble(JsonWriter *writer, double number) {
+    if (!isfinite(number)) {
+        writeText(writer, "null"); // JSON has no infinity
+        return;
+    }
+    char digits[32];
+    writeBytes(writer, digits, snprintf(digits, sizeof(digits), "%.17g", number));
+}
+
+// Paths are bytes in the locale's encoding; they are quoted as they are
+void writeJsonPath(JsonWriter *writer, const char *path) {
+    writeBytes(writer, "\"", 1);
+    for (; *path; path++) {
+        char bytes[8];
+        int length = 0;
+        if (*path == '"' || *path == '\\') {
+            bytes[length++] = '\\';
+            bytes[length++] = *path;
+        } else if ((unsigned char)*path < 0x20) {
+            length = snprintf(bytes, sizeof(bytes), "\\u%04x", (unsigned char)*path);
+        } else {
+            bytes[length++] = *path;
+        }
+        writeBytes(writer, bytes, length);
+    }
+    writeBytes(writer, "\"", 1);
+}
+
+void writeJsonToken(JsonWriter *writer, Token token) {
+    writeText(writer, "{\"token\":\"");
+    writeText(writer, dumpTokenNames[token.type]);
+    writeText(writer, "\",\"offset\":");
+    writeInt(writer, token.offset);
+    if (token.type == TOKEN_INT) {
+        writeText(writer, ",\"value\":");
+        writeJsonInt64(writer, token.intValue);
+    } else if (token.type == TOKEN_DOUBLE) {
+        writeText(writer, ",\"value\":");
+        writeJsonDouble(writer, token.doubleValue);
+    } else if (token.type == TOKEN_VARIABLE || token.type == TOKEN_CHAR) {
+        writeText(writer, ",\"text\":");
+        writeJsonString(writer, token.varName);
+    }
+    writeText(writer, "}\n");
+}
+
+void writeBinaryToken(JsonWriter *writer, Token token, int previousOffset) {
+    writeByte(writer, token.type);
+    writeVarint(writer, (uint64_t)(token.offset - previousOffset));
+    if (token.type == TOKEN_INT) {
+        writeSignedVarint(writer, token.intValue);
+    } else if (token.type == TOKEN_DOUBLE) {
+        writeDouble(writer, token.doubleValue);
+    } else if (token.type == TOKEN_VARIABLE || token.type == TOKEN_CHAR) {
+        writeDumpString(writer, token.varName);
+    }
+}
+
+const wchar_t *calledName(Node *node) {
+    return node->kind == NODE_BUILTIN ? builtins[node->slot].name : functions[node->slot].name;
+}
+
+void writeJsonNode(JsonWriter *writer, Node *node);
+
+void writeJsonMember(JsonWriter *writer, const char *key, Node *node) {
+    writeText(writer, ",\"");
+    writeText(writer, key);
+    writeText(writer, "\":");
+    writeJsonNode(writer, node);
+}
+
+void writeJsonNodes(JsonWriter *writer, Node **nodes, int count) {
+    writeText(writer, "[");
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            writeText(writer, ",");
+        }
+        writeJsonNode(writer, nodes[i]);
+    }
+    writeText(writer, "]");
+}
+
+void writeJsonNode(JsonWriter *writer, Node *node) {
+    writeText(writer, "{\"kind\":\"");
+    writeText(writer, dumpNodeNames[node->kind]);
+    writeText(writer, "\",\"offset\":");
+    writeInt(writer, node->offset);
+    switch (node->kind) {
+        case NODE_LITERAL:
+            writeText(writer, ",\"value\":");
+            if (valueIsInt(node->value)) {
+                writeJsonInt64(writer, valueAsInt(node->value));
+            } else if (valueIsDouble(node->value)) {
+                writeJsonDouble(writer, valueAsDouble(node->value));
+            } else {
+                writeJsonString(writer, valueAsString(node->value));
+            }
+            break;
+        case NODE_LOCAL:
+        case NODE_CAPTURED:
+            writeText(writer, ",\"slot\":");
+            writeInt(writer, node->slot);
+            // fall through
+        case NODE_GLOBAL:
+        case NODE_LOOP_INDEX:
+            writeText(writer, ",\"name\":");
+            writeJsonString(writer, node->name);
+            break;
+        case NODE_BINARY:
+            writeText(writer, ",\"op\":\"");
+            writeText(writer, dumpTokenNames[node->op]);
+            writeText(writer, "\"");
+            writeJsonMember(writer, "left", node->left);
+            writeJsonMember(writer, "right", node->right);
+            break;
+        case NODE_CALL:
+        case NODE_BUILTIN:
+            writeText(writer, ",\"name\":");
+            writeJsonString(writer, calledName(node));
+            // fall through
+        case NODE_ARRAY:
+            writeText(writer, ",\"args\":");
+            writeJsonNodes(writer, node->args, node->argCount);
+            break;
+        case NODE_INDEX:
+            writeJsonMember(writer, "array", node->left);
+            writeJsonMember(writer, "index", node->right);
+            break;
+        case NODE_ASSIGN:
+            writeText(writer, ",\"op\":\"");
+            writeText(writer, dumpTokenNames[node->op]);
+            writeText(writer, "\"");
+            writeJsonMember(writer, "target", node->target);
+            writeJsonMember(writer, "value", node->left);
+            break;
+        case NODE_FOR:
+            writeText(writer, ",\"variable\":");
+            writeJsonString(writer, node->name);
+            writeJsonMember(writer, "from", node->left);
+            writeJsonMember(writer, "to", node->right);
+            writeText(writer, ",\"captures\":");
+            writeJsonNodes(writer, node->args, node->argCount);
+            writeText(writer, ",\"body\":[");
+            for (Node *statement = node->body; statement; statement = statement->next) {
+                if (statement != node->body) {
+                    writeText(writer, ",");
+                }
+                writeJsonNode(writer, statement);
+            }
+            writeText(writer, "]");
+            break;
+        default:
+            if (node->left) {
+                writeJsonMember(writer, "value", node->left);
+            }
+            break;
+    }
+    writeText(writer, "}");
+}
+
+// Nodes are written in preorder: the kind, the offset, then the fields and
+// children the kind has, in the order of the JSON form
+void writeBinaryNode(JsonWriter *writer, Node *node) {
+    writeByte(writer, node->kind);
+    writeVarint(writer, (uint64_t)node->offset);
+    switch (node->kind) {
+        case NODE_LITERAL:
+            writeByte(writer, valueType(node->value));
+            if (valueIsInt(node->value)) {
+                writeSignedVarint(writer, valueAsInt(node->value));
+            } else if (valueIsDouble(node->value)) {
+                writeDouble(writer, valueAsDouble(node->value));
+            } else {
+                writeDumpString(writer, valueAsString(node->value));
+            }
+            break;
+        case NODE_LOCAL:
+        case NODE_CAPTURED:
+            writeVarint(writer, (uint64_t)node->slot);
+            // fall through
+        case NODE_GLOBAL:
+        case NODE_LOOP_INDEX:
+            writeDumpString(writer, node->name);
+            break;
+        case NODE_BINARY:
+            writeByte(writer, node->op);
+            writeBinaryNode(writer, node->left);
+            writeBinaryNode(writer, node->right);
+            break;
+        case NODE_CALL:
+        case NODE_BUILTIN:
+            writeDumpString(writer, calledName(node));
+            // fall through
+        case NODE_ARRAY:
+            writeVarint(writer, (uint64_t)node->argCount);
+            for (int i = 0; i < node->argCount; i++) {
+                writeBinaryNode(writer, node->args[i]);
+            }
+            break;
+        case NODE_INDEX:
+            writeBinaryNode(writer, node->left);
+            writeBinaryNode(writer, node->right);
+            break;
+        case NODE_ASSIGN:
+            writeByte(writer, node->op);
+            writeBinaryNode(writer, node->target);
+            writeBinaryNode(writer, node->left);
+            break;
+        case NODE_FOR:
+            {
+                writeDumpString(writer, node->name);
+                writeBinaryNode(writer, node->left);
+                writeBinaryNode(writer, node->right);
+                writeVarint(writer, (uint64_t)node->argCount);
+                for (int i = 0; i < node->argCount; i++) {
+                    writeBinaryNode(writer, node->args[i]);
+                }
+                uint64_t count = 0;
+                for (Node *statement = node->body; statement; statement = statement->next) {
+                    count++;
+                }
+                writeVarint(writer, count);
+                for (Node *statement = node->body; statement; statement = statement->next) {
+                    writeBinaryNode(writer, statement);
+                }
+                break;
+            }
+        case NODE_RETURN:
+            writeByte(writer, node->left != NULL);
+            if (node->left) {
+                writeBinaryNode(writer, node->left);
+            }
+            break;
+        default:
+            writeBinaryNode(writer, node->left);
+            break;
+    }
+}
+
+void dumpStatement(Node *statement) {
+    if (dumpFormat == DUMP_JSON) {
+        writeText(&dumpText, "{\"statement\":");
+        writeJsonNode(&dumpText, statement);
+        writeText(&dumpText, "}\n");
+        if (dumpText.length >= DUMP_FLUSH_SIZE) {
+            flushDump(&dumpText);
+        }
+    } else {
+        writeBinaryNode(&dumpStatements, statement);
+        dumpStatementCount++;
+    }
+}
+
+void dumpJson(DiagnosticList *errors) {
+    JsonWriter *writer = &dumpText;
+    for (Token *token = tokens; token->type != TOKEN_EOF; token++) {
+        writeJsonToken(writer, *token);
+        if (writer->length >= DUMP_FLUSH_SIZE) {
+            flushDump(writer);
+        }
+    }
+    flushDump(writer);
+    collectParseErrors(dumpStatement);
+
+    for (int i = 0; i < functionCount; i++) {
+        if (functions[i].paramCount < 0) {
+            continue; // Called but never defined
+        }
+        writeText(writer, "{\"function\":");
+        writeJsonString(writer, functions[i].name);
+        writeText(writer, ",\"params\":");
+        writeInt(writer, functions[i].paramCount);
+        writeText(writer, ",\"locals\":");
+        writeInt(writer, functions[i].localCount);
+        writeText(writer, ",\"body\":[");
+        for (Node *statement = functions[i].body; statement; statement = statement->next) {
+            writeJsonNode(writer, statement);
+            if (statement->next) {
+                writeText(writer, ",");
+            }
+        }
+        writeText(writer, "]}\n");
+    }
+    sortDiagnostics(errors);
+    for (int i = 0; i < errors->count; i++) {
+        writeText(writer, "{\"error\":");
+        writeJsonString(writer, errors->items[i].message);
+        writeText(writer, ",\"offset\":");
+        writeInt(writer, errors->items[i].offset);
+        writeText(writer, "}\n");
+    }
+}
+
+void dumpBinary(const char *name, DiagnosticList *errors) {
+    JsonWriter tokenBytes = {0};
+    uint64_t tokenCount = 0;
+    int previousOffset = 0;
+    for (Token *token = tokens; token->type != TOKEN_EOF; token++) {
+        writeBinaryToken(&tokenBytes, *token, previousOffset);
+        previousOffset = token->offset;
+        tokenCount++;
+    }
+    collectParseErrors(dumpStatement);
+
+    JsonWriter rest = {0};
+    uint64_t definedCount = 0;
+    for (int i = 0; i < functionCount; i++) {
+        definedCount += functions[i].paramCount >= 0;
+    }
+    writeVarint(&rest, definedCount);
+    for (int i = 0; i < functionCount; i++) {
+        if (functions[i].paramCount < 0) {
+            continue;
+        }
+        writeDumpString(&rest, functions[i].name);
+        writeVarint(&rest, (uint64_t)functions[i].paramCount);
+        writeVarint(&rest, (uint64_t)functions[i].localCount);
+        uint64_t statementCount = 0;
+        for (Node *statement = functions[i].body; statement; statement = statement->next) {
+            statementCount++;
+        }
+        writeVarint(&rest, statementCount);
+        for (Node *statement = functions[i].body; statement; statement = statement->next) {
+            writeBinaryNode(&rest, statement);
+        }
+    }
+    sortDiagnostics(errors);
+    writeVarint(&rest, (uint64_t)errors->count);
+    for (int i = 0; i < errors->count; i++) {
+        writeVarint(&rest, (uint64_t)errors->items[i].offset);
+        writeDumpString(&rest, errors->items[i].message);
+    }
+
+    JsonWriter *writer = &dumpText;
+    writeBytes(writer, DUMP_MAGIC, strlen(DUMP_MAGIC));
+    writeByte(writer, DUMP_VERSION);
+    writeVarint(writer, strlen(name));
+    writeText(writer, name);
+    writeVarint(writer, dumpStrings.count);
+    flushDump(writer);
+    flushDump(&dumpStrings.bytes);
+    writeVarint(writer, tokenCount);
+    flushDump(writer);
+    flushDump(&tokenBytes);
+    writeVarint(writer, dumpStatementCount);
+    flushDump(writer);
+    flushDump(&dumpStatements);
+    flushDump(&rest);
+    free(tokenBytes.data);
+    free(rest.data);
+}
+
+void clearDump() {
+    free(dumpText.data);
+    free(dumpStatements.data);
+    free(dumpStrings.table.data);
+    free(dumpStrings.table.slots);
+    free(dumpStrings.offsets);
+    free(dumpStrings.bytes.data);
+    dumpText = (JsonWriter){0};
+    dumpStatements = (JsonWriter){0};
+    dumpStrings = (DumpStrings){0};
+    dumpStatementCount = 0;
+}
+
+int dumpScript(Script script) {
+    const char *name = scriptName(script);
+    size_t length;
+    char *bytes = readScript(script, &length);
+    if (!bytes) {
+        return 1;
+    }
+
+    int failed = 0;
+    tokens = NULL;
+    resetParser();
+    scriptRunning = 1;
+    diagnosticList = &scriptDiagnostics;
+    if (setjmp(scriptRecovery) == 0) {
+        scriptInput = decodeScript(bytes, name);
+        tokens = tokenize(scriptInput);
+        if (dumpFormat == DUMP_JSON) {
+            writeText(&dumpText, "{\"script\":");
+            writeJsonPath(&dumpText, name);
+            writeText(&dumpText, "}\n");
+            dumpJson(&scriptDiagnostics);
+        } else {
+            dumpBinary(name, &scriptDiagnostics);
+        }
+        failed = scriptDiagnostics.count > 0;
+    } else {
+        failed = 1;
+    }
+    scriptRunning = 0;
+    diagnosticList = NULL;
+    flushDump(&dumpText);
+    fflush(stdout);
+
+    clearDiagnostics(&scriptDiagnostics);
+    clearDump();
+    resetInterpreter();
+    if (tokens) {
+        freeTokens(tokens);
+    }
+    tokens = NULL;
+    free(scriptInput);
+    scriptInput = NULL;
+    free(bytes);
+    return failed;
+}
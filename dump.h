@@ -0,0 +1,29 @@
+// dump.h
+#ifndef DUMP_H
+#define DUMP_H
+
+#include "script.h"
+
+typedef enum {
+    DUMP_NONE,
+    DUMP_JSON,   // One JSON object per line
+    DUMP_BINARY  // The compact form below
+} DumpFormat;
+
+extern DumpFormat dumpFormat; // Set by --dump
+
+// Binary dumps start with this, then the script's name, the string table,
+// the tokens, the top-level statements, the functions and the errors. Counts,
+// offsets and string numbers are unsigned LEB128 varints and integers are
+// zigzag varints; doubles are 8 little-endian bytes. Strings are UTF-8 and
+// stored once, then referred to by their number in the table. A token's
+// offset is the distance from the previous token's.
+#define DUMP_MAGIC "HBBDUMP"
+#define DUMP_VERSION 2
+
+// Lexes and parses one script without running it and writes its tokens,
+// syntax tree and lex or parse errors to standard output. Returns 0 if the
+// script was read and had no errors.
+int dumpScript(Script script);
+
+#endif // DUMP_H
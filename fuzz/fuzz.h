@@ -0,0 +1,77 @@
+// fuzz.h
+#ifndef FUZZ_H
+#define FUZZ_H
+
+// Shared by the fuzzing entry points. Each one defines LLVMFuzzerTestOneInput,
+// which libFuzzer and AFL++ call with every input. Built with
+// -DFUZZ_STANDALONE instead, the entry point gets a main that runs it on the
+// files named on the command line, or on standard input, so a corpus or a
+// crash can be replayed with any compiler.
+
+#define HABIBI_NO_MAIN
+#include "../main.c"
+
+#include <stdint.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Scripts are read as UTF-8, whatever the environment says
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    (void)argc;
+    (void)argv;
+    if (!setlocale(LC_CTYPE, "C.UTF-8")) {
+        setlocale(LC_CTYPE, "");
+    }
+    scriptOutput = stdout;
+    scriptErrors = stderr;
+    lexerThreadCount = 1;
+    useTokenCache = 0;
+    return 0;
+}
+
+// Copies the input into a null-terminated string; the script ends at the
+// first null byte, as it would when read from a file
+char *fuzzText(const uint8_t *data, size_t size) {
+    char *text = malloc(size + 1);
+    if (!text) {
+        abort();
+    }
+    memcpy(text, data, size);
+    text[size] = '\0';
+    return text;
+}
+
+#ifdef FUZZ_STANDALONE
+int runFuzzFile(FILE *file) {
+    size_t length;
+    char *bytes = readStream(file, &length);
+    if (!bytes) {
+        return 1;
+    }
+    LLVMFuzzerTestOneInput((const uint8_t *)bytes, length);
+    free(bytes);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    LLVMFuzzerInitialize(&argc, &argv);
+    if (argc == 1) {
+        return runFuzzFile(stdin);
+    }
+    for (int arg = 1; arg < argc; arg++) {
+        FILE *file = fopen(argv[arg], "rb");
+        if (!file) {
+            fwprintf(stderr, L"Error opening %s\n", argv[arg]);
+            return 1;
+        }
+        int failed = runFuzzFile(file);
+        fclose(file);
+        if (failed) {
+            return 1;
+        }
+    }
+    return 0;
+}
+#endif
+
+#endif // FUZZ_H
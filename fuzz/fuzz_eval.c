@@ -0,0 +1,128 @@
+// Fuzzes the whole interpreter. Every input runs as a script under each
+// engine configuration below, once with wrapping arithmetic and once with
+// --checked, and under each mode all of them must print the same output and
+// errors and succeed or fail alike. The first configuration is the reference
+// interpreter; faster engines are added to the table as they land, so they
+// are checked against it on every input.
+#include "fuzz.h"
+
+typedef struct {
+    const char *name;
+    void (*setup)(void);
+} EngineConfiguration;
+
+// Runs every node as the parser made it, every loop on one thread and the
+// array built-ins on the best vector level the CPU has
+void setupReference(void) {
+    vectorLevel = -1;
+    detectVectorLevel();
+    quickeningEnabled = 0;
+    fusionEnabled = 0;
+    jitEnabled = 0;
+    loopThreadCount = 1;
+    parallelMinIterations = PARALLEL_MIN_ITERATIONS;
+}
+
+// Specializes global variables and arithmetic for what they saw
+void setupQuickened(void) {
+    setupReference();
+    quickeningEnabled = 1;
+}
+
+// Runs statements of the commonest shapes as single operations
+void setupFused(void) {
+    setupReference();
+    fusionEnabled = 1;
+}
+
+// Compiles every function on its first call, and interprets the rest as
+// scripts normally are
+void setupJit(void) {
+    setupReference();
+    quickeningEnabled = 1;
+    fusionEnabled = 1;
+    jitEnabled = 1;
+    jitThreshold = 0;
+}
+
+// Splits every parallel loop, however short, across helper threads, whose
+// results must match one thread's
+void setupParallelLoops(void) {
+    setupReference();
+    loopThreadCount = 4;
+    parallelMinIterations = 1;
+}
+
+// Runs the array built-ins on SSE2 even where AVX2 is available. Sums, dot
+// products and extremes of doubles must round and pick exactly as AVX2 does.
+void setupSse2Vectors(void) {
+    setupReference();
+    if (vectorLevel > VECTOR_SSE2) vectorLevel = VECTOR_SSE2;
+}
+
+// Runs the array built-ins on their scalar loops
+void setupScalarVectors(void) {
+    setupReference();
+    vectorLevel = VECTOR_SCALAR;
+}
+
+EngineConfiguration configurations[] = {
+    { "reference", setupReference },
+    { "reference, run again", setupReference }, // Catches state a script leaves behind
+    { "quickened", setupQuickened },
+    { "fused", setupFused },
+    { "jit", setupJit },
+    { "parallel loops", setupParallelLoops },
+    { "sse2 vectors", setupSse2Vectors },
+    { "scalar vectors", setupScalarVectors },
+};
+
+#define CONFIGURATION_COUNT (int)(sizeof(configurations) / sizeof(configurations[0]))
+
+typedef struct {
+    wchar_t *output;
+    size_t outputSize;
+    wchar_t *errors;
+    size_t errorsSize;
+    int failed;
+} EngineResult;
+
+void runConfiguration(EngineConfiguration *configuration, int checked, const char *text, EngineResult *result) {
+    configuration->setup();
+    checkedArithmetic = checked;
+    scriptOutput = open_wmemstream(&result->output, &result->outputSize);
+    scriptErrors = open_wmemstream(&result->errors, &result->errorsSize);
+    if (!scriptOutput || !scriptErrors) {
+        abort();
+    }
+    result->failed = runScript((Script){SCRIPT_INLINE, text});
+    fclose(scriptOutput);
+    fclose(scriptErrors);
+    scriptOutput = stdout;
+    scriptErrors = stderr;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char *text = fuzzText(data, size);
+    for (int checked = 0; checked <= 1; checked++) {
+        const char *mode = checked ? ", checked" : "";
+        EngineResult results[CONFIGURATION_COUNT] = {0};
+        for (int i = 0; i < CONFIGURATION_COUNT; i++) {
+            runConfiguration(&configurations[i], checked, text, &results[i]);
+            if (i > 0 && (results[i].failed != results[0].failed ||
+                          wcscmp(results[i].output, results[0].output) != 0 ||
+                          wcscmp(results[i].errors, results[0].errors) != 0)) {
+                fwprintf(stderr, L"%s%s and %s%s differ\n--- %s\n%ls%ls--- %s\n%ls%ls", configurations[0].name, mode,
+                         configurations[i].name, mode, configurations[0].name, results[0].output, results[0].errors,
+                         configurations[i].name, results[i].output, results[i].errors);
+                abort();
+            }
+        }
+        for (int i = 0; i < CONFIGURATION_COUNT; i++) {
+            free(results[i].output);
+            free(results[i].errors);
+        }
+    }
+    free(text);
+    return 0;
+}
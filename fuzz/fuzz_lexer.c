@@ -0,0 +1,66 @@
+// Fuzzes tokenize. Every input is lexed with errors collected, and the tokens
+// must stay inside the source in increasing order. The input is then lexed
+// again in several parallel chunkings, which must give the same tokens.
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    char *bytes = fuzzText(data, size);
+    size_t length = mbstowcs(NULL, bytes, 0);
+    if (length == (size_t)-1 || length > INT_MAX) {
+        free(bytes); // Not text; runScript would reject it before lexing
+        return 0;
+    }
+    wchar_t *source = malloc((length + 1) * sizeof(wchar_t));
+    if (!source) {
+        abort();
+    }
+    mbstowcs(source, bytes, length + 1);
+    free(bytes);
+
+    DiagnosticList errors = {0};
+    diagnosticList = &errors;
+    Token *tokens = tokenize(source);
+    diagnosticList = NULL;
+    int previous = -1;
+    Token *token = tokens;
+    for (; token->type != TOKEN_EOF; token++) {
+        if (token->offset <= previous || token->offset >= (int)length) {
+            abort(); // Out of order or outside the source
+        }
+        if ((token->type == TOKEN_VARIABLE || token->type == TOKEN_CHAR) && !token->varName) {
+            abort();
+        }
+        previous = token->offset;
+    }
+    if (token->offset < previous || token->offset > (int)length) {
+        abort();
+    }
+    if (lexerErrorCount != errors.count) {
+        abort(); // Every error lexed past is reported once
+    }
+    freeTokens(tokens);
+    clearDiagnostics(&errors);
+    free(errors.items);
+
+    // Lexer errors stop this pass; the chunked lexers must stop at the same one
+    wchar_t *messages = NULL;
+    size_t messagesSize = 0;
+    scriptOutput = open_wmemstream(&messages, &messagesSize);
+    scriptErrors = scriptOutput;
+    scriptRunning = 1;
+    volatile int mismatch = 0;
+    if (setjmp(scriptRecovery) == 0) {
+        mismatch = checkParallelLexer(source);
+    }
+    scriptRunning = 0;
+    fclose(scriptOutput);
+    scriptOutput = stdout;
+    scriptErrors = stderr;
+    if (mismatch) {
+        fwprintf(stderr, L"%ls", messages);
+        abort();
+    }
+    free(messages);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,380 @@
+#include "input.h"
+#include "interpreter.h"
+#include "array.h"
+#include "script.h"
+#include "budget.h"
+#include "charclass.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INPUT_RELEASE_INTERVAL ((size_t)8 << 20) // Mapped bytes read between dropping their pages
+
+// Running sum of one column for مجموع_أعمدة. A column stays an integer until
+// a double shows up in it.
+typedef struct {
+    int64_t integer;
+    double real;
+    int isDouble;
+} ColumnSum;
+
+typedef struct {
+    int descriptor;
+    int ownsDescriptor;   // Standard input is left open
+    char *mapped;         // The whole file when it is mapped, else NULL
+    size_t mappedSize;
+    char *buffer;         // Bytes read so far from a pipe or terminal
+    size_t capacity;
+    size_t start;         // First unread byte in mapped or buffer
+    size_t end;           // End of the bytes available
+    size_t released;      // Mapped pages before this offset have been dropped
+    int finished;         // Nothing more to read from the descriptor
+    int64_t lineNumber;
+    wchar_t *line;        // The last line read, decoded
+    size_t lineCapacity;
+    ColumnSum *sums;
+    int64_t sumCapacity;
+} InputStream;
+
+_Thread_local InputStream *inputStreams[MAX_INPUT_STREAMS];
+
+_Noreturn void inputError(const wchar_t *action, const wchar_t *what, const char *reason) {
+    fwprintf(scriptErrors, L"Runtime error: %ls %ls: %s\n", action, what, reason);
+    abortScript();
+}
+
+void *inputAllocate(void *memory, size_t oldSize, size_t size) {
+    chargeMemory(MEMORY_STREAM, size - oldSize);
+    memory = realloc(memory, size);
+    if (!memory) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for input\n");
+        abortScript();
+    }
+    return memory;
+}
+
+void closeStream(InputStream *stream) {
+    if (stream->mapped) {
+        munmap(stream->mapped, stream->mappedSize);
+    }
+    if (stream->ownsDescriptor) {
+        close(stream->descriptor);
+    }
+    releaseMemory(MEMORY_STREAM, sizeof(InputStream) + stream->capacity + stream->lineCapacity * sizeof(wchar_t) +
+                  stream->sumCapacity * sizeof(ColumnSum));
+    free(stream->buffer);
+    free(stream->line);
+    free(stream->sums);
+    free(stream);
+}
+
+void closeInputStreams(void) {
+    for (int i = 0; i < MAX_INPUT_STREAMS; i++) {
+        if (inputStreams[i]) {
+            closeStream(inputStreams[i]);
+            inputStreams[i] = NULL;
+        }
+    }
+}
+
+// Maps a regular file from the descriptor's current offset, or sets up the
+// buffer for anything else
+void openStream(InputStream *stream) {
+    struct stat status;
+    off_t offset = lseek(stream->descriptor, 0, SEEK_CUR);
+    if (fstat(stream->descriptor, &status) == 0 && S_ISREG(status.st_mode) && offset >= 0 &&
+        status.st_size > offset) {
+        void *mapped = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, stream->descriptor, 0);
+        if (mapped != MAP_FAILED) {
+            madvise(mapped, (size_t)status.st_size, MADV_SEQUENTIAL);
+            stream->mapped = mapped;
+            stream->mappedSize = (size_t)status.st_size;
+            stream->start = (size_t)offset;
+            stream->released = (size_t)offset & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+            stream->end = stream->mappedSize;
+            stream->finished = 1;
+            return;
+        }
+    }
+    stream->buffer = inputAllocate(NULL, 0, INPUT_BUFFER_SIZE);
+    stream->capacity = INPUT_BUFFER_SIZE;
+}
+
+// Moves what is left of the buffer to its start and reads more after it,
+// doubling the buffer when a single line fills it
+void fillBuffer(InputStream *stream) {
+    if (stream->start > 0) {
+        memmove(stream->buffer, stream->buffer + stream->start, stream->end - stream->start);
+        stream->end -= stream->start;
+        stream->start = 0;
+    }
+    if (stream->end == stream->capacity) {
+        stream->buffer = inputAllocate(stream->buffer, stream->capacity, stream->capacity * 2);
+        stream->capacity *= 2;
+    }
+    ssize_t count = read(stream->descriptor, stream->buffer + stream->end, stream->capacity - stream->end);
+    if (count < 0 && errno != EINTR) {
+        inputError(L"Cannot read", L"input", strerror(errno));
+    } else if (count == 0) {
+        stream->finished = 1;
+    } else if (count > 0) {
+        stream->end += (size_t)count;
+    }
+}
+
+// Drops the pages of a mapped file before offset every INPUT_RELEASE_INTERVAL
+// bytes, so they do not stay in the process's memory. The line being read
+// starts at offset and must stay mapped: touching a dropped page maps back the
+// whole folio around it, which would never be dropped again.
+void releaseMappedLines(InputStream *stream, size_t offset) {
+    size_t upTo = offset & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+    if (upTo - stream->released >= INPUT_RELEASE_INTERVAL) {
+        madvise(stream->mapped + stream->released, upTo - stream->released, MADV_DONTNEED);
+        stream->released = upTo;
+    }
+}
+
+// Returns the next line without its newline, or NULL at the end. The bytes
+// stay valid until the next read from the stream.
+const char *nextLine(InputStream *stream, size_t *length) {
+    char *bytes = stream->mapped ? stream->mapped : stream->buffer;
+    for (;;) {
+        char *line = bytes + stream->start;
+        char *newline = memchr(line, '\n', stream->end - stream->start);
+        if (newline || (stream->finished && stream->start < stream->end)) {
+            if (stream->mapped) {
+                releaseMappedLines(stream, stream->start);
+            }
+            *length = newline ? (size_t)(newline - line) : stream->end - stream->start;
+            stream->start += *length + (newline != NULL);
+            stream->lineNumber++;
+            return line;
+        }
+        if (stream->finished) {
+            return NULL;
+        }
+        fillBuffer(stream);
+        bytes = stream->buffer;
+    }
+}
+
+int streamAtEnd(InputStream *stream) {
+    while (stream->start == stream->end && !stream->finished) {
+        fillBuffer(stream);
+    }
+    return stream->start == stream->end;
+}
+
+// Decodes a line of UTF-8 into the stream's line buffer. A byte that does not
+// begin a valid sequence becomes U+FFFD; a trailing carriage return is dropped.
+void decodeLine(InputStream *stream, const char *bytes, size_t length) {
+    if (length > 0 && bytes[length - 1] == '\r') {
+        length--;
+    }
+    if (length + 1 > stream->lineCapacity) {
+        size_t capacity = stream->lineCapacity ? stream->lineCapacity : 256;
+        while (capacity < length + 1) {
+            capacity *= 2;
+        }
+        stream->line = inputAllocate(stream->line, stream->lineCapacity * sizeof(wchar_t), capacity * sizeof(wchar_t));
+        stream->lineCapacity = capacity;
+    }
+
+    const unsigned char *input = (const unsigned char *)bytes;
+    wchar_t *output = stream->line;
+    size_t i = 0;
+    while (i < length) {
+        unsigned char byte = input[i];
+        if (byte < 0x80) {
+            *output++ = byte;
+            i++;
+            continue;
+        }
+        int extra = byte >= 0xF0 ? 3 : byte >= 0xE0 ? 2 : 1;
+        uint32_t code = byte & (0x3F >> extra);
+        int valid = byte >= 0xC2 && byte <= 0xF4 && i + extra < length;
+        for (int k = 1; valid && k <= extra; k++) {
+            valid = (input[i + k] & 0xC0) == 0x80;
+            code = (code << 6) | (input[i + k] & 0x3F);
+        }
+        // Overlong forms, surrogates and code points past U+10FFFF
+        static const uint32_t smallest[] = { 0, 0x80, 0x800, 0x10000 };
+        if (!valid || code < smallest[extra] || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF) {
+            *output++ = 0xFFFD;
+            i++;
+            continue;
+        }
+        *output++ = (wchar_t)code;
+        i += extra + 1;
+    }
+    *output = L'\0';
+}
+
+int isInputSeparator(wchar_t ch) {
+    return (charClass(ch) & CHAR_SPACE) || ch == L',' || ch == L'،' || ch == L';';
+}
+
+// Reads the next number of the decoded line at *cursor, with the digits and
+// decimal separators the lexer accepts. Returns 0 at the end of the line.
+int nextNumber(InputStream *stream, wchar_t **cursor, Value *number) {
+    wchar_t *source = *cursor;
+    while (*source && isInputSeparator(*source)) {
+        source++;
+    }
+    if (!*source) {
+        return 0;
+    }
+    if (*source == L'+') {
+        source++;
+    }
+    Token token;
+    int outOfRange = 0;
+    wchar_t *digits = *source == L'-' ? source + 1 : source;
+    wchar_t *end = (charClass(*digits) & CHAR_DIGIT) ? scanNumber(source, &token, &outOfRange) : NULL;
+    if (!end || (*end && !isInputSeparator(*end)) || outOfRange) {
+        fwprintf(scriptErrors, L"Runtime error: Line %lld of the input has a field that is not a 64-bit number.\n",
+                 (long long)stream->lineNumber);
+        abortScript();
+    }
+    *number = token.type == TOKEN_INT ? valueFromInt(token.intValue) : valueFromDouble(token.doubleValue);
+    *cursor = end;
+    return 1;
+}
+
+InputStream *requireStream(Value value) {
+    int64_t handle = valueIsInt(value) ? valueAsInt(value) : -1;
+    if (handle < 0 || handle >= MAX_INPUT_STREAMS || !inputStreams[handle]) {
+        runtimeError(L"Type error: not an open input stream");
+    }
+    return inputStreams[handle];
+}
+
+// Builtin افتح
+Value builtinOpen(Value *args) {
+    if (!valueIsString(args[0])) {
+        runtimeError(L"Type error: file path is not a string");
+    }
+    int handle = 0;
+    while (handle < MAX_INPUT_STREAMS && inputStreams[handle]) {
+        handle++;
+    }
+    if (handle == MAX_INPUT_STREAMS) {
+        runtimeError(L"Runtime error: Too many open input streams.");
+    }
+
+    wchar_t *widePath = valueAsString(args[0]);
+    size_t pathLength = wcstombs(NULL, widePath, 0);
+    if (pathLength == (size_t)-1) {
+        inputError(L"Cannot open", widePath, "not a valid path in the current locale");
+    }
+    char path[pathLength + 1];
+    wcstombs(path, widePath, pathLength + 1);
+
+    int descriptor = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (descriptor < 0) {
+        inputError(L"Cannot open", widePath, strerror(errno));
+    }
+    InputStream *stream = calloc(1, sizeof(InputStream));
+    if (!stream) {
+        if (descriptor != STDIN_FILENO) {
+            close(descriptor);
+        }
+        fwprintf(scriptErrors, L"Failed to allocate memory for input\n");
+        abortScript();
+    }
+    stream->descriptor = descriptor;
+    stream->ownsDescriptor = descriptor != STDIN_FILENO;
+    inputStreams[handle] = stream; // Closed with the script from here on
+    chargeMemory(MEMORY_STREAM, sizeof(InputStream));
+    openStream(stream);
+    return valueFromInt(handle);
+}
+
+// Builtin اقرأ_سطر
+Value builtinReadLine(Value *args) {
+    InputStream *stream = requireStream(args[0]);
+    size_t length;
+    const char *bytes = nextLine(stream, &length);
+    decodeLine(stream, bytes ? bytes : "", bytes ? length : 0);
+    return valueTemporary(valueCopy(valueFromString(stream->line)));
+}
+
+// Builtin اقرأ_أرقام
+Value builtinReadNumbers(Value *args) {
+    InputStream *stream = requireStream(args[0]);
+    Array *array = newArray(0);
+    Value result = valueTemporary(valueFromArray(array)); // Released with the statement unless stored
+    size_t length;
+    const char *bytes = nextLine(stream, &length);
+    if (bytes) {
+        decodeLine(stream, bytes, length);
+        wchar_t *cursor = stream->line;
+        Value number;
+        while (nextNumber(stream, &cursor, &number)) {
+            arrayAppend(array, number);
+        }
+    }
+    return result;
+}
+
+// Builtin انتهى
+Value builtinAtEnd(Value *args) {
+    return valueFromInt(streamAtEnd(requireStream(args[0])));
+}
+
+// Builtin أغلق
+Value builtinClose(Value *args) {
+    InputStream *stream = requireStream(args[0]);
+    inputStreams[valueAsInt(args[0])] = NULL;
+    closeStream(stream);
+    return valueError();
+}
+
+// Builtin مجموع_أعمدة: reads every remaining line and adds up each column,
+// with the promotion rules of +. Each line is a step of the script's budget.
+Value builtinColumnSums(Value *args) {
+    InputStream *stream = requireStream(args[0]);
+    int64_t columnCount = 0;
+    size_t length;
+    const char *bytes;
+    while ((bytes = nextLine(stream, &length))) {
+        countStep();
+        decodeLine(stream, bytes, length);
+        wchar_t *cursor = stream->line;
+        Value number;
+        for (int64_t column = 0; nextNumber(stream, &cursor, &number); column++) {
+            if (column == columnCount) {
+                if (columnCount == stream->sumCapacity) {
+                    int64_t capacity = stream->sumCapacity ? stream->sumCapacity * 2 : 16;
+                    stream->sums = inputAllocate(stream->sums, stream->sumCapacity * sizeof(ColumnSum),
+                                                 capacity * sizeof(ColumnSum));
+                    stream->sumCapacity = capacity;
+                }
+                stream->sums[columnCount++] = (ColumnSum){0, 0, 0};
+            }
+            ColumnSum *sum = &stream->sums[column];
+            if (valueIsInt(number) && !sum->isDouble) {
+                sum->integer = performIntegerOperation(sum->integer, valueAsInt(number), TOKEN_PLUS);
+            } else {
+                if (!sum->isDouble) {
+                    sum->real = (double)sum->integer;
+                    sum->isDouble = 1;
+                }
+                sum->real += valueIsInt(number) ? (double)valueAsInt(number) : valueAsDouble(number);
+            }
+        }
+    }
+
+    Array *array = newArray(columnCount);
+    Value result = valueTemporary(valueFromArray(array));
+    for (int64_t i = 0; i < columnCount; i++) {
+        ColumnSum *sum = &stream->sums[i];
+        arrayAppend(array, sum->isDouble ? valueFromDouble(sum->real) : valueFromInt(sum->integer));
+    }
+    return result;
+}
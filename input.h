@@ -0,0 +1,32 @@
+// input.h
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include "value.h"
+
+// Input streams a script reads lines from, opened by افتح with a path, or
+// "-" for standard input. A script refers to a stream by a small integer;
+// streams are closed when the script ends.
+//
+// Regular files, standard input included when it is redirected from one,
+// are mapped into memory and read in place; the pages behind the lines
+// already read are dropped as the stream moves on. Pipes and terminals are
+// read through one buffer that grows only to hold the longest line. Either
+// way a file of any size is read in constant memory. Lines are decoded from
+// UTF-8 into a buffer the stream reuses, without going through the C
+// library's wide-character input.
+#define MAX_INPUT_STREAMS 16
+#define INPUT_BUFFER_SIZE (1 << 20)
+
+// Built-ins
+Value builtinOpen(Value *args);        // افتح(مسار): a stream number
+Value builtinReadLine(Value *args);    // اقرأ_سطر(ق): the next line, "" at the end
+Value builtinReadNumbers(Value *args); // اقرأ_أرقام(ق): the numbers on the next line
+Value builtinAtEnd(Value *args);       // انتهى(ق): 1 once every line has been read
+Value builtinClose(Value *args);       // أغلق(ق)
+Value builtinColumnSums(Value *args);  // مجموع_أعمدة(ق): sums of each column of the remaining lines
+
+void closeInputStreams(void);
+
+#endif // INPUT_H
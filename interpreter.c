@@ -0,0 +1,885 @@
+#include "interpreter.h"
+#include "script.h"
+#include "vector.h"
+#include "jit.h"
+#include "map.h"
+#include "input.h"
+#include "budget.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <wchar.h>
+
+int checkedArithmetic = 0; // Report integer overflow instead of wrapping
+int quickeningEnabled = 1; // Specialize nodes for what they saw on their first run
+int fusionEnabled = 1;     // Fuse statements of the commonest shapes on their first run
+
+typedef struct {
+    wchar_t *name;  // Variable name
+    Value value;    // Owned copy of the value (see valueCopy)
+} Symbol;
+
+// The interpreter state below is per thread, so batch workers each run their
+// own script.
+#define MAX_SYMBOLS 100
+_Thread_local Symbol symbolTable[MAX_SYMBOLS];
+_Thread_local int symbolCount = 0;
+
+_Thread_local Function functions[MAX_FUNCTIONS];
+_Thread_local int functionCount = 0;
+
+// Activation frames are carved out of one contiguous region. A frame holds the
+// call's parameters followed by its locals; the parser has already mapped every
+// local name to its slot, so no names are looked up during a call.
+_Thread_local Value frameStack[FRAME_STACK_SIZE];
+_Thread_local int frameBase = 0;  // First slot of the running function's frame
+_Thread_local int frameTop = 0;   // First free slot
+_Thread_local int callDepth = 0;
+_Thread_local Value returnValue;  // Set by a return statement
+
+Value evaluate(Node *node);
+int executeStatement(Node *statement);
+
+void runtimeError(wchar_t *message) {
+    fwprintf(scriptErrors, L"%ls\n", message);
+    abortScript();
+}
+
+Symbol *findSymbol(wchar_t *name) {
+    for (int i = 0; i < symbolCount; i++) {
+        if (wcscmp(symbolTable[i].name, name) == 0) {
+            return &symbolTable[i];
+        }
+    }
+    return NULL;
+}
+
+void addSymbol(wchar_t *name, Value value) {
+    if (symbolCount >= MAX_SYMBOLS) {
+        fwprintf(scriptErrors, L"Symbol table overflow\n");
+        abortScript();
+    }
+
+    wchar_t* nameCopy = wcsdup(name);
+    if (!nameCopy) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for symbol name\n");
+        abortScript();
+    }
+
+    symbolTable[symbolCount].name = nameCopy;
+    symbolTable[symbolCount].value = valueCopy(value);
+    symbolCount++;
+}
+
+// Finds the symbol of a global variable node, or returns NULL if it has not
+// been assigned. With quickening on, the first lookup rewrites the node to
+// remember the symbol's index. Symbols are never removed while the nodes that
+// refer to them live, so later lookups need no search.
+Symbol *globalSymbol(Node *node) {
+    if (node->kind == NODE_GLOBAL_CACHED && node->slot < symbolCount) {
+        return &symbolTable[node->slot];
+    }
+    Symbol *symbol = findSymbol(node->name);
+    if (!quickeningEnabled) {
+        return symbol;
+    }
+    if (symbol) {
+        node->kind = NODE_GLOBAL_CACHED;
+        node->slot = (int)(symbol - symbolTable);
+    } else {
+        node->kind = NODE_GLOBAL;
+    }
+    return symbol;
+}
+
+// Assigns a global, adding it on its first assignment
+void storeGlobal(Node *target, Value value) {
+    Symbol *symbol = globalSymbol(target);
+    if (!symbol) {
+        addSymbol(target->name, value);
+        globalSymbol(target);
+        return;
+    }
+    Value previous = symbol->value;
+    symbol->value = valueCopy(value); // Copy first in case the new value refers to the old one
+    valueFree(previous);
+}
+
+Value loadGlobal(Node *node) {
+    Symbol *symbol = globalSymbol(node);
+    if (!symbol) {
+        fwprintf(scriptErrors, L"Undefined variable: %ls\n", node->name);
+        abortScript();
+    }
+    return symbol->value;
+}
+
+// Returns the index of the named function, adding an undefined entry so that
+// calls may appear before the definition.
+int declareFunction(wchar_t *name) {
+    for (int i = 0; i < functionCount; i++) {
+        if (wcscmp(functions[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    if (functionCount >= MAX_FUNCTIONS) {
+        fwprintf(scriptErrors, L"Function table overflow\n");
+        abortScript();
+    }
+
+    functions[functionCount].name = wcsdup(name);
+    if (!functions[functionCount].name) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for function name\n");
+        abortScript();
+    }
+    functions[functionCount].paramCount = -1;
+    functions[functionCount].localCount = 0;
+    functions[functionCount].body = NULL;
+    functions[functionCount].callCount = 0;
+    functions[functionCount].jit = NULL;
+    return functionCount++;
+}
+
+// Performs 64-bit integer arithmetic. Overflow wraps around unless checked mode
+// is enabled, in which case it is reported as a runtime error.
+int64_t performIntegerOperation(int64_t left, int64_t right, TokenType operatorType) {
+    int64_t result = 0;
+    int overflow = 0;
+
+    switch (operatorType) {
+        case TOKEN_PLUS:
+            overflow = __builtin_add_overflow(left, right, &result);
+            break;
+        case TOKEN_MINUS:
+            overflow = __builtin_sub_overflow(left, right, &result);
+            break;
+        case TOKEN_STAR:
+            overflow = __builtin_mul_overflow(left, right, &result);
+            break;
+        case TOKEN_SLASH:
+        case TOKEN_MODULUS:
+            if (right == 0) {
+                runtimeError(L"Runtime error: Division by zero in expression.");
+            }
+            if (left == INT64_MIN && right == -1) {
+                // The only quotient that does not fit; the remainder is zero
+                overflow = (operatorType == TOKEN_SLASH);
+                result = (operatorType == TOKEN_SLASH) ? INT64_MIN : 0;
+            } else {
+                result = (operatorType == TOKEN_SLASH) ? left / right : left % right;
+            }
+            break;
+        default:
+            runtimeError(L"Unexpected operator in expression");
+    }
+
+    if (overflow && checkedArithmetic) {
+        runtimeError(L"Runtime error: Integer overflow in expression.");
+    }
+    return result;
+}
+
+// Performs arithmetic operations based on the operator type.
+Value performArithmeticOperation(Value left, Value right, TokenType operatorType) {
+    if (valueIsInt(left) && valueIsInt(right)) {
+        // Integer arithmetic
+        return valueFromInt(performIntegerOperation(valueAsInt(left), valueAsInt(right), operatorType));
+    }
+
+    if (!valueIsNumber(left) || !valueIsNumber(right)) {
+        ValueType type = valueIsNumber(left) ? valueType(right) : valueType(left);
+        if (type == TYPE_CHAR) {
+            runtimeError(L"Type error: arithmetic on a string value");
+        } else if (type == TYPE_ARRAY) {
+            runtimeError(L"Type error: arithmetic on an array value");
+        } else if (type == TYPE_MAP) {
+            runtimeError(L"Type error: arithmetic on a map value");
+        }
+        runtimeError(L"Type error: arithmetic on a missing value");
+    }
+
+    // Floating-point arithmetic; an integer operand is converted to double
+    double leftValue = valueIsInt(left) ? (double)valueAsInt(left) : valueAsDouble(left);
+    double rightValue = valueIsInt(right) ? (double)valueAsInt(right) : valueAsDouble(right);
+    return valueFromDouble(performDoubleOperation(leftValue, rightValue, operatorType));
+}
+
+double performDoubleOperation(double leftValue, double rightValue, TokenType operatorType) {
+    double result = 0;
+
+    switch (operatorType) {
+        case TOKEN_PLUS:
+            result = leftValue + rightValue;
+            break;
+        case TOKEN_MINUS:
+            result = leftValue - rightValue;
+            break;
+        case TOKEN_STAR:
+            result = leftValue * rightValue;
+            break;
+        case TOKEN_SLASH:
+            if (rightValue == 0) {
+                runtimeError(L"Runtime error: Division by zero in expression.");
+            }
+            result = leftValue / rightValue;
+            break;
+        default:
+            runtimeError(L"Unexpected operator in expression");
+    }
+    return result;
+}
+
+// Truncates the double operand of an integer compound assignment toward zero.
+// NaN and values outside the range of int64_t overflow: that is an error when
+// arithmetic is checked and INT64_MIN otherwise, as x86-64's cvttsd2si gives.
+int64_t truncateDouble(double value) {
+    if (!(value >= -0x1p63 && value < 0x1p63)) {
+        if (checkedArithmetic) {
+            runtimeError(L"Runtime error: Integer overflow in expression.");
+        }
+        return INT64_MIN;
+    }
+    return (int64_t)value;
+}
+
+// The arithmetic operator a compound assignment applies
+TokenType compoundOperator(TokenType operation) {
+    switch (operation) {
+        case TOKEN_INCREMENT_BY: return TOKEN_PLUS;
+        case TOKEN_DECREASE_BY:  return TOKEN_MINUS;
+        case TOKEN_MULTIPLY_BY:  return TOKEN_STAR;
+        case TOKEN_DIVIDE_BY:    return TOKEN_SLASH;
+        default:                 return TOKEN_MODULUS;
+    }
+}
+
+// Applies a compound assignment (+=, -=, *=, /=, %=) and returns the new value.
+Value performCompoundAssignment(wchar_t *varName, Value current, Value operand, TokenType operation) {
+    TokenType operatorType = compoundOperator(operation);
+
+    if (valueType(operand) != TYPE_INT && valueType(operand) != TYPE_DOUBLE) {
+        runtimeError(L"Invalid right-hand side in assignment");
+    }
+    if (operation == TOKEN_MOD_BY && valueType(operand) != TYPE_INT) {
+        runtimeError(L"Modulo operation not supported for double");
+    }
+
+    if (valueIsInt(current)) {
+        // Integer variables stay integers; a double operand is truncated
+        int64_t value = valueIsInt(operand) ? valueAsInt(operand) : truncateDouble(valueAsDouble(operand));
+        return valueFromInt(performIntegerOperation(valueAsInt(current), value, operatorType));
+    } else if (valueIsDouble(current)) {
+        double value = valueIsInt(operand) ? (double)valueAsInt(operand) : valueAsDouble(operand);
+        double number = valueAsDouble(current);
+        if (operation == TOKEN_INCREMENT_BY)
+            number += value;
+        else if (operation == TOKEN_DECREASE_BY)
+            number -= value;
+        else if (operation == TOKEN_MULTIPLY_BY)
+            number *= value;
+        else if (operation == TOKEN_DIVIDE_BY)
+            number /= value;
+        // Note: Modulo operation not applicable for doubles
+        return valueFromDouble(number);
+    }
+
+    fwprintf(scriptErrors, L"Type error: %ls is not a number\n", varName);
+    abortScript();
+}
+
+Array *requireArray(Value value) {
+    if (!valueIsArray(value)) {
+        runtimeError(L"Type error: indexing a value that is not an array");
+    }
+    return valueAsArray(value);
+}
+
+Map *requireMap(Value value) {
+    if (!valueIsMap(value)) {
+        runtimeError(L"Type error: map operation on a value that is not a map");
+    }
+    return valueAsMap(value);
+}
+
+int64_t requireIndex(Value value) {
+    if (!valueIsInt(value)) {
+        runtimeError(L"Type error: array index is not an integer");
+    }
+    return valueAsInt(value);
+}
+
+// Builtin طول: length of an array or a string, or the number of keys of a map
+Value builtinLength(Value *args) {
+    if (valueIsArray(args[0])) {
+        return valueFromInt(valueAsArray(args[0])->length);
+    }
+    if (valueIsString(args[0])) {
+        return valueFromInt((int64_t)wcslen(valueAsString(args[0])));
+    }
+    if (valueIsMap(args[0])) {
+        return valueFromInt(valueAsMap(args[0])->count);
+    }
+    runtimeError(L"Type error: length of a value that is not an array, a string or a map");
+    return valueError();
+}
+
+// Refuses to store an array or map inside itself, directly or through the
+// containers it holds: the cycle could never be freed or printed
+void checkStoredInto(void *container, Value value) {
+    if (valueContains(value, container)) {
+        runtimeError(L"Runtime error: An array or map cannot be stored inside itself.");
+    }
+}
+
+// Builtin أضف: appends an element to an array
+Value builtinAppend(Value *args) {
+    Array *array = requireArray(args[0]);
+    checkStoredInto(array, args[1]);
+    arrayAppend(array, args[1]);
+    return valueError();
+}
+
+// Builtin قاموس: a new empty map
+Value builtinNewMap(Value *args) {
+    (void)args;
+    return valueTemporary(valueFromMap(newMap())); // Released with the statement unless stored
+}
+
+// Builtin يوجد: 1 if the map has the key, else 0
+Value builtinHasKey(Value *args) {
+    return valueFromInt(mapFind(requireMap(args[0]), args[1]) != NULL);
+}
+
+// Builtin حذف: removes a key from a map; 1 if it was there, else 0
+Value builtinDeleteKey(Value *args) {
+    return valueFromInt(mapDelete(requireMap(args[0]), args[1]));
+}
+
+// Builtins مفاتيح and قيم: the keys or the values of a map as an array, in
+// the order the keys were inserted
+Value mapColumn(Value map, int values) {
+    Map *source = requireMap(map);
+    Array *array = newArray(source->count);
+    Value result = valueTemporary(valueFromArray(array));
+    for (int64_t i = 0; i < source->entryCount; i++) {
+        MapEntry *entry = &source->entries[i];
+        if (valueType(entry->key) != TYPE_ERROR) {
+            arrayAppend(array, values ? entry->value : entry->key);
+        }
+    }
+    return result;
+}
+
+Value builtinKeys(Value *args) {
+    return mapColumn(args[0], 0);
+}
+
+Value builtinValues(Value *args) {
+    return mapColumn(args[0], 1);
+}
+
+Builtin builtins[] = {
+    { L"طول", 1, builtinLength },
+    { L"أضف", 2, builtinAppend },
+    { L"مجموع", 1, builtinSum },
+    { L"أصغر", 1, builtinMin },
+    { L"أكبر", 1, builtinMax },
+    { L"تحجيم", 2, builtinScale },
+    { L"جمع_متجهات", 2, builtinAddArrays },
+    { L"ضرب_نقطي", 2, builtinDot },
+    { L"تطبيق", 3, builtinMap },
+    { L"قاموس", 0, builtinNewMap },
+    { L"يوجد", 2, builtinHasKey },
+    { L"حذف", 2, builtinDeleteKey },
+    { L"مفاتيح", 1, builtinKeys },
+    { L"قيم", 1, builtinValues },
+    { L"افتح", 1, builtinOpen },
+    { L"اقرأ_سطر", 1, builtinReadLine },
+    { L"اقرأ_أرقام", 1, builtinReadNumbers },
+    { L"انتهى", 1, builtinAtEnd },
+    { L"أغلق", 1, builtinClose },
+    { L"مجموع_أعمدة", 1, builtinColumnSums },
+};
+
+#define BUILTIN_COUNT (int)(sizeof(builtins) / sizeof(builtins[0]))
+
+int findBuiltin(wchar_t *name) {
+    for (int i = 0; i < BUILTIN_COUNT; i++) {
+        if (wcscmp(builtins[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int builtinParamCount(int builtin) {
+    return builtins[builtin].paramCount;
+}
+
+Value callBuiltin(Node *node) {
+    Value args[MAX_BUILTIN_ARGS];
+    for (int i = 0; i < node->argCount; i++) {
+        args[i] = evaluate(node->args[i]);
+    }
+    return builtins[node->slot].function(args);
+}
+
+Value evaluateArray(Node *node) {
+    Array *array = newArray(node->argCount);
+    Value result = valueTemporary(valueFromArray(array)); // Released with the statement unless stored
+    for (int i = 0; i < node->argCount; i++) {
+        arrayAppend(array, evaluate(node->args[i]));
+    }
+    return result;
+}
+
+Value loadLocal(Node *node) {
+    Value value = frameStack[frameBase + node->slot];
+    if (valueType(value) == TYPE_ERROR) {
+        fwprintf(scriptErrors, L"Undefined variable: %ls\n", node->name);
+        abortScript();
+    }
+    return value;
+}
+
+void storeLocal(int slot, Value value) {
+    Value previous = frameStack[frameBase + slot];
+    frameStack[frameBase + slot] = valueCopy(value);
+    valueFree(previous);
+}
+
+void executeIndexAssignment(Node *node) {
+    Node *target = node->target;
+    Value value = evaluate(node->left);
+    Value container = evaluate(target->left);
+    if (valueIsMap(container)) {
+        Map *map = valueAsMap(container);
+        Value key = evaluate(target->right);
+        if (node->op != TOKEN_ASSIGNMENT) {
+            value = performCompoundAssignment(L"map entry", mapGet(map, key), value, node->op);
+        }
+        checkStoredInto(map, value);
+        mapSet(map, key, value);
+        return;
+    }
+    Array *array = requireArray(container);
+    int64_t index = requireIndex(evaluate(target->right));
+
+    if (node->op != TOKEN_ASSIGNMENT) {
+        value = performCompoundAssignment(L"array element", arrayGet(array, index), value, node->op);
+    }
+    checkStoredInto(array, value);
+    arraySet(array, index, value);
+}
+
+// Returns the value of the variable a compound assignment updates
+Value currentValue(Node *target) {
+    if (target->kind == NODE_LOCAL) {
+        Value current = frameStack[frameBase + target->slot];
+        if (valueType(current) == TYPE_ERROR) {
+            fwprintf(scriptErrors, L"Variable not found for update: %ls\n", target->name);
+            abortScript();
+        }
+        return current;
+    }
+    Symbol *symbol = globalSymbol(target);
+    if (!symbol) {
+        fwprintf(scriptErrors, L"Variable not found for update: %ls\n", target->name);
+        abortScript();
+    }
+    return symbol->value;
+}
+
+void storeVariable(Node *target, Value value) {
+    if (target->kind == NODE_LOCAL) {
+        storeLocal(target->slot, value);
+    } else {
+        storeGlobal(target, value);
+    }
+}
+
+void executeAssignment(Node *node) {
+    Node *target = node->target;
+    if (target->kind == NODE_INDEX) {
+        executeIndexAssignment(node);
+        return;
+    }
+
+    Value value = evaluate(node->left);
+
+    if (node->op != TOKEN_ASSIGNMENT) {
+        value = performCompoundAssignment(target->name, currentValue(target), value, node->op);
+    }
+    storeVariable(target, value);
+}
+
+// Runs a parallel loop on the values its body captures; the reductions are
+// stored back when it ends
+void executeLoop(Node *loop) {
+    Value start = evaluate(loop->left);
+    Value end = evaluate(loop->right);
+    if (!valueIsInt(start) || !valueIsInt(end)) {
+        runtimeError(L"Type error: loop bounds are not integers");
+    }
+    if (valueAsInt(end) <= valueAsInt(start)) {
+        return;
+    }
+
+    unsigned roles[loop->argCount + 1];
+    Value captured[loop->argCount + 1];
+    loopRoles(loop, roles);
+    for (int i = 0; i < loop->argCount; i++) {
+        if (roles[i] & LOOP_REDUCED) {
+            captured[i] = currentValue(loop->args[i]);
+            if (!valueIsNumber(captured[i])) {
+                fwprintf(scriptErrors, L"Type error: %ls is not a number\n", loop->args[i]->name);
+                abortScript();
+            }
+        } else {
+            captured[i] = evaluate(loop->args[i]);
+        }
+    }
+    runParallelLoop(loop, valueAsInt(start), valueAsInt(end), roles, captured);
+    for (int i = 0; i < loop->argCount; i++) {
+        if (roles[i] & LOOP_REDUCED) {
+            storeVariable(loop->args[i], captured[i]);
+        }
+    }
+}
+
+Value callFunction(Node *node) {
+    countStep();
+    Function *function = &functions[node->slot];
+    if (function->paramCount < 0) {
+        fwprintf(scriptErrors, L"Undefined function: %ls\n", function->name);
+        abortScript();
+    }
+    if (node->argCount != function->paramCount) {
+        fwprintf(scriptErrors, L"Wrong number of arguments to %ls: expected %d, got %d\n",
+                 function->name, function->paramCount, node->argCount);
+        abortScript();
+    }
+    if (callDepth >= MAX_CALL_DEPTH || frameTop + function->localCount > FRAME_STACK_SIZE) {
+        runtimeError(L"Runtime error: Stack overflow.");
+    }
+
+    // Arguments are pushed one at a time so that calls nested inside them
+    // build their frames above the ones already evaluated.
+    int base = frameTop;
+    for (int i = 0; i < node->argCount; i++) {
+        Value argument = evaluate(node->args[i]);
+        frameStack[frameTop++] = valueCopy(argument);
+    }
+    while (frameTop < base + function->localCount) {
+        frameStack[frameTop++] = valueError(); // Locals start out unassigned
+    }
+
+    int savedBase = frameBase;
+    frameBase = base;
+    callDepth++;
+
+    Value result = valueError();
+    if (!jitCall(function, &frameStack[base], &result)) {
+        for (Node *statement = function->body; statement; statement = statement->next) {
+            if (executeStatement(statement)) {
+                // Detach the result from the frame before the frame is released
+                result = valueCopyTemporary(returnValue);
+                break;
+            }
+        }
+    }
+
+    callDepth--;
+    for (int i = base; i < frameTop; i++) {
+        valueFree(frameStack[i]);
+    }
+    frameTop = base;
+    frameBase = savedBase;
+    return result;
+}
+
+// Calls a function or a built-in. The result is valueError() when there is
+// none: the function ended without ارجع, or the built-in, such as أضف, has
+// nothing to give back.
+Value executeCall(Node *node) {
+    return node->kind == NODE_CALL ? callFunction(node) : callBuiltin(node);
+}
+
+// A call whose result is used must have one
+Value callResult(Node *node) {
+    Value result = executeCall(node);
+    if (valueType(result) == TYPE_ERROR) {
+        fwprintf(scriptErrors, L"Runtime error: %ls returned no value\n",
+                 node->kind == NODE_CALL ? functions[node->slot].name : builtins[node->slot].name);
+        abortScript();
+    }
+    return result;
+}
+
+Value evaluate(Node *node) {
+    switch (node->kind) {
+        case NODE_LITERAL:
+            return node->value;
+        case NODE_GLOBAL:
+        case NODE_GLOBAL_CACHED:
+            return loadGlobal(node);
+        case NODE_LOCAL:
+            return loadLocal(node);
+        case NODE_BINARY:
+            {
+                Value left = evaluate(node->left);
+                Value right = evaluate(node->right);
+                if (!quickeningEnabled) {
+                    return performArithmeticOperation(left, right, node->op);
+                }
+                if (valueIsInt(left) && valueIsInt(right)) {
+                    node->kind = NODE_BINARY_INT;
+                } else if (valueIsDouble(left) && valueIsDouble(right)) {
+                    node->kind = NODE_BINARY_DOUBLE;
+                }
+                return performArithmeticOperation(left, right, node->op);
+            }
+        case NODE_BINARY_INT:
+            {
+                Value left = evaluate(node->left);
+                Value right = evaluate(node->right);
+                if (valueIsInt(left) && valueIsInt(right)) {
+                    return valueFromInt(performIntegerOperation(valueAsInt(left), valueAsInt(right), node->op));
+                }
+                node->kind = NODE_BINARY;
+                return performArithmeticOperation(left, right, node->op);
+            }
+        case NODE_BINARY_DOUBLE:
+            {
+                Value left = evaluate(node->left);
+                Value right = evaluate(node->right);
+                if (valueIsDouble(left) && valueIsDouble(right)) {
+                    return valueFromDouble(performDoubleOperation(valueAsDouble(left), valueAsDouble(right), node->op));
+                }
+                node->kind = NODE_BINARY;
+                return performArithmeticOperation(left, right, node->op);
+            }
+        case NODE_CALL:
+        case NODE_BUILTIN:
+            return callResult(node);
+        case NODE_ARRAY:
+            return evaluateArray(node);
+        case NODE_INDEX:
+            {
+                Value container = evaluate(node->left);
+                if (valueIsMap(container)) {
+                    return mapGet(valueAsMap(container), evaluate(node->right));
+                }
+                Array *array = requireArray(container);
+                return arrayGet(array, requireIndex(evaluate(node->right)));
+            }
+        default:
+            runtimeError(L"Unexpected node in expression");
+            return valueError();
+    }
+}
+
+int isVariable(Node *node) {
+    return node->kind == NODE_GLOBAL || node->kind == NODE_GLOBAL_CACHED || node->kind == NODE_LOCAL;
+}
+
+int isNumberLiteral(Node *node) {
+    return node->kind == NODE_LITERAL && valueIsNumber(node->value);
+}
+
+// Rewrites a NODE_ASSIGN or NODE_PRINT to the fused kind of its shape, or to
+// the general kind when it has none
+void fuseStatement(Node *statement) {
+    if (statement->kind == NODE_PRINT) {
+        statement->kind = isVariable(statement->left) ? NODE_PRINT_VARIABLE : NODE_PRINT_GENERAL;
+        return;
+    }
+    statement->kind = NODE_ASSIGN_GENERAL;
+    if (isVariable(statement->target)) {
+        Node *value = statement->left;
+        if (statement->op != TOKEN_ASSIGNMENT) {
+            if (isNumberLiteral(value)) {
+                statement->kind = NODE_UPDATE_NUMBER;
+            }
+        } else if ((value->kind == NODE_BINARY || value->kind == NODE_BINARY_INT || value->kind == NODE_BINARY_DOUBLE) &&
+                   isVariable(value->left) && isNumberLiteral(value->right)) {
+            statement->kind = NODE_ASSIGN_OPERATION;
+        }
+    }
+}
+
+Value loadVariable(Node *node) {
+    return node->kind == NODE_LOCAL ? loadLocal(node) : loadGlobal(node);
+}
+
+// x = y op number; without evaluating the expression node by node
+void executeOperationAssignment(Node *statement) {
+    Node *operation = statement->left;
+    Value operand = loadVariable(operation->left);
+    Value number = operation->right->value;
+    Value result;
+    if (valueIsInt(operand) && valueIsInt(number)) {
+        result = valueFromInt(performIntegerOperation(valueAsInt(operand), valueAsInt(number), operation->op));
+    } else if (valueIsDouble(operand) && valueIsDouble(number)) {
+        result = valueFromDouble(performDoubleOperation(valueAsDouble(operand), valueAsDouble(number), operation->op));
+    } else {
+        result = performArithmeticOperation(operand, number, operation->op);
+    }
+    storeVariable(statement->target, result);
+}
+
+// x op= number;
+void executeNumberUpdate(Node *statement) {
+    Node *target = statement->target;
+    Value current = currentValue(target);
+    Value number = statement->left->value;
+    Value result;
+    if (valueIsInt(current) && valueIsInt(number)) {
+        result = valueFromInt(performIntegerOperation(valueAsInt(current), valueAsInt(number),
+                                                      compoundOperator(statement->op)));
+    } else {
+        result = performCompoundAssignment(target->name, current, number, statement->op);
+    }
+    storeVariable(target, result);
+}
+
+// Executes a statement whose step has been counted
+int dispatchStatement(Node *statement) {
+    switch (statement->kind) {
+        case NODE_ASSIGN:
+            if (fusionEnabled) {
+                fuseStatement(statement);
+                return dispatchStatement(statement);
+            }
+            // Fall through
+        case NODE_ASSIGN_GENERAL:
+            executeAssignment(statement);
+            break;
+        case NODE_PRINT:
+            if (fusionEnabled) {
+                fuseStatement(statement);
+                return dispatchStatement(statement);
+            }
+            // Fall through
+        case NODE_PRINT_GENERAL:
+            printValue(evaluate(statement->left));
+            break;
+        case NODE_ASSIGN_OPERATION:
+            executeOperationAssignment(statement);
+            break;
+        case NODE_UPDATE_NUMBER:
+            executeNumberUpdate(statement);
+            break;
+        case NODE_PRINT_VARIABLE:
+            printValue(loadVariable(statement->left));
+            break;
+        case NODE_EXPRESSION:
+            executeCall(statement->left);
+            break;
+        case NODE_FOR:
+            executeLoop(statement);
+            break;
+        case NODE_RETURN:
+            returnValue = statement->left ? evaluate(statement->left) : valueError();
+            return 1;
+        default:
+            runtimeError(L"Unexpected node in statement");
+    }
+    return 0;
+}
+
+// Executes one statement. Returns 1 when a return statement was executed.
+int executeStatement(Node *statement) {
+    countStep();
+    return dispatchStatement(statement);
+}
+
+// Runs a top-level statement.
+void runStatement(Node *statement) {
+    executeStatement(statement);
+    resetTemporaryValues(); // Intermediate results die with their statement
+}
+
+void runProgram(Node *program) {
+    for (Node *statement = program; statement; statement = statement->next) {
+        runStatement(statement);
+    }
+}
+
+void freeNode(Node *node) {
+    if (!node) {
+        return;
+    }
+    if (node->kind == NODE_LITERAL) {
+        valueFree(node->value);
+    }
+    freeNode(node->target);
+    freeNode(node->left);
+    freeNode(node->right);
+    for (int i = 0; i < node->argCount; i++) {
+        freeNode(node->args[i]);
+    }
+    free(node->args);
+    freeProgram(node->body);
+    free(node);
+}
+
+void freeProgram(Node *program) {
+    while (program) {
+        Node *next = program->next;
+        freeNode(program);
+        program = next;
+    }
+}
+
+void freeFunctions() {
+    for (int i = 0; i < functionCount; i++) {
+        free(functions[i].name);
+        freeProgram(functions[i].body);
+        jitFree(&functions[i]);
+    }
+    functionCount = 0;
+}
+
+void clearSymbolTable() {
+    for (int i = 0; i < symbolCount; i++) {
+        // Free the memory allocated for the name of the symbol
+        free(symbolTable[i].name);
+        symbolTable[i].name = NULL;
+
+        // Free the heap storage owned by the value, if any
+        valueFree(symbolTable[i].value);
+    }
+
+    // Reset the symbol count to 0
+    symbolCount = 0;
+}
+
+void freeSymbolTable() {
+    clearSymbolTable();
+    freeTemporaryValues();
+}
+
+// Releases the frames of calls that an error left unfinished, along with the
+// statement's temporaries.
+void unwindFrames() {
+    for (int i = 0; i < frameTop; i++) {
+        valueFree(frameStack[i]);
+    }
+    frameTop = 0;
+    frameBase = 0;
+    callDepth = 0;
+    resetTemporaryValues();
+}
+
+// Drops every variable, function and frame so the next script starts from a
+// clean interpreter. Also used after a script stops with an error part way
+// through a call. The temporary arenas are kept for reuse.
+void resetInterpreter() {
+    unwindFrames();
+    freeFunctions();
+    clearSymbolTable();
+    closeInputStreams();
+}
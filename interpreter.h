@@ -0,0 +1,59 @@
+// interpreter.h
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include "ast.h"
+#include "value.h"
+#include "array.h"
+
+#define MAX_FUNCTIONS 100
+#define FRAME_STACK_SIZE 65536 // Value slots shared by all activation frames
+#define MAX_CALL_DEPTH 10000
+
+typedef struct {
+    wchar_t *name;
+    int paramCount;  // -1 until the definition has been parsed
+    int localCount;  // Parameters plus locals; the frame size in slots
+    Node *body;      // Statement list, NULL until defined
+    int callCount;
+    struct JitCode *jit; // Machine code for the body, see jit.h
+} Function;
+
+// A function implemented by the interpreter. Arguments are evaluated before
+// the call; the result may be a temporary.
+typedef Value (*BuiltinFunction)(Value *args);
+
+#define MAX_BUILTIN_ARGS 4
+
+typedef struct {
+    const wchar_t *name;
+    int paramCount;
+    BuiltinFunction function;
+} Builtin;
+
+extern _Thread_local Function functions[MAX_FUNCTIONS];
+extern _Thread_local int functionCount;
+extern int checkedArithmetic; // Set to report integer overflow as a runtime error
+extern int quickeningEnabled; // Cleared to leave every node as the parser made it
+extern int fusionEnabled;     // Cleared to run every statement node by node
+
+void runtimeError(wchar_t *message);
+int64_t performIntegerOperation(int64_t left, int64_t right, TokenType operatorType);
+double performDoubleOperation(double left, double right, TokenType operatorType);
+Value performArithmeticOperation(Value left, Value right, TokenType operatorType);
+TokenType compoundOperator(TokenType operation); // TOKEN_PLUS for TOKEN_INCREMENT_BY, and so on
+int64_t truncateDouble(double value);
+Array *requireArray(Value value);
+int declareFunction(wchar_t *name);
+int findBuiltin(wchar_t *name);
+int builtinParamCount(int builtin);
+void runStatement(Node *statement);
+void runProgram(Node *program);
+void freeNode(Node *node);
+void freeProgram(Node *program);
+void freeFunctions();
+void freeSymbolTable();
+void resetInterpreter();
+void unwindFrames();
+
+#endif // INTERPRETER_H
@@ -0,0 +1,581 @@
+#include "jit.h"
+#include "script.h"
+#include "budget.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) && !defined(HABIBI_NO_JIT)
+#define JIT_X86 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+int jitEnabled = 1;
+int jitThreshold = 1;
+
+#ifdef JIT_X86
+
+// Machine code for one function, built for one set of argument types. A
+// function that cannot be compiled keeps a JitCode with no memory, so it is
+// not tried again.
+typedef struct JitCode {
+    void *memory;      // Executable pages, or NULL
+    size_t size;
+    int checked;       // checkedArithmetic when the code was built
+    int statementCount; // Statements a call runs, each one step of the budget
+    int paramCount;
+    ValueType paramTypes[]; // TYPE_INT or TYPE_DOUBLE for each parameter
+} JitCode;
+
+// Compiled code is called with the arguments as raw integers or double bits
+// and a place for the result. It returns the result's type, TYPE_ERROR when
+// the function returns nothing.
+typedef int (*JitEntry)(const uint64_t *arguments, uint64_t *result);
+
+#define JIT_MAX_PARAMS 256 // The parser's limit on locals
+_Thread_local uint64_t jitArguments[JIT_MAX_PARAMS];
+
+#define JIT_DIVISION_BY_ZERO 0
+#define JIT_OVERFLOW 1
+
+// Called from compiled code to stop the script; never returns
+void jitRuntimeError(int error) {
+    runtimeError(error == JIT_DIVISION_BY_ZERO ? L"Runtime error: Division by zero in expression."
+                                               : L"Runtime error: Integer overflow in expression.");
+}
+
+void jitPrintInt(int64_t number) {
+    printValue(valueFromInt(number));
+}
+
+void jitPrintDouble(double number) {
+    printValue(valueFromDouble(number));
+}
+
+// Code is generated from templates, one per node, straight into a byte
+// buffer. Locals live in the machine stack frame at rbp - 16 - 8 * slot,
+// below the saved result pointer at rbp - 8. An expression leaves an integer
+// in rax or a double in xmm0; a binary operator has its right operand in rcx
+// or xmm1. The type of every local is known at each statement because the
+// body has no branches.
+typedef struct {
+    uint8_t *code;
+    size_t length;
+    size_t capacity;
+    ValueType *localTypes; // TYPE_ERROR while a local is unassigned
+    int unsupported;       // Set when the body uses something not compiled
+} JitCompiler;
+
+void emitCode(JitCompiler *compiler, const char *bytes, size_t length) {
+    if (compiler->length + length > compiler->capacity) {
+        size_t capacity = compiler->capacity ? compiler->capacity * 2 : 256;
+        while (capacity < compiler->length + length) {
+            capacity *= 2;
+        }
+        uint8_t *code = realloc(compiler->code, capacity);
+        if (!code) {
+            fwprintf(scriptErrors, L"Failed to allocate memory for compiled code\n");
+            abortScript();
+        }
+        compiler->code = code;
+        compiler->capacity = capacity;
+    }
+    memcpy(compiler->code + compiler->length, bytes, length);
+    compiler->length += length;
+}
+
+void emit32(JitCompiler *compiler, int32_t number) {
+    emitCode(compiler, (const char *)&number, 4); // x86 is little-endian
+}
+
+void emit64(JitCompiler *compiler, uint64_t number) {
+    emitCode(compiler, (const char *)&number, 8);
+}
+
+int32_t localOffset(int slot) {
+    return -16 - 8 * slot;
+}
+
+// Emits a short conditional or unconditional jump and returns where its
+// displacement goes, for patchJump
+size_t emitJump(JitCompiler *compiler, uint8_t opcode) {
+    char bytes[2] = {(char)opcode, 0};
+    emitCode(compiler, bytes, 2);
+    return compiler->length - 1;
+}
+
+// Points a jump from emitJump at the next instruction
+void patchJump(JitCompiler *compiler, size_t jump) {
+    compiler->code[jump] = (uint8_t)(compiler->length - jump - 1);
+}
+
+#define JUMP_IF_NO_OVERFLOW 0x71
+#define JUMP_IF_EQUAL       0x74
+#define JUMP_IF_NOT_EQUAL   0x75
+#define JUMP_IF_PARITY      0x7A
+#define JUMP                0xEB
+
+// Emits a call to jitRuntimeError. The stack is realigned for it, which is
+// safe because it does not return.
+void emitRuntimeError(JitCompiler *compiler, int error) {
+    emitCode(compiler, "\x48\x83\xE4\xF0", 4); // and rsp, -16
+    emitCode(compiler, "\xBF", 1);             // mov edi, error
+    emit32(compiler, error);
+    emitCode(compiler, "\x48\xB8", 2);         // mov rax, jitRuntimeError
+    emit64(compiler, (uint64_t)(uintptr_t)jitRuntimeError);
+    emitCode(compiler, "\xFF\xD0", 2);         // call rax
+}
+
+// Stops with an overflow error if the last instruction overflowed and
+// arithmetic is checked
+void emitOverflowCheck(JitCompiler *compiler) {
+    if (checkedArithmetic) {
+        size_t skip = emitJump(compiler, JUMP_IF_NO_OVERFLOW);
+        emitRuntimeError(compiler, JIT_OVERFLOW);
+        patchJump(compiler, skip);
+    }
+}
+
+// rax = rax op rcx, as performIntegerOperation
+void emitIntegerOperation(JitCompiler *compiler, TokenType operatorType) {
+    switch (operatorType) {
+        case TOKEN_PLUS:
+            emitCode(compiler, "\x48\x01\xC8", 3);     // add rax, rcx
+            emitOverflowCheck(compiler);
+            break;
+        case TOKEN_MINUS:
+            emitCode(compiler, "\x48\x29\xC8", 3);     // sub rax, rcx
+            emitOverflowCheck(compiler);
+            break;
+        case TOKEN_STAR:
+            emitCode(compiler, "\x48\x0F\xAF\xC1", 4); // imul rax, rcx
+            emitOverflowCheck(compiler);
+            break;
+        case TOKEN_SLASH:
+        case TOKEN_MODULUS:
+            {
+                emitCode(compiler, "\x48\x85\xC9", 3); // test rcx, rcx
+                size_t nonZero = emitJump(compiler, JUMP_IF_NOT_EQUAL);
+                emitRuntimeError(compiler, JIT_DIVISION_BY_ZERO);
+                patchJump(compiler, nonZero);
+
+                // idiv faults on INT64_MIN / -1, so dividing by -1 negates
+                emitCode(compiler, "\x48\x83\xF9\xFF", 4); // cmp rcx, -1
+                size_t divide = emitJump(compiler, JUMP_IF_NOT_EQUAL);
+                if (operatorType == TOKEN_SLASH) {
+                    emitCode(compiler, "\x48\xF7\xD8", 3); // neg rax
+                    emitOverflowCheck(compiler);
+                } else {
+                    emitCode(compiler, "\x31\xC0", 2);     // xor eax, eax
+                }
+                size_t done = emitJump(compiler, JUMP);
+                patchJump(compiler, divide);
+                emitCode(compiler, "\x48\x99", 2);         // cqo
+                emitCode(compiler, "\x48\xF7\xF9", 3);     // idiv rcx
+                if (operatorType == TOKEN_MODULUS) {
+                    emitCode(compiler, "\x48\x89\xD0", 3); // mov rax, rdx
+                }
+                patchJump(compiler, done);
+            }
+            break;
+        default:
+            compiler->unsupported = 1;
+    }
+}
+
+// xmm0 = xmm0 op xmm1. Division by zero is an error in an expression, but
+// not in a compound assignment.
+void emitDoubleOperation(JitCompiler *compiler, TokenType operatorType, int checkDivisor) {
+    switch (operatorType) {
+        case TOKEN_PLUS:
+            emitCode(compiler, "\xF2\x0F\x58\xC1", 4); // addsd xmm0, xmm1
+            break;
+        case TOKEN_MINUS:
+            emitCode(compiler, "\xF2\x0F\x5C\xC1", 4); // subsd xmm0, xmm1
+            break;
+        case TOKEN_STAR:
+            emitCode(compiler, "\xF2\x0F\x59\xC1", 4); // mulsd xmm0, xmm1
+            break;
+        case TOKEN_SLASH:
+            if (checkDivisor) {
+                emitCode(compiler, "\x66\x0F\x57\xD2", 4); // xorpd xmm2, xmm2
+                emitCode(compiler, "\x66\x0F\x2E\xCA", 4); // ucomisd xmm1, xmm2
+                size_t notANumber = emitJump(compiler, JUMP_IF_PARITY);
+                size_t nonZero = emitJump(compiler, JUMP_IF_NOT_EQUAL);
+                emitRuntimeError(compiler, JIT_DIVISION_BY_ZERO);
+                patchJump(compiler, notANumber);
+                patchJump(compiler, nonZero);
+            }
+            emitCode(compiler, "\xF2\x0F\x5E\xC1", 4); // divsd xmm0, xmm1
+            break;
+        default:
+            compiler->unsupported = 1;
+    }
+}
+
+// Type a literal or local will have, or TYPE_ERROR if it is not one the
+// compiled code handles
+ValueType leafType(JitCompiler *compiler, Node *node) {
+    if (node->kind == NODE_LITERAL && valueIsNumber(node->value)) {
+        return valueType(node->value);
+    }
+    if (node->kind == NODE_LOCAL) {
+        return compiler->localTypes[node->slot];
+    }
+    return TYPE_ERROR;
+}
+
+// Loads a literal or local into rax or xmm0, or into rcx or xmm1 when second
+void emitLoadLeaf(JitCompiler *compiler, Node *node, ValueType type, int second) {
+    if (node->kind == NODE_LITERAL) {
+        emitCode(compiler, second ? "\x48\xB9" : "\x48\xB8", 2); // mov rcx/rax, imm64
+        emit64(compiler, type == TYPE_INT ? (uint64_t)valueAsInt(node->value) : node->value);
+        if (type == TYPE_DOUBLE) {
+            emitCode(compiler, second ? "\x66\x48\x0F\x6E\xC9" : "\x66\x48\x0F\x6E\xC0", 5); // movq xmm1, rcx / xmm0, rax
+        }
+    } else if (type == TYPE_INT) {
+        emitCode(compiler, second ? "\x48\x8B\x8D" : "\x48\x8B\x85", 3); // mov rcx/rax, [rbp + offset]
+        emit32(compiler, localOffset(node->slot));
+    } else {
+        emitCode(compiler, second ? "\xF2\x0F\x10\x8D" : "\xF2\x0F\x10\x85", 4); // movsd xmm1/xmm0, [rbp + offset]
+        emit32(compiler, localOffset(node->slot));
+    }
+}
+
+ValueType compileExpression(JitCompiler *compiler, Node *node);
+
+// Operands are evaluated left to right as the interpreter does. A right
+// operand that is a literal or local is loaded straight into rcx or xmm1;
+// anything else is computed with the left operand saved on the stack.
+ValueType compileBinary(JitCompiler *compiler, Node *node) {
+    ValueType left = compileExpression(compiler, node->left);
+    ValueType right = leafType(compiler, node->right);
+    if (left == TYPE_ERROR) {
+        return TYPE_ERROR;
+    }
+    if (right != TYPE_ERROR) {
+        emitLoadLeaf(compiler, node->right, right, 1);
+    } else {
+        if (left == TYPE_DOUBLE) {
+            emitCode(compiler, "\x66\x48\x0F\x7E\xC0", 5); // movq rax, xmm0
+        }
+        emitCode(compiler, "\x50", 1);                     // push rax
+        right = compileExpression(compiler, node->right);
+        if (right == TYPE_ERROR) {
+            return TYPE_ERROR;
+        }
+        if (right == TYPE_INT) {
+            emitCode(compiler, "\x48\x89\xC1", 3);         // mov rcx, rax
+        } else {
+            emitCode(compiler, "\x66\x0F\x28\xC8", 4);     // movapd xmm1, xmm0
+        }
+        emitCode(compiler, "\x58", 1);                     // pop rax
+        if (left == TYPE_DOUBLE) {
+            emitCode(compiler, "\x66\x48\x0F\x6E\xC0", 5); // movq xmm0, rax
+        }
+    }
+
+    if (left == TYPE_INT && right == TYPE_INT) {
+        emitIntegerOperation(compiler, node->op);
+        return TYPE_INT;
+    }
+    // An integer operand is converted to double
+    if (left == TYPE_INT) {
+        emitCode(compiler, "\xF2\x48\x0F\x2A\xC0", 5); // cvtsi2sd xmm0, rax
+    }
+    if (right == TYPE_INT) {
+        emitCode(compiler, "\xF2\x48\x0F\x2A\xC9", 5); // cvtsi2sd xmm1, rcx
+    }
+    emitDoubleOperation(compiler, node->op, 1);
+    return TYPE_DOUBLE;
+}
+
+// Emits code for an expression and returns the type of its value, or
+// TYPE_ERROR if it cannot be compiled
+ValueType compileExpression(JitCompiler *compiler, Node *node) {
+    ValueType type;
+    switch (node->kind) {
+        case NODE_LITERAL:
+        case NODE_LOCAL:
+            type = leafType(compiler, node);
+            if (type != TYPE_ERROR) {
+                emitLoadLeaf(compiler, node, type, 0);
+            }
+            break;
+        case NODE_BINARY:
+        case NODE_BINARY_INT:
+        case NODE_BINARY_DOUBLE:
+            type = compileBinary(compiler, node);
+            break;
+        default:
+            type = TYPE_ERROR; // Globals, calls, strings and arrays are left to the interpreter
+    }
+    if (type == TYPE_ERROR) {
+        compiler->unsupported = 1;
+    }
+    return type;
+}
+
+void emitStoreLocal(JitCompiler *compiler, int slot, ValueType type) {
+    emitCode(compiler, type == TYPE_INT ? "\x48\x89\x85" : "\xF2\x0F\x11\x85", type == TYPE_INT ? 3 : 4); // mov/movsd [rbp + offset], rax/xmm0
+    emit32(compiler, localOffset(slot));
+}
+
+// As truncateDouble: after cvttsd2si rcx, xmm0, stops with an overflow error
+// if arithmetic is checked and xmm0 was NaN or out of range. The instruction
+// gives INT64_MIN for those, which is also the conversion of -2^63 itself.
+void emitTruncationCheck(JitCompiler *compiler) {
+    if (!checkedArithmetic) {
+        return;
+    }
+    emitCode(compiler, "\x48\x83\xF9\x01", 4);     // cmp rcx, 1; overflows only for INT64_MIN
+    size_t inRange = emitJump(compiler, JUMP_IF_NO_OVERFLOW);
+    emitCode(compiler, "\x48\xBA", 2);             // mov rdx, -2^63
+    emit64(compiler, 0xC3E0000000000000ull);
+    emitCode(compiler, "\x66\x48\x0F\x6E\xCA", 5); // movq xmm1, rdx
+    emitCode(compiler, "\x66\x0F\x2E\xC1", 4);     // ucomisd xmm0, xmm1
+    size_t notANumber = emitJump(compiler, JUMP_IF_PARITY);
+    size_t exact = emitJump(compiler, JUMP_IF_EQUAL);
+    patchJump(compiler, notANumber);
+    emitRuntimeError(compiler, JIT_OVERFLOW);
+    patchJump(compiler, inRange);
+    patchJump(compiler, exact);
+}
+
+// As performCompoundAssignment: integer locals stay integers, with a double
+// operand truncated, and double locals take the operand as a double
+void compileCompoundAssignment(JitCompiler *compiler, Node *node, ValueType operand) {
+    int slot = node->target->slot;
+    ValueType current = compiler->localTypes[slot];
+    if (current == TYPE_ERROR || (node->op == TOKEN_MOD_BY && operand != TYPE_INT)) {
+        compiler->unsupported = 1; // Errors the interpreter reports
+        return;
+    }
+
+    TokenType operatorType = compoundOperator(node->op);
+
+    if (current == TYPE_INT) {
+        if (operand == TYPE_INT) {
+            emitCode(compiler, "\x48\x89\xC1", 3);         // mov rcx, rax
+        } else {
+            emitCode(compiler, "\xF2\x48\x0F\x2C\xC8", 5); // cvttsd2si rcx, xmm0
+            emitTruncationCheck(compiler);
+        }
+        emitCode(compiler, "\x48\x8B\x85", 3);             // mov rax, [rbp + offset]
+        emit32(compiler, localOffset(slot));
+        emitIntegerOperation(compiler, operatorType);
+    } else {
+        if (node->op == TOKEN_MOD_BY) {
+            return; // Leaves a double unchanged
+        }
+        if (operand == TYPE_INT) {
+            emitCode(compiler, "\xF2\x48\x0F\x2A\xC8", 5); // cvtsi2sd xmm1, rax
+        } else {
+            emitCode(compiler, "\x66\x0F\x28\xC8", 4);     // movapd xmm1, xmm0
+        }
+        emitCode(compiler, "\xF2\x0F\x10\x85", 4);         // movsd xmm0, [rbp + offset]
+        emit32(compiler, localOffset(slot));
+        emitDoubleOperation(compiler, operatorType, 0);
+    }
+    emitStoreLocal(compiler, slot, current);
+}
+
+void emitReturn(JitCompiler *compiler, ValueType type) {
+    if (type != TYPE_ERROR) {
+        emitCode(compiler, "\x48\x8B\x4D\xF8", 4);     // mov rcx, [rbp - 8]
+        if (type == TYPE_INT) {
+            emitCode(compiler, "\x48\x89\x01", 3);     // mov [rcx], rax
+        } else {
+            emitCode(compiler, "\xF2\x0F\x11\x01", 4); // movsd [rcx], xmm0
+        }
+    }
+    emitCode(compiler, "\xB8", 1);                     // mov eax, type
+    emit32(compiler, type);
+    emitCode(compiler, "\xC9\xC3", 2);                 // leave; ret
+}
+
+// Compiles a statement and returns 1 if it returns from the function
+int compileStatement(JitCompiler *compiler, Node *statement) {
+    ValueType type;
+    switch (statement->kind) {
+        case NODE_ASSIGN:
+        case NODE_ASSIGN_OPERATION:
+        case NODE_UPDATE_NUMBER:
+        case NODE_ASSIGN_GENERAL:
+            if (statement->target->kind != NODE_LOCAL) {
+                compiler->unsupported = 1;
+                return 0;
+            }
+            type = compileExpression(compiler, statement->left);
+            if (type == TYPE_ERROR) {
+                return 0;
+            }
+            if (statement->op == TOKEN_ASSIGNMENT) {
+                emitStoreLocal(compiler, statement->target->slot, type);
+                compiler->localTypes[statement->target->slot] = type;
+            } else {
+                compileCompoundAssignment(compiler, statement, type);
+            }
+            return 0;
+        case NODE_PRINT:
+        case NODE_PRINT_VARIABLE:
+        case NODE_PRINT_GENERAL:
+            type = compileExpression(compiler, statement->left);
+            if (type == TYPE_INT) {
+                emitCode(compiler, "\x48\x89\xC7", 3); // mov rdi, rax
+            }
+            // The stack is aligned between statements
+            emitCode(compiler, "\x48\xB8", 2);         // mov rax, helper
+            emit64(compiler, (uint64_t)(uintptr_t)(type == TYPE_INT ? (void *)jitPrintInt : (void *)jitPrintDouble));
+            emitCode(compiler, "\xFF\xD0", 2);         // call rax
+            return 0;
+        case NODE_RETURN:
+            type = statement->left ? compileExpression(compiler, statement->left) : TYPE_ERROR;
+            emitReturn(compiler, type);
+            return 1;
+        default:
+            compiler->unsupported = 1;
+            return 0;
+    }
+}
+
+// Copies compiled code into executable pages, or returns NULL
+void *mapCode(const uint8_t *code, size_t length, size_t *size) {
+    long page = sysconf(_SC_PAGESIZE);
+    *size = (length + page - 1) / page * page;
+    void *memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    memcpy(memory, code, length);
+    if (mprotect(memory, *size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, *size);
+        return NULL;
+    }
+    return memory;
+}
+
+// Compiles a function for the argument types in frame
+JitCode *compileFunction(Function *function, Value *frame) {
+    int paramCount = function->paramCount;
+    JitCode *jit = calloc(1, sizeof(JitCode) + paramCount * sizeof(ValueType));
+    ValueType *localTypes = malloc((function->localCount + 1) * sizeof(ValueType));
+    if (!jit || !localTypes) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for compiled code\n");
+        abortScript();
+    }
+    jit->checked = checkedArithmetic;
+    jit->paramCount = paramCount;
+    for (int i = 0; i < function->localCount; i++) {
+        localTypes[i] = i < paramCount ? valueType(frame[i]) : TYPE_ERROR;
+        if (i < paramCount) {
+            jit->paramTypes[i] = localTypes[i];
+        }
+    }
+
+    JitCompiler compiler = {0};
+    compiler.localTypes = localTypes;
+    for (int i = 0; i < paramCount; i++) {
+        if (localTypes[i] != TYPE_INT && localTypes[i] != TYPE_DOUBLE) {
+            compiler.unsupported = 1;
+        }
+    }
+    if (paramCount > JIT_MAX_PARAMS) {
+        compiler.unsupported = 1;
+    }
+
+    // The frame keeps rsp 16-byte aligned for the calls print makes
+    int frameSize = (8 + 8 * function->localCount + 15) / 16 * 16;
+    emitCode(&compiler, "\x55", 1);             // push rbp
+    emitCode(&compiler, "\x48\x89\xE5", 3);     // mov rbp, rsp
+    emitCode(&compiler, "\x48\x81\xEC", 3);     // sub rsp, frameSize
+    emit32(&compiler, frameSize);
+    emitCode(&compiler, "\x48\x89\x75\xF8", 4); // mov [rbp - 8], rsi
+    for (int i = 0; i < paramCount; i++) {
+        emitCode(&compiler, "\x48\x8B\x87", 3); // mov rax, [rdi + 8 * i]
+        emit32(&compiler, 8 * i);
+        emitStoreLocal(&compiler, i, TYPE_INT);
+    }
+
+    int returned = 0;
+    for (Node *statement = function->body; statement && !returned && !compiler.unsupported;
+         statement = statement->next) {
+        returned = compileStatement(&compiler, statement);
+        jit->statementCount++;
+    }
+    if (!returned) {
+        emitReturn(&compiler, TYPE_ERROR);
+    }
+
+    if (!compiler.unsupported) {
+        jit->memory = mapCode(compiler.code, compiler.length, &jit->size);
+    }
+    free(compiler.code);
+    free(localTypes);
+    return jit;
+}
+
+int jitCall(Function *function, Value *frame, Value *result) {
+    if (!jitEnabled || function->callCount++ < jitThreshold) {
+        return 0;
+    }
+    if (function->jit && function->jit->checked != checkedArithmetic) {
+        jitFree(function); // Built for the other arithmetic mode
+    }
+    if (!function->jit) {
+        function->jit = compileFunction(function, frame);
+    }
+    JitCode *jit = function->jit;
+    if (!jit->memory) {
+        return 0;
+    }
+    for (int i = 0; i < jit->paramCount; i++) {
+        Value argument = frame[i];
+        if (valueType(argument) != jit->paramTypes[i]) {
+            return 0;
+        }
+        jitArguments[i] = jit->paramTypes[i] == TYPE_INT ? (uint64_t)valueAsInt(argument) : argument;
+    }
+    if (!takeSteps(jit->statementCount)) {
+        return 0; // The interpreter stops at the statement that goes over
+    }
+
+    uint64_t bits;
+    switch (((JitEntry)jit->memory)(jitArguments, &bits)) {
+        case TYPE_INT:
+            *result = valueFromInt((int64_t)bits);
+            break;
+        case TYPE_DOUBLE:
+            *result = valueFromDouble(valueAsDouble(bits));
+            break;
+        default:
+            *result = valueError();
+    }
+    return 1;
+}
+
+void jitFree(Function *function) {
+    if (function->jit) {
+        if (function->jit->memory) {
+            munmap(function->jit->memory, function->jit->size);
+        }
+        free(function->jit);
+        function->jit = NULL;
+    }
+}
+
+#else
+
+int jitCall(Function *function, Value *frame, Value *result) {
+    (void)function;
+    (void)frame;
+    (void)result;
+    return 0;
+}
+
+void jitFree(Function *function) {
+    (void)function;
+}
+
+#endif // JIT_X86
@@ -0,0 +1,24 @@
+// jit.h
+#ifndef JIT_H
+#define JIT_H
+
+#include "interpreter.h"
+
+extern int jitEnabled;   // Cleared by --no-jit
+extern int jitThreshold; // Calls a function is interpreted for before it is compiled
+
+// Runs a call of function in machine code if it can be. frame holds the
+// call's arguments. Returns 1 with the function's result in *result, or 0
+// when the call must be interpreted.
+//
+// A function is compiled once, for the types its arguments have on the call
+// that makes it hot, and only if its body is straight-line arithmetic on
+// integer and double locals: assignments, compound assignments, print and
+// return. Later calls with other argument types are interpreted. Compiled
+// code is only built on x86-64 Linux, and not at all with HABIBI_NO_JIT.
+int jitCall(Function *function, Value *frame, Value *result);
+
+// Releases a function's machine code
+void jitFree(Function *function);
+
+#endif // JIT_H
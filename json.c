@@ -0,0 +1,71 @@
+#include "json.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int encodeUtf8(uint32_t code, char *bytes) {
+    if (code < 0x80) {
+        bytes[0] = (char)code;
+        return 1;
+    } else if (code < 0x800) {
+        bytes[0] = (char)(0xC0 | (code >> 6));
+        bytes[1] = (char)(0x80 | (code & 0x3F));
+        return 2;
+    } else if (code < 0x10000) {
+        bytes[0] = (char)(0xE0 | (code >> 12));
+        bytes[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        bytes[2] = (char)(0x80 | (code & 0x3F));
+        return 3;
+    }
+    bytes[0] = (char)(0xF0 | (code >> 18));
+    bytes[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    bytes[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    bytes[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
+}
+
+void writeBytes(JsonWriter *writer, const char *bytes, size_t length) {
+    if (writer->length + length > writer->capacity) {
+        size_t capacity = writer->capacity ? writer->capacity * 2 : 1024;
+        while (capacity < writer->length + length) {
+            capacity *= 2;
+        }
+        writer->data = realloc(writer->data, capacity);
+        if (!writer->data) {
+            fwprintf(stderr, L"Failed to allocate memory for JSON output\n");
+            exit(EXIT_FAILURE);
+        }
+        writer->capacity = capacity;
+    }
+    memcpy(writer->data + writer->length, bytes, length);
+    writer->length += length;
+}
+
+void writeText(JsonWriter *writer, const char *text) {
+    writeBytes(writer, text, strlen(text));
+}
+
+void writeInt(JsonWriter *writer, int number) {
+    char digits[16];
+    writeBytes(writer, digits, snprintf(digits, sizeof(digits), "%d", number));
+}
+
+void writeJsonString(JsonWriter *writer, const wchar_t *string) {
+    writeBytes(writer, "\"", 1);
+    for (; *string; string++) {
+        uint32_t code = (uint32_t)*string;
+        char bytes[8];
+        int length = 0;
+        if (code == '"' || code == '\\') {
+            bytes[length++] = '\\';
+            bytes[length++] = (char)code;
+        } else if (code < 0x20) {
+            length = snprintf(bytes, sizeof(bytes), "\\u%04x", code);
+        } else {
+            length = encodeUtf8(code, bytes);
+        }
+        writeBytes(writer, bytes, length);
+    }
+    writeBytes(writer, "\"", 1);
+}
@@ -0,0 +1,26 @@
+// json.h
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wchar.h>
+
+// Output is built in a byte buffer, so a message can be measured or written
+// in one go. Running out of memory exits the process.
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} JsonWriter;
+
+// Stores the UTF-8 form of a character in bytes and returns its length, 1 to 4
+int encodeUtf8(uint32_t code, char *bytes);
+
+void writeBytes(JsonWriter *writer, const char *bytes, size_t length);
+void writeText(JsonWriter *writer, const char *text);
+void writeInt(JsonWriter *writer, int number);
+// Writes a quoted JSON string in UTF-8, whatever the locale
+void writeJsonString(JsonWriter *writer, const wchar_t *string);
+
+#endif // JSON_H
@@ -1,64 +1,190 @@
 #include "lexer.h"
-#include <ctype.h>
+#include "script.h"
+#include "diagnostic.h"
+#include "charclass.h"
+#include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <wchar.h>
 #include <locale.h>
 
-int isArabicLetter(wchar_t ch) {
-    // Check if the character falls within the Arabic Unicode range
-    return (ch >= 0x0600 && ch <= 0x06FF); // This range covers most Arabic characters
+// Checks for a keyword that is not just the start of a longer identifier
+int matchKeyword(wchar_t *source, const wchar_t *keyword) {
+    size_t len = wcslen(keyword);
+    if (wcsncmp(source, keyword, len) != 0) {
+        return 0;
+    }
+    wchar_t next = source[len];
+    return !(charClass(next) & CHAR_NAME);
+}
+
+// Copies the name starting at source into a new string and returns the
+// character after it, or NULL when out of memory
+wchar_t *scanName(wchar_t *source, wchar_t **name) {
+    wchar_t *start = source;
+    while (charClass(*source) & CHAR_NAME) {
+        source++;
+    }
+    *name = malloc((source - start + 1) * sizeof(wchar_t));
+    if (!*name) {
+        fwprintf(scriptErrors, L"Failed to allocate memory\n");
+        return NULL;
+    }
+    wmemcpy(*name, start, source - start);
+    (*name)[source - start] = L'\0';
+    return source;
+}
+
+// Reads the number at source into token and returns the character after it,
+// or NULL when out of memory. Digits may come from any of the digit sets and
+// the fraction may follow '.' or the Arabic decimal separator. The number is
+// copied out in ASCII for the C library to convert, so doubles round as
+// before. outOfRange is set for integers that do not fit in 64 bits.
+wchar_t *scanNumber(wchar_t *source, Token *token, int *outOfRange) {
+    wchar_t *start = source;
+    int isDouble = 0;
+    if (*source == L'-') {
+        source++;
+    }
+    while (charClass(*source) & CHAR_DIGIT) {
+        source++;
+    }
+    if ((*source == L'.' || *source == L'\u066B') && (charClass(source[1]) & CHAR_DIGIT)) {
+        isDouble = 1;
+        source++;
+        while (charClass(*source) & CHAR_DIGIT) {
+            source++;
+        }
+        if (*source == L'e' || *source == L'E') {
+            wchar_t *exponent = source + 1;
+            if (*exponent == L'+' || *exponent == L'-') {
+                exponent++;
+            }
+            if (charClass(*exponent) & CHAR_DIGIT) {
+                source = exponent;
+                while (charClass(*source) & CHAR_DIGIT) {
+                    source++;
+                }
+            }
+        }
+    }
+
+    size_t length = source - start;
+    char shortText[64];
+    char *text = length < sizeof(shortText) ? shortText : malloc(length + 1);
+    if (!text) {
+        fwprintf(scriptErrors, L"Failed to allocate memory\n");
+        return NULL;
+    }
+    for (size_t i = 0; i < length; i++) {
+        unsigned kind = charClass(start[i]);
+        if (kind & CHAR_DIGIT) {
+            text[i] = (char)('0' + digitValue(kind));
+        } else {
+            text[i] = start[i] == L'\u066B' ? '.' : (char)start[i];
+        }
+    }
+    text[length] = '\0';
+
+    errno = 0;
+    if (isDouble) {
+        token->type = TOKEN_DOUBLE;
+        token->doubleValue = strtod(text, NULL);
+        *outOfRange = 0;
+    } else {
+        token->type = TOKEN_INT;
+        token->intValue = strtoll(text, NULL, 10);
+        *outOfRange = errno == ERANGE;
+    }
+    if (text != shortText) {
+        free(text);
+    }
+    return source;
 }
 
+// Frees the tokens lexed so far and stops the script. The token being lexed
+// owns no string yet.
+_Noreturn void abortLexer(Token *tokens, int tokenCount) {
+    tokens[tokenCount].type = TOKEN_EOF;
+    freeTokens(tokens);
+    abortScript();
+}
+
+// Prints a lexer error, or records it when diagnostics are being collected
+void reportLexerError(int offset, const wchar_t *message) {
+    if (diagnosticList) {
+        addDiagnostic(diagnosticList, offset, message);
+    } else {
+        fwprintf(scriptErrors, L"%ls\n", message);
+    }
+}
+
+// Number of errors the last tokenize call reported and lexed past
+_Thread_local int lexerErrorCount = 0;
+
 // Function to tokenize the input
 Token *tokenize(wchar_t *source) 
+{
+    int tokenCount;
+    return tokenizeRange(source, NULL, &tokenCount);
+}
+
+// Tokenizes up to end, or to the terminating null when end is NULL. The
+// token count does not include the closing TOKEN_EOF.
+Token *tokenizeRange(wchar_t *source, wchar_t *end, int *count)
 {
     int capacity = 10;
     Token *tokens = malloc(capacity * sizeof(Token));
     if (!tokens) 
     {
-        fprintf(stderr, "Failed to allocate memory\n");
-        exit(EXIT_FAILURE);
+        fwprintf(scriptErrors, L"Failed to allocate memory\n");
+        abortScript();
     }
 
     int tokenCount = 0;
+    lexerErrorCount = 0;
+    wchar_t *begin = source;
 
-    while (*source != '\0')
+    while (*source != '\0' && (!end || source < end))
     {
-        // Resize tokens array if necessary
-        if (tokenCount >= capacity) 
+        // Resize tokens array if necessary, keeping room for the closing TOKEN_EOF
+        if (tokenCount + 1 >= capacity) 
         {
             capacity *= 2;
             tokens = realloc(tokens, capacity * sizeof(Token));
             if (!tokens) 
             {
-                fprintf(stderr, "Failed to reallocate memory\n");
-                exit(EXIT_FAILURE);
+                fwprintf(scriptErrors, L"Failed to reallocate memory\n");
+                abortScript();
             }
         }
 
-        if (isspace(*source)) 
+        unsigned kind = charClass(*source);
+        if (kind & CHAR_SPACE) 
         {
             source++;
             continue;
         }
+        tokens[tokenCount].offset = (int)(source - begin);
 
-        if (isdigit(*source) || (*source == '-' && isdigit(*(source + 1)))) 
+        // A '-' starts a number only if a digit follows inside the range
+        if ((kind & CHAR_DIGIT) || (*source == '-' && (!end || source + 1 < end) && (charClass(source[1]) & CHAR_DIGIT))) 
         {
-            wchar_t *endPtr;
-            tokens[tokenCount].type = TOKEN_INT;
-            tokens[tokenCount].intValue = wcstol(source, &endPtr, 10); // Try to read as integer first
-
-            if (*endPtr == L'.') {
-                if (isdigit(*(endPtr + 1))) {
-                    tokens[tokenCount].type = TOKEN_DOUBLE;
-                    tokens[tokenCount].doubleValue = wcstod(source, &source); // Read DOUBLE, advance source
-                } else {
-                    source = endPtr; // Advance source after reading int
+            int outOfRange;
+            source = scanNumber(source, &tokens[tokenCount], &outOfRange);
+            if (!source) {
+                abortLexer(tokens, tokenCount);
+            }
+
+            if (outOfRange) {
+                reportLexerError(tokens[tokenCount].offset, L"Integer literal out of range");
+                if (!diagnosticList) {
+                    abortLexer(tokens, tokenCount);
                 }
-            } else {
-                source = endPtr; // Advance source after reading int
+                tokens[tokenCount].type = TOKEN_ERROR;
+                lexerErrorCount++;
             }
 
         }
@@ -187,6 +313,14 @@ Token *tokenize(wchar_t *source)
                     tokens[tokenCount].type = TOKEN_RIGHT_BRACKET; 
                     break;
 
+                case '{': 
+                    tokens[tokenCount].type = TOKEN_LEFT_BRACE; 
+                    break;
+
+                case '}': 
+                    tokens[tokenCount].type = TOKEN_RIGHT_BRACE; 
+                    break;
+
                 case '#': 
                     tokens[tokenCount].type = TOKEN_COMMENT; 
                     break;
@@ -213,25 +347,15 @@ Token *tokenize(wchar_t *source)
                     else if (wcsncmp(source, L"ل", wcslen(L"ل")) == 0) {
                         wchar_t* nextChar = source + 1;
 
-                        // Check if the next character is an Arabic letter
-                        if (isArabicLetter(*nextChar)) {
+                        // Check if the next character continues a name
+                        if (charClass(*nextChar) & CHAR_NAME) {
                             // Tokenize as a variable
                             tokens[tokenCount].type = TOKEN_VARIABLE;
-                            tokens[tokenCount].varName = malloc(sizeof(wchar_t)); // Allocate initial memory
-                            tokens[tokenCount].varName[0] = L'\0'; // Set as empty string
-
-                            while (isArabicLetter(*source) || isdigit(*source) || *source == L'_') {
-                                size_t len = wcslen(tokens[tokenCount].varName);
-                                wchar_t* str = realloc(tokens[tokenCount].varName, sizeof(wchar_t) * (len + 2));
-                                if (!str) {
-                                    fprintf(stderr, "Failed to reallocate memory\n");
-                                    exit(EXIT_FAILURE);
-                                }
-                                tokens[tokenCount].varName = str;
-                                wchar_t tempStr[2] = {*source, L'\0'}; // Create a temporary string
-                                wcscat(tokens[tokenCount].varName, tempStr); // Append the character
-                                source++;
+                            source = scanName(source, &tokens[tokenCount].varName);
+                            if (!source) {
+                                abortLexer(tokens, tokenCount);
                             }
+                            source--; // Leave the following character for the next token
                         } else {
                             // Tokenize as for
                             tokens[tokenCount].type = TOKEN_FOR;
@@ -246,6 +370,18 @@ Token *tokenize(wchar_t *source)
                         break;
                     } 
 
+                    else if (matchKeyword(source, L"دالة")) {
+                        tokens[tokenCount].type = TOKEN_FUNCTION;
+                        source += wcslen(L"دالة") - 1;
+                        break;
+                    }
+
+                    else if (matchKeyword(source, L"ارجع")) {
+                        tokens[tokenCount].type = TOKEN_RETURN;
+                        source += wcslen(L"ارجع") - 1;
+                        break;
+                    }
+
                     else if (wcsncmp(source, L"&&", wcslen(L"&&")) == 0) {
                         tokens[tokenCount].type = TOKEN_AND; 
                         source++;
@@ -258,22 +394,11 @@ Token *tokenize(wchar_t *source)
                         break;
                     }
                     
-                    else if (isArabicLetter(*source)) {
+                    else if (kind & CHAR_NAME_START) {
                         tokens[tokenCount].type = TOKEN_VARIABLE;
-                        tokens[tokenCount].varName = malloc(sizeof(wchar_t)); // Allocate initial memory
-                        tokens[tokenCount].varName[0] = L'\0'; // Set as empty string
-
-                        while (isArabicLetter(*source) || isdigit(*source) || *source == L'_') {
-                            size_t len = wcslen(tokens[tokenCount].varName);
-                            wchar_t* str = realloc(tokens[tokenCount].varName, sizeof(wchar_t) * (len + 2));
-                            if (!str) {
-                                fprintf(stderr, "Failed to reallocate memory\n");
-                                exit(EXIT_FAILURE);
-                            }
-                            tokens[tokenCount].varName = str;
-                            wchar_t tempStr[2] = {*source, L'\0'}; // Create a temporary string
-                            wcscat(tokens[tokenCount].varName, tempStr); // Append the character
-                            source++;
+                        source = scanName(source, &tokens[tokenCount].varName);
+                        if (!source) {
+                            abortLexer(tokens, tokenCount);
                         }
                         source--;
                         break;
@@ -298,205 +423,267 @@ Token *tokenize(wchar_t *source)
                                 tokens[tokenCount].charValue[len] = L'\0'; // Null-terminate the string
                             } 
                             else {
-                                fprintf(stderr, "Failed to allocate memory\n");
-                                exit(EXIT_FAILURE);
+                                fwprintf(scriptErrors, L"Failed to allocate memory\n");
+                                abortLexer(tokens, tokenCount);
                             }
                         } 
                         else {
-                            fprintf(stderr, "Unterminated string literal\n");
-                            exit(EXIT_FAILURE);
+                            reportLexerError(tokens[tokenCount].offset, L"Unterminated string literal");
+                            if (!diagnosticList) {
+                                abortLexer(tokens, tokenCount);
+                            }
+                            tokens[tokenCount].type = TOKEN_ERROR;
+                            lexerErrorCount++;
+                            source--; // Stay on the terminating null
                         }
                         break;
                     }
                     else {
-                        printf("Unexpected character: %c\n", *source);
+                        wchar_t message[32];
+                        swprintf(message, 32, L"Unexpected character: %lc", *source);
+                        reportLexerError(tokens[tokenCount].offset, message);
+                        tokens[tokenCount].type = TOKEN_ERROR;
+                        lexerErrorCount++;
                         break;
                     }                  
             }
-            source++;
+            if (*source != '\0') // Keywords that skip the next character may end on the null
+            {
+                source++;
+            }
         }
         tokenCount++;
     }
 
     // Mark the end of the tokens
     tokens[tokenCount].type = TOKEN_EOF;
+    tokens[tokenCount].offset = (int)(source - begin);
+    *count = tokenCount;
     return tokens;
 }
 
+// Lexes more source onto the end of a token array, replacing its TOKEN_EOF.
+// Only the new source is read, and the array grows by doubling, so the cost
+// depends on the new source alone. Start with tokens NULL and both counts 0.
+Token *tokenizeMore(Token *tokens, int *tokenCount, int *capacity, wchar_t *source)
+{
+    int count;
+    Token *more = tokenizeRange(source, NULL, &count);
+    if (*tokenCount + count + 1 > *capacity) {
+        int grown = *capacity ? *capacity : 64;
+        while (grown < *tokenCount + count + 1) {
+            grown *= 2;
+        }
+        Token *moved = realloc(tokens, grown * sizeof(Token));
+        if (!moved) {
+            fwprintf(scriptErrors, L"Failed to reallocate memory\n");
+            abortScript();
+        }
+        tokens = moved;
+        *capacity = grown;
+    }
+    memcpy(tokens + *tokenCount, more, (count + 1) * sizeof(Token)); // Includes the new TOKEN_EOF
+    *tokenCount += count;
+    free(more);
+    return tokens;
+}
+
+// Frees a token array returned by tokenize, with its strings
+void freeTokens(Token *tokens) {
+    for (Token *token = tokens; token->type != TOKEN_EOF; token++) {
+        if (token->type == TOKEN_VARIABLE || token->type == TOKEN_CHAR) {
+            free(token->varName);
+        }
+    }
+    free(tokens);
+}
+
 // Function to print tokens for debugging
 void printToken(Token token) 
 {
     switch (token.type) 
     {
         case TOKEN_INT: 
-            printf("INT(%d) ", token.intValue); // here
+            fwprintf(scriptErrors, L"INT(%" PRId64 ") ", token.intValue); // here
             break;
 
         case TOKEN_DOUBLE:
-            printf("DOUBLE(%lf) ", token.doubleValue); // here
+            fwprintf(scriptErrors, L"DOUBLE(%lf) ", token.doubleValue); // here
             break;
 
         case TOKEN_PLUS: 
-            printf("PLUS "); 
+            fwprintf(scriptErrors, L"PLUS "); 
             break;
 
         case TOKEN_MINUS: 
-            printf("MINUS "); 
+            fwprintf(scriptErrors, L"MINUS "); 
             break;
 
         case TOKEN_EXPONENT: 
-            printf("EXPONENT"); 
+            fwprintf(scriptErrors, L"EXPONENT"); 
             break;
 
         case TOKEN_COMMENT: 
-            printf("COMMENT"); 
+            fwprintf(scriptErrors, L"COMMENT"); 
             break;
         
         case TOKEN_PRINT: 
-            printf("PRINT"); 
+            fwprintf(scriptErrors, L"PRINT"); 
             break;
 
         case TOKEN_STAR: 
-            printf("STAR "); 
+            fwprintf(scriptErrors, L"STAR "); 
             break;
         case TOKEN_SLASH: 
-            printf("SLASH "); 
+            fwprintf(scriptErrors, L"SLASH "); 
             break;
 
         case TOKEN_LPAREN: 
-            printf("LPAREN "); 
+            fwprintf(scriptErrors, L"LPAREN "); 
             break;
 
         case TOKEN_RPAREN: 
-            printf("RPAREN "); 
+            fwprintf(scriptErrors, L"RPAREN "); 
             break;
 
         case TOKEN_VARIABLE: 
-            wprintf(L"VARIABLE(%ls) ", token.varName);
+            fwprintf(scriptErrors, L"VARIABLE(%ls) ", token.varName);
             break;
 
         case TOKEN_EOF: 
-            printf("EOF "); 
+            fwprintf(scriptErrors, L"EOF "); 
             break;
 
         case TOKEN_FOR: 
-            printf("FOR "); 
+            fwprintf(scriptErrors, L"FOR "); 
             break;
 
         case TOKEN_IF: 
-            printf("IF "); 
+            fwprintf(scriptErrors, L"IF "); 
             break;
 
         case TOKEN_ELSE: 
-            printf("ELSE "); 
+            fwprintf(scriptErrors, L"ELSE "); 
             break;
 
         case TOKEN_WHILE: 
-            printf("WHILE "); 
+            fwprintf(scriptErrors, L"WHILE "); 
             break;
 
         case TOKEN_CHAR: 
-            wprintf(L"STRING(%ls) ", token.charValue);
+            fwprintf(scriptErrors, L"STRING(%ls) ", token.charValue);
             break;
 
         case TOKEN_RETURN: 
-            printf("RETURN "); 
+            fwprintf(scriptErrors, L"RETURN "); 
             break;
 
         case TOKEN_MODULUS: 
-            printf("MODULUS "); 
+            fwprintf(scriptErrors, L"MODULUS "); 
             break;
 
         case TOKEN_EQUAL_TO: 
-            printf("EQUAL_TO "); 
+            fwprintf(scriptErrors, L"EQUAL_TO "); 
             break;
 
         case TOKEN_LESS_THAN: 
-            printf("LESS_THAN "); 
+            fwprintf(scriptErrors, L"LESS_THAN "); 
             break;
 
         case TOKEN_GREATER_THAN: 
-            printf("GREATER_THAN "); 
+            fwprintf(scriptErrors, L"GREATER_THAN "); 
             break;
 
         case TOKEN_AND: 
-            printf("AND "); 
+            fwprintf(scriptErrors, L"AND "); 
             break;
 
         case TOKEN_OR: 
-            printf("OR "); 
+            fwprintf(scriptErrors, L"OR "); 
             break;
 
         case TOKEN_INCREMENT_BY:
-            printf("INCREMENT_BY ");
+            fwprintf(scriptErrors, L"INCREMENT_BY ");
             break;
 
         case TOKEN_MULTIPLY_BY:
-            printf("MULTIPLY_BY ");
+            fwprintf(scriptErrors, L"MULTIPLY_BY ");
             break;
 
         case TOKEN_DECREASE_BY:
-            printf("DECREASE_BY ");
+            fwprintf(scriptErrors, L"DECREASE_BY ");
             break;
 
         case TOKEN_DIVIDE_BY:
-            printf("DIVIDE_BY ");
+            fwprintf(scriptErrors, L"DIVIDE_BY ");
             break;
 
         case TOKEN_MOD_BY:
-            printf("MOD_BY ");
+            fwprintf(scriptErrors, L"MOD_BY ");
             break;
 
         case TOKEN_NOT_EQUAL_TO:
-            printf("NOT_EQUAL_TO ");
+            fwprintf(scriptErrors, L"NOT_EQUAL_TO ");
             break;
 
         case TOKEN_LESS_THAN_OR_EQUAL_TO:
-            printf("LESS_THAN_OR_EQUAL_TO ");
+            fwprintf(scriptErrors, L"LESS_THAN_OR_EQUAL_TO ");
             break;
 
         case TOKEN_GREATER_THAN_OR_EQUAL_TO:
-            printf("GREATER_THAN_OR_EQUAL_TO ");
+            fwprintf(scriptErrors, L"GREATER_THAN_OR_EQUAL_TO ");
             break;
 
         case TOKEN_COMMA:
-            printf("COMMA ");
+            fwprintf(scriptErrors, L"COMMA ");
             break;
 
         case TOKEN_SEMICOLON:
-            printf("SEMICOLON ");
+            fwprintf(scriptErrors, L"SEMICOLON ");
             break;
 
         case TOKEN_PERIOD:
-            printf("PERIOD ");
+            fwprintf(scriptErrors, L"PERIOD ");
             break;
 
         case TOKEN_COLON:
-            printf("COLON ");
+            fwprintf(scriptErrors, L"COLON ");
             break;
 
         case TOKEN_QUESTION_MARK:
-            printf("QUESTION_MARK ");
+            fwprintf(scriptErrors, L"QUESTION_MARK ");
             break;
 
         case TOKEN_EXCLAMATION_MARK:
-            printf("EXCLAMATION_MARK ");
+            fwprintf(scriptErrors, L"EXCLAMATION_MARK ");
             break;
 
         case TOKEN_LEFT_BRACKET:
-            printf("LEFT_BRACKET ");
+            fwprintf(scriptErrors, L"LEFT_BRACKET ");
             break;
 
         case TOKEN_RIGHT_BRACKET:
-            printf("RIGHT_BRACKET ");
+            fwprintf(scriptErrors, L"RIGHT_BRACKET ");
             break;
 
         case TOKEN_ASSIGNMENT:
-            printf("ASSIGNMENT ");
+            fwprintf(scriptErrors, L"ASSIGNMENT ");
+            break;
+
+        case TOKEN_FUNCTION:
+            fwprintf(scriptErrors, L"FUNCTION ");
+            break;
+
+        case TOKEN_LEFT_BRACE:
+            fwprintf(scriptErrors, L"LEFT_BRACE ");
+            break;
+
+        case TOKEN_RIGHT_BRACE:
+            fwprintf(scriptErrors, L"RIGHT_BRACE ");
             break;
             
         default:
-            printf("UNKNOWN ");
+            fwprintf(scriptErrors, L"UNKNOWN ");
             break;
     }
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <wchar.h>
 #include <locale.h>
 
@@ -51,13 +52,17 @@ typedef enum {
     TOKEN_PRINT,
     TOKEN_ERROR,
     TOKEN_ASSIGNMENT,
+    TOKEN_FUNCTION,
+    TOKEN_LEFT_BRACE,
+    TOKEN_RIGHT_BRACE,
 } TokenType;
 
 // Token structure
 typedef struct {
     TokenType type;
+    int offset; // Position in the lexed text, in characters
     union {
-        int intValue;    // For TOKEN_INT
+        int64_t intValue;    // For TOKEN_INT
         double doubleValue; // For TOKEN_DOUBLE
         wchar_t * charValue; // For TOKEN_CHAR
         wchar_t * varName;    // For TOKEN_VARIABLE
@@ -66,7 +71,12 @@ typedef struct {
 } Token;
 
 
+extern _Thread_local int lexerErrorCount;
+
 Token *tokenize(wchar_t *source);
+Token *tokenizeRange(wchar_t *source, wchar_t *end, int *count);
+Token *tokenizeMore(Token *tokens, int *tokenCount, int *capacity, wchar_t *source);
+void freeTokens(Token *tokens);
 void printToken(Token token);
 
 #endif // LEXER_H
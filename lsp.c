@@ -0,0 +1,517 @@
+#include "lsp.h"
+#include "json.h"
+#include "document.h"
+#include "script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#define JSON_MAX_DEPTH 64
+
+typedef enum {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+} JsonKind;
+
+typedef struct JsonValue {
+    JsonKind kind;
+    double number;              // Also 0 or 1 for JSON_BOOL
+    wchar_t *string;            // JSON_STRING, decoded
+    int stringLength;
+    wchar_t **keys;             // JSON_OBJECT
+    struct JsonValue **items;   // Elements of an array, values of an object
+    int itemCount;
+    const char *raw;            // The value's text in the message, to echo request ids
+    size_t rawLength;
+} JsonValue;
+
+typedef struct {
+    wchar_t *uri;
+    Document document;
+} OpenDocument;
+
+OpenDocument *openDocuments = NULL;
+int openDocumentCount = 0;
+
+void lspOutOfMemory() {
+    fwprintf(stderr, L"Failed to allocate memory for the language server\n");
+    exit(EXIT_FAILURE);
+}
+
+void freeJson(JsonValue *value) {
+    if (!value) {
+        return;
+    }
+    for (int i = 0; i < value->itemCount; i++) {
+        freeJson(value->items[i]);
+        if (value->keys) {
+            free(value->keys[i]);
+        }
+    }
+    free(value->items);
+    free(value->keys);
+    free(value->string);
+    free(value);
+}
+
+void skipJsonSpace(const char **cursor, const char *end) {
+    while (*cursor < end && (**cursor == ' ' || **cursor == '\t' || **cursor == '\r' || **cursor == '\n')) {
+        (*cursor)++;
+    }
+}
+
+// Decodes one UTF-8 sequence, or returns U+FFFD for a malformed one
+wchar_t decodeUtf8(const char **cursor, const char *end) {
+    unsigned char lead = (unsigned char)*(*cursor)++;
+    int extra = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+    if (lead >= 0x80 && extra == 0) {
+        return 0xFFFD;
+    }
+    uint32_t code = extra ? lead & (0x3F >> extra) : lead;
+    for (int i = 0; i < extra; i++) {
+        if (*cursor == end || ((unsigned char)**cursor & 0xC0) != 0x80) {
+            return 0xFFFD;
+        }
+        code = (code << 6) | ((unsigned char)*(*cursor)++ & 0x3F);
+    }
+    return code > 0x10FFFF ? 0xFFFD : (wchar_t)code;
+}
+
+int readHex4(const char **cursor, const char *end, uint32_t *code) {
+    *code = 0;
+    for (int i = 0; i < 4; i++) {
+        if (*cursor == end) {
+            return 0;
+        }
+        char digit = *(*cursor)++;
+        *code <<= 4;
+        if (digit >= '0' && digit <= '9') {
+            *code |= digit - '0';
+        } else if (digit >= 'a' && digit <= 'f') {
+            *code |= digit - 'a' + 10;
+        } else if (digit >= 'A' && digit <= 'F') {
+            *code |= digit - 'A' + 10;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Parses a string after its opening quote. The decoded text is never longer
+// than the encoded one.
+wchar_t *parseJsonString(const char **cursor, const char *end, int *length) {
+    const char *close = *cursor;
+    while (close < end && *close != '"') {
+        close += *close == '\\' && close + 1 < end ? 2 : 1;
+    }
+    if (close >= end) {
+        return NULL;
+    }
+    wchar_t *string = malloc((close - *cursor + 1) * sizeof(wchar_t));
+    if (!string) {
+        lspOutOfMemory();
+    }
+    int count = 0;
+    while (*cursor < close) {
+        if (**cursor != '\\') {
+            string[count++] = decodeUtf8(cursor, close);
+            continue;
+        }
+        (*cursor)++;
+        char escape = *(*cursor)++;
+        uint32_t code;
+        switch (escape) {
+            case '"': string[count++] = L'"'; break;
+            case '\\': string[count++] = L'\\'; break;
+            case '/': string[count++] = L'/'; break;
+            case 'b': string[count++] = L'\b'; break;
+            case 'f': string[count++] = L'\f'; break;
+            case 'n': string[count++] = L'\n'; break;
+            case 'r': string[count++] = L'\r'; break;
+            case 't': string[count++] = L'\t'; break;
+            case 'u':
+                if (!readHex4(cursor, close, &code)) {
+                    free(string);
+                    return NULL;
+                }
+                // A surrogate pair escapes one character beyond the BMP
+                if (code >= 0xD800 && code < 0xDC00 && close - *cursor >= 6 && (*cursor)[0] == '\\' && (*cursor)[1] == 'u') {
+                    const char *low = *cursor + 2;
+                    uint32_t lowCode;
+                    if (readHex4(&low, close, &lowCode) && lowCode >= 0xDC00 && lowCode < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (lowCode - 0xDC00);
+                        *cursor = low;
+                    }
+                }
+                string[count++] = (code >= 0xD800 && code < 0xE000) ? 0xFFFD : (wchar_t)code;
+                break;
+            default:
+                free(string);
+                return NULL;
+        }
+    }
+    *cursor = close + 1;
+    string[count] = L'\0';
+    *length = count;
+    return string;
+}
+
+JsonValue *parseJson(const char **cursor, const char *end, int depth);
+
+// Adds an element to an array, or a member to an object when key is set
+int parseJsonItems(JsonValue *value, const char **cursor, const char *end, int depth, char closing) {
+    int capacity = 0;
+    skipJsonSpace(cursor, end);
+    if (*cursor < end && **cursor == closing) {
+        (*cursor)++;
+        return 1;
+    }
+    while (1) {
+        wchar_t *key = NULL;
+        if (closing == '}') {
+            int length;
+            skipJsonSpace(cursor, end);
+            if (*cursor == end || **cursor != '"') {
+                return 0;
+            }
+            (*cursor)++;
+            key = parseJsonString(cursor, end, &length);
+            skipJsonSpace(cursor, end);
+            if (!key || *cursor == end || **cursor != ':') {
+                free(key);
+                return 0;
+            }
+            (*cursor)++;
+        }
+        JsonValue *item = parseJson(cursor, end, depth + 1);
+        if (!item) {
+            free(key);
+            return 0;
+        }
+        if (value->itemCount == capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            value->items = realloc(value->items, capacity * sizeof(JsonValue *));
+            if (closing == '}') {
+                value->keys = realloc(value->keys, capacity * sizeof(wchar_t *));
+            }
+            if (!value->items || (closing == '}' && !value->keys)) {
+                lspOutOfMemory();
+            }
+        }
+        if (closing == '}') {
+            value->keys[value->itemCount] = key;
+        }
+        value->items[value->itemCount++] = item;
+
+        skipJsonSpace(cursor, end);
+        if (*cursor == end) {
+            return 0;
+        }
+        char separator = *(*cursor)++;
+        if (separator == closing) {
+            return 1;
+        }
+        if (separator != ',') {
+            return 0;
+        }
+    }
+}
+
+// Returns NULL if the text is not valid JSON
+JsonValue *parseJson(const char **cursor, const char *end, int depth) {
+    skipJsonSpace(cursor, end);
+    if (*cursor == end || depth > JSON_MAX_DEPTH) {
+        return NULL;
+    }
+    JsonValue *value = calloc(1, sizeof(JsonValue));
+    if (!value) {
+        lspOutOfMemory();
+    }
+    value->raw = *cursor;
+    int valid = 1;
+    char first = **cursor;
+    if (first == '{' || first == '[') {
+        (*cursor)++;
+        value->kind = first == '{' ? JSON_OBJECT : JSON_ARRAY;
+        valid = parseJsonItems(value, cursor, end, depth, first == '{' ? '}' : ']');
+    } else if (first == '"') {
+        (*cursor)++;
+        value->kind = JSON_STRING;
+        value->string = parseJsonString(cursor, end, &value->stringLength);
+        valid = value->string != NULL;
+    } else if (end - *cursor >= 4 && strncmp(*cursor, "true", 4) == 0) {
+        value->kind = JSON_BOOL;
+        value->number = 1;
+        *cursor += 4;
+    } else if (end - *cursor >= 5 && strncmp(*cursor, "false", 5) == 0) {
+        value->kind = JSON_BOOL;
+        *cursor += 5;
+    } else if (end - *cursor >= 4 && strncmp(*cursor, "null", 4) == 0) {
+        *cursor += 4;
+    } else {
+        // The message ends in a null byte, so strtod cannot run past it
+        char *numberEnd;
+        value->kind = JSON_NUMBER;
+        value->number = strtod(*cursor, &numberEnd);
+        valid = numberEnd > *cursor && numberEnd <= end;
+        *cursor = numberEnd;
+    }
+    if (!valid) {
+        freeJson(value);
+        return NULL;
+    }
+    value->rawLength = *cursor - value->raw;
+    return value;
+}
+
+JsonValue *jsonMember(JsonValue *object, const wchar_t *key) {
+    if (!object || object->kind != JSON_OBJECT) {
+        return NULL;
+    }
+    for (int i = 0; i < object->itemCount; i++) {
+        if (wcscmp(object->keys[i], key) == 0) {
+            return object->items[i];
+        }
+    }
+    return NULL;
+}
+
+int jsonInt(JsonValue *value) {
+    return value && value->kind == JSON_NUMBER ? (int)value->number : 0;
+}
+
+// Frames the message with its Content-Length header and sends it
+void sendMessage(JsonWriter *writer) {
+    fprintf(stdout, "Content-Length: %zu\r\n\r\n", writer->length);
+    fwrite(writer->data, 1, writer->length, stdout);
+    fflush(stdout);
+    writer->length = 0;
+}
+
+void sendResult(JsonWriter *writer, JsonValue *id, const char *result) {
+    writeText(writer, "{\"jsonrpc\":\"2.0\",\"id\":");
+    writeBytes(writer, id->raw, id->rawLength);
+    writeText(writer, ",\"result\":");
+    writeText(writer, result);
+    writeText(writer, "}");
+    sendMessage(writer);
+}
+
+void sendError(JsonWriter *writer, JsonValue *id, int code, const char *message) {
+    writeText(writer, "{\"jsonrpc\":\"2.0\",\"id\":");
+    if (id) {
+        writeBytes(writer, id->raw, id->rawLength);
+    } else {
+        writeText(writer, "null");
+    }
+    writeText(writer, ",\"error\":{\"code\":");
+    writeInt(writer, code);
+    writeText(writer, ",\"message\":\"");
+    writeText(writer, message);
+    writeText(writer, "\"}}");
+    sendMessage(writer);
+}
+
+typedef struct {
+    JsonWriter *writer;
+    int count;
+} DiagnosticOutput;
+
+void writeDiagnostic(void *context, int line, int column, const wchar_t *message) {
+    DiagnosticOutput *output = context;
+    JsonWriter *writer = output->writer;
+    writeText(writer, output->count++ ? ",{\"range\":{\"start\":{\"line\":" : "{\"range\":{\"start\":{\"line\":");
+    writeInt(writer, line);
+    writeText(writer, ",\"character\":");
+    writeInt(writer, column);
+    writeText(writer, "},\"end\":{\"line\":");
+    writeInt(writer, line);
+    writeText(writer, ",\"character\":");
+    writeInt(writer, column + 1);
+    writeText(writer, "}},\"severity\":1,\"source\":\"habibi\",\"message\":");
+    writeJsonString(writer, message);
+    writeText(writer, "}");
+}
+
+void publishDiagnostics(JsonWriter *writer, OpenDocument *open) {
+    analyzeDocument(&open->document);
+    writeText(writer, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    writeJsonString(writer, open->uri);
+    writeText(writer, ",\"diagnostics\":[");
+    DiagnosticOutput output = {writer, 0};
+    forEachDiagnostic(&open->document, writeDiagnostic, &output);
+    writeText(writer, "]}}");
+    sendMessage(writer);
+}
+
+OpenDocument *findDocument(JsonValue *params) {
+    JsonValue *uri = jsonMember(jsonMember(params, L"textDocument"), L"uri");
+    if (!uri || uri->kind != JSON_STRING) {
+        return NULL;
+    }
+    for (int i = 0; i < openDocumentCount; i++) {
+        if (wcscmp(openDocuments[i].uri, uri->string) == 0) {
+            return &openDocuments[i];
+        }
+    }
+    return NULL;
+}
+
+void openDocument(JsonWriter *writer, JsonValue *params) {
+    JsonValue *item = jsonMember(params, L"textDocument");
+    JsonValue *uri = jsonMember(item, L"uri");
+    JsonValue *text = jsonMember(item, L"text");
+    if (!uri || uri->kind != JSON_STRING || !text || text->kind != JSON_STRING) {
+        return;
+    }
+    OpenDocument *open = findDocument(params);
+    if (open) {
+        freeDocument(&open->document);
+    } else {
+        openDocuments = realloc(openDocuments, (openDocumentCount + 1) * sizeof(OpenDocument));
+        if (!openDocuments) {
+            lspOutOfMemory();
+        }
+        open = &openDocuments[openDocumentCount++];
+        open->uri = wcsdup(uri->string);
+        if (!open->uri) {
+            lspOutOfMemory();
+        }
+    }
+    initDocument(&open->document, text->string, text->stringLength);
+    publishDiagnostics(writer, open);
+}
+
+// Applies the changes in order; a change without a range replaces the whole text
+void changeDocument(JsonWriter *writer, JsonValue *params) {
+    OpenDocument *open = findDocument(params);
+    JsonValue *changes = jsonMember(params, L"contentChanges");
+    if (!open || !changes || changes->kind != JSON_ARRAY) {
+        return;
+    }
+    for (int i = 0; i < changes->itemCount; i++) {
+        JsonValue *text = jsonMember(changes->items[i], L"text");
+        JsonValue *range = jsonMember(changes->items[i], L"range");
+        if (!text || text->kind != JSON_STRING) {
+            continue;
+        }
+        if (range) {
+            JsonValue *from = jsonMember(range, L"start");
+            JsonValue *to = jsonMember(range, L"end");
+            int start = documentOffset(&open->document, jsonInt(jsonMember(from, L"line")), jsonInt(jsonMember(from, L"character")));
+            int end = documentOffset(&open->document, jsonInt(jsonMember(to, L"line")), jsonInt(jsonMember(to, L"character")));
+            editDocument(&open->document, start, end, text->string, text->stringLength);
+        } else {
+            freeDocument(&open->document);
+            initDocument(&open->document, text->string, text->stringLength);
+        }
+    }
+    publishDiagnostics(writer, open);
+}
+
+void closeDocument(JsonWriter *writer, JsonValue *params) {
+    OpenDocument *open = findDocument(params);
+    if (!open) {
+        return;
+    }
+    // Clear the editor's markers before forgetting the document
+    writeText(writer, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":");
+    writeJsonString(writer, open->uri);
+    writeText(writer, ",\"diagnostics\":[]}}");
+    sendMessage(writer);
+
+    freeDocument(&open->document);
+    free(open->uri);
+    *open = openDocuments[--openDocumentCount];
+}
+
+// Reads one framed message into a null-terminated buffer. Returns NULL at
+// the end of input.
+char *readMessage(size_t *length) {
+    char line[256];
+    size_t contentLength = 0;
+    int sawLength = 0;
+    while (fgets(line, sizeof(line), stdin)) {
+        if (strcmp(line, "\r\n") == 0 || strcmp(line, "\n") == 0) {
+            if (!sawLength) {
+                continue;
+            }
+            char *message = malloc(contentLength + 1);
+            if (!message) {
+                lspOutOfMemory();
+            }
+            if (fread(message, 1, contentLength, stdin) != contentLength) {
+                free(message);
+                return NULL;
+            }
+            message[contentLength] = '\0';
+            *length = contentLength;
+            return message;
+        }
+        if (strncmp(line, "Content-Length:", 15) == 0) {
+            contentLength = strtoul(line + 15, NULL, 10);
+            sawLength = 1;
+        }
+    }
+    return NULL;
+}
+
+int runLanguageServer(void) {
+    JsonWriter writer = {0};
+    int shutdownRequested = 0;
+    int status = EXIT_FAILURE; // Unless exit follows shutdown
+    size_t length;
+    char *message;
+    while ((message = readMessage(&length))) {
+        const char *cursor = message;
+        JsonValue *request = parseJson(&cursor, message + length, 0);
+        JsonValue *method = jsonMember(request, L"method");
+        JsonValue *id = jsonMember(request, L"id");
+        JsonValue *params = jsonMember(request, L"params");
+        int exiting = 0;
+
+        if (!request) {
+            sendError(&writer, NULL, -32700, "Parse error");
+        } else if (!method || method->kind != JSON_STRING) {
+            // A response to a request of ours; none are sent
+        } else if (wcscmp(method->string, L"initialize") == 0 && id) {
+            sendResult(&writer, id, "{\"capabilities\":{\"textDocumentSync\":{\"openClose\":true,\"change\":2}},"
+                                    "\"serverInfo\":{\"name\":\"habibi\"}}");
+        } else if (wcscmp(method->string, L"shutdown") == 0 && id) {
+            shutdownRequested = 1;
+            sendResult(&writer, id, "null");
+        } else if (wcscmp(method->string, L"exit") == 0) {
+            status = shutdownRequested ? 0 : EXIT_FAILURE;
+            exiting = 1;
+        } else if (wcscmp(method->string, L"textDocument/didOpen") == 0) {
+            openDocument(&writer, params);
+        } else if (wcscmp(method->string, L"textDocument/didChange") == 0) {
+            changeDocument(&writer, params);
+        } else if (wcscmp(method->string, L"textDocument/didClose") == 0) {
+            closeDocument(&writer, params);
+        } else if (id) {
+            sendError(&writer, id, -32601, "Method not found");
+        }
+        freeJson(request);
+        free(message);
+        if (exiting) {
+            break;
+        }
+    }
+
+    for (int i = 0; i < openDocumentCount; i++) {
+        freeDocument(&openDocuments[i].document);
+        free(openDocuments[i].uri);
+    }
+    free(openDocuments);
+    openDocuments = NULL;
+    openDocumentCount = 0;
+    free(writer.data);
+    return status;
+}
@@ -0,0 +1,12 @@
+// lsp.h
+#ifndef LSP_H
+#define LSP_H
+
+// Serves the Language Server Protocol over standard input and output. Open
+// documents are checked as they change, reparsing only the statements an
+// edit touches, and their lex and parse errors are published as
+// diagnostics. Nothing is run. Returns the exit status once the client
+// sends exit.
+int runLanguageServer(void);
+
+#endif // LSP_H
@@ -2,56 +2,294 @@
 #include <stdlib.h>
 #include <wchar.h>
 #include <locale.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include "charclass.c"
 #include "lexer.c"// Assuming your lexer code is in lexer.h and lexer.c
+#include "diagnostic.c"
+#include "cache.c"
+#include "script.c"
+#include "pool.c"
+#include "parlex.c"
+#include "repl.c"
+#include "document.c"
+#include "json.c"
+#include "lsp.c"
+#include "budget.c"
+#include "value.c"
+#include "array.c"
+#include "map.c"
+#include "interpreter.c"
+#include "parallel.c"
+#include "jit.c"
+#include "checker.c"
+#include "state.c"
+#include "dump.c"
+#include "vector.c"
+#include "input.c"
 #include "parser.c"
 #include "parser.h"
 
-Token *tokens;
-
-int main() {
-    setlocale(LC_CTYPE, "");
-
-    FILE *file = fopen("source_code.txt", "r");
+void printUsage(FILE *stream) {
+    fwprintf(stream, L"Usage: main [options] [script...]\n"
+                     L"  script         path of a script, or - to read one from standard input\n"
+                     L"  -e CODE        run CODE as a script\n"
+                     L"  -i             read statements interactively after running any scripts\n"
+                     L"  --batch LIST   also run every script listed in LIST, one path per line\n"
+                     L"  -j, --jobs N   run up to N scripts at once; 0 uses every CPU\n"
+                     L"  --checked      report 64-bit integer overflow instead of wrapping around\n"
+                     L"  --no-jit       interpret every function instead of compiling hot ones to machine code\n"
+                     L"  --save-state F write the globals a script leaves to F\n"
+                     L"  --load-state F start every script from the globals saved in F\n"
+                     L"  --max-steps N  stop a script after it executes N statements and calls\n"
+                     L"  --max-time S   stop a script after S seconds\n"
+                     L"  --max-memory B stop a script that holds more than B bytes of strings and arrays;\n"
+                     L"                 B may end in K, M or G\n"
+                     L"  --mem-stats    report the bytes each script holds at its end and at its peak, and\n"
+                     L"                 its allocations of strings, integers, arrays, maps and streams\n"
+                     L"  --no-cache     always lex scripts and leave their .hbc caches alone\n"
+                     L"  --verify-lexer check that parallel lexing gives the same tokens instead of running\n"
+                     L"  --check        report every error the scripts would stop with, without running them\n"
+                     L"  --dump FORMAT  write each script's tokens and syntax tree as json lines or binary\n"
+                     L"                 instead of running it\n"
+                     L"  --lsp          serve the Language Server Protocol on standard input and output\n"
+                     L"Without scripts or -i, source_code.txt is run. Each script starts with no variables\n"
+                     L"or functions; an error stops only the script it occurs in.\n");
+}
 
-    if (file == NULL) {
-        perror("Error opening file");
-        return 1;
+void addScript(Script **scripts, int *count, int *capacity, ScriptKind kind, const char *text) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        *scripts = realloc(*scripts, *capacity * sizeof(Script));
+        if (!*scripts) {
+            fwprintf(stderr, L"Failed to allocate memory for the script list\n");
+            exit(EXIT_FAILURE);
+        }
     }
+    (*scripts)[(*count)++] = (Script){kind, text};
+}
 
-    // Determine the length of the file
-    fseek(file, 0, SEEK_END);
-    long length = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    // Allocate memory for the file contents
-    wchar_t *input = malloc((length + 1) * sizeof(wchar_t));
-    if (!input) {
-        wprintf(L"Failed to allocate memory for file content\n");
+// Adds the paths listed in a batch file; the list buffer holds the path strings.
+char *addBatchScripts(const char *listPath, Script **scripts, int *count, int *capacity) {
+    FILE *file = strcmp(listPath, "-") == 0 ? stdin : fopen(listPath, "rb");
+    if (!file) {
+        fwprintf(stderr, L"Error opening %s: %s\n", listPath, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    size_t length;
+    char *list = readStream(file, &length);
+    if (file != stdin) {
         fclose(file);
-        return 1;
     }
+    if (!list) {
+        exit(EXIT_FAILURE);
+    }
+    for (char *line = list; line < list + length;) {
+        char *end = memchr(line, '\n', list + length - line);
+        if (!end) {
+            end = list + length;
+        }
+        *end = '\0';
+        if (end > line && end[-1] == '\r') {
+            end[-1] = '\0';
+        }
+        if (*line) {
+            addScript(scripts, count, capacity, SCRIPT_FILE, line);
+        }
+        line = end + 1;
+    }
+    return list;
+}
 
-    // Read the file into the allocated array
-    int i = 0;
-    wint_t wc;
-    while ((wc = fgetwc(file)) != WEOF) {
-        input[i++] = wc;
+// Reads a byte count with an optional K, M or G suffix, or returns -1
+int64_t parseByteCount(const char *text) {
+    char *end;
+    long long count = strtoll(text, &end, 10);
+    int shift = 0;
+    switch (*end) {
+        case 'K': case 'k': shift = 10; end++; break;
+        case 'M': case 'm': shift = 20; end++; break;
+        case 'G': case 'g': shift = 30; end++; break;
+    }
+    if (*end != '\0' || end == text || count <= 0 || count > (INT64_MAX >> shift)) {
+        return -1;
     }
-    input[i] = L'\0';
+    return (int64_t)count << shift;
+}
+
+// The fuzzing entry points in fuzz/ include this file for the interpreter
+// and bring their own main
+#ifndef HABIBI_NO_MAIN
+int main(int argc, char *argv[]) {
+    setlocale(LC_CTYPE, "");
+    scriptOutput = stdout;
+    scriptErrors = stderr;
 
-    fclose(file);
+    Script *scripts = NULL;
+    int scriptCount = 0;
+    int scriptCapacity = 0;
+    char *batchLists[argc];
+    int batchListCount = 0;
+    long jobs = 1;
+    int interactive = 0;
+    int languageServer = 0;
 
-    // Tokenize the input
-    tokens = tokenize(input);
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--checked") == 0) {
+            checkedArithmetic = 1;
+        } else if (strcmp(argv[arg], "--no-jit") == 0) {
+            jitEnabled = 0;
+        } else if (strcmp(argv[arg], "--no-cache") == 0) {
+            useTokenCache = 0;
+        } else if (strcmp(argv[arg], "-i") == 0) {
+            interactive = 1;
+        } else if (strcmp(argv[arg], "--verify-lexer") == 0) {
+            verifyLexer = 1;
+        } else if (strcmp(argv[arg], "--mem-stats") == 0) {
+            memoryStats = 1;
+        } else if (strcmp(argv[arg], "--check") == 0) {
+            checkOnly = 1;
+        } else if (strcmp(argv[arg], "--lsp") == 0) {
+            languageServer = 1;
+        } else if (strcmp(argv[arg], "-h") == 0 || strcmp(argv[arg], "--help") == 0) {
+            printUsage(stdout);
+            return 0;
+        } else if ((strcmp(argv[arg], "-e") == 0 || strcmp(argv[arg], "--batch") == 0 ||
+                    strcmp(argv[arg], "-j") == 0 || strcmp(argv[arg], "--jobs") == 0 ||
+                    strcmp(argv[arg], "--dump") == 0 || strcmp(argv[arg], "--max-steps") == 0 ||
+                    strcmp(argv[arg], "--max-time") == 0 || strcmp(argv[arg], "--max-memory") == 0 ||
+                    strcmp(argv[arg], "--save-state") == 0 || strcmp(argv[arg], "--load-state") == 0) &&
+                   arg + 1 == argc) {
+            fwprintf(stderr, L"%s needs an argument\n", argv[arg]);
+            printUsage(stderr);
+            return 2;
+        } else if (strcmp(argv[arg], "-e") == 0) {
+            addScript(&scripts, &scriptCount, &scriptCapacity, SCRIPT_INLINE, argv[++arg]);
+        } else if (strcmp(argv[arg], "--batch") == 0) {
+            batchLists[batchListCount++] = addBatchScripts(argv[++arg], &scripts, &scriptCount, &scriptCapacity);
+        } else if (strcmp(argv[arg], "-j") == 0 || strcmp(argv[arg], "--jobs") == 0) {
+            char *end;
+            jobs = strtol(argv[++arg], &end, 10);
+            if (*end != '\0' || jobs < 0) {
+                fwprintf(stderr, L"Invalid job count %s\n", argv[arg]);
+                return 2;
+            }
+            if (jobs == 0) {
+                jobs = sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        } else if (strcmp(argv[arg], "--save-state") == 0) {
+            saveStatePath = argv[++arg];
+        } else if (strcmp(argv[arg], "--load-state") == 0) {
+            arg++;
+            if (!loadState(argv[arg])) {
+                fwprintf(stderr, L"Cannot load state from %s: missing, damaged or saved by another build\n", argv[arg]);
+                return 2;
+            }
+        } else if (strcmp(argv[arg], "--max-steps") == 0) {
+            char *end;
+            stepLimit = strtoll(argv[++arg], &end, 10);
+            if (*end != '\0' || stepLimit <= 0) {
+                fwprintf(stderr, L"Invalid step limit %s\n", argv[arg]);
+                return 2;
+            }
+        } else if (strcmp(argv[arg], "--max-time") == 0) {
+            char *end;
+            timeLimit = strtod(argv[++arg], &end);
+            if (*end != '\0' || !(timeLimit > 0)) {
+                fwprintf(stderr, L"Invalid time limit %s\n", argv[arg]);
+                return 2;
+            }
+        } else if (strcmp(argv[arg], "--max-memory") == 0) {
+            memoryLimit = parseByteCount(argv[++arg]);
+            if (memoryLimit <= 0) {
+                fwprintf(stderr, L"Invalid memory limit %s\n", argv[arg]);
+                return 2;
+            }
+        } else if (strcmp(argv[arg], "--dump") == 0) {
+            arg++;
+            if (strcmp(argv[arg], "json") == 0) {
+                dumpFormat = DUMP_JSON;
+            } else if (strcmp(argv[arg], "binary") == 0) {
+                dumpFormat = DUMP_BINARY;
+            } else {
+                fwprintf(stderr, L"Unknown dump format %s; use json or binary\n", argv[arg]);
+                return 2;
+            }
+        } else if (strcmp(argv[arg], "-") == 0) {
+            addScript(&scripts, &scriptCount, &scriptCapacity, SCRIPT_STDIN, NULL);
+        } else if (argv[arg][0] == '-') {
+            fwprintf(stderr, L"Unknown option %s\n", argv[arg]);
+            printUsage(stderr);
+            return 2;
+        } else {
+            addScript(&scripts, &scriptCount, &scriptCapacity, SCRIPT_FILE, argv[arg]);
+        }
+    }
+    if (languageServer) {
+        for (int i = 0; i < batchListCount; i++) {
+            free(batchLists[i]);
+        }
+        free(scripts);
+        return runLanguageServer();
+    }
+    if (scriptCount == 0 && !interactive) {
+        addScript(&scripts, &scriptCount, &scriptCapacity, SCRIPT_FILE, "source_code.txt");
+    }
+    if (saveStatePath && (scriptCount != 1 || interactive || checkOnly || dumpFormat != DUMP_NONE)) {
+        fwprintf(stderr, L"--save-state runs exactly one script\n");
+        return 2;
+    }
 
+    // With several scripts, each one's output is headed by its name and a
+    // script that fails is named on stderr after its error. Checking prints
+    // nothing but errors, which carry the script's name.
+    int batch = scriptCount > 1;
+    lexerThreadCount = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    loopThreadCount = lexerThreadCount;
+    int failures = 0;
+    if (dumpFormat != DUMP_NONE) {
+        // Dumps go to stdout as bytes, one script after another
+        for (int i = 0; i < scriptCount; i++) {
+            failures += dumpScript(scripts[i]);
+        }
+    } else if (batch && jobs > 1) {
+        detectVectorLevel(); // Before the workers share it
+        lexerThreadCount = 1; // The workers already keep every CPU busy
+        loopThreadCount = 1;
+        failures = runScriptsInParallel(scripts, scriptCount, jobs < INT_MAX ? (int)jobs : INT_MAX);
+    } else {
+        for (int i = 0; i < scriptCount; i++) {
+            if (checkOnly) {
+                failures += checkScript(scripts[i]);
+                continue;
+            }
+            if (batch) {
+                wprintf(L"==> %s <==\n", scriptName(scripts[i]));
+                fflush(stdout);
+            }
+            if (runScript(scripts[i]) != 0) {
+                failures++;
+                if (batch) {
+                    fwprintf(stderr, L"%s: stopped after an error\n", scriptName(scripts[i]));
+                }
+            }
+            fflush(stdout);
+        }
+    }
 
-    
-    parseProgram();
+    if (interactive) {
+        runRepl();
+    }
 
-    // Free allocated memory for tokens and input (don't forget to free memory after usage)
     freeSymbolTable();
-    free(tokens);
-    free(input);
+    releaseState();
+    for (int i = 0; i < batchListCount; i++) {
+        free(batchLists[i]);
+    }
+    free(scripts);
 
-    return 0;
+    return failures ? EXIT_FAILURE : 0;
 }
+#endif // HABIBI_NO_MAIN
@@ -0,0 +1,218 @@
+#include "map.h"
+#include "interpreter.h"
+#include "script.h"
+#include "budget.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#define MAP_MIN_CAPACITY 8
+#define MAP_MAX_CAPACITY ((int64_t)1 << 30) // Entry numbers must fit the int32_t slots
+
+void mapOutOfMemory() {
+    fwprintf(scriptErrors, L"Failed to allocate memory for map\n");
+    abortScript();
+}
+
+size_t mapSize(int64_t capacity) {
+    return capacity * sizeof(MapEntry) + capacity * 2 * sizeof(int32_t);
+}
+
+Map *newMap(void) {
+    chargeMemory(MEMORY_MAP, sizeof(Map) + mapSize(MAP_MIN_CAPACITY));
+    Map *map = malloc(sizeof(Map));
+    if (!map) {
+        mapOutOfMemory();
+    }
+    map->refCount = 1;
+    map->visit = 0;
+    map->count = 0;
+    map->entryCount = 0;
+    map->entryCapacity = MAP_MIN_CAPACITY;
+    map->slotMask = MAP_MIN_CAPACITY * 2 - 1;
+    map->entries = malloc(MAP_MIN_CAPACITY * sizeof(MapEntry));
+    map->slots = calloc(MAP_MIN_CAPACITY * 2, sizeof(int32_t));
+    if (!map->entries || !map->slots) {
+        mapOutOfMemory();
+    }
+    return map;
+}
+
+// Strings hash as the token cache's names do; integers are mixed so that
+// runs of them spread over the table
+uint64_t hashKey(Value key) {
+    if (valueIsString(key)) {
+        return hashString(valueAsString(key));
+    }
+    uint64_t hash = (uint64_t)valueAsInt(key);
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 31);
+}
+
+uint64_t requireKey(Value key) {
+    if (!valueIsInt(key) && !valueIsString(key)) {
+        runtimeError(L"Type error: map key is not a string or an integer");
+    }
+    return hashKey(key);
+}
+
+int keysEqual(Value stored, Value key) {
+    if (valueIsInt(stored)) {
+        return valueIsInt(key) && valueAsInt(stored) == valueAsInt(key);
+    }
+    return valueIsString(stored) && valueIsString(key) && wcscmp(valueAsString(stored), valueAsString(key)) == 0;
+}
+
+// The slot holding the key, or the empty slot where it would go
+int64_t mapSlot(Map *map, Value key, uint64_t hash) {
+    int64_t slot = (int64_t)(hash & (uint64_t)map->slotMask);
+    while (map->slots[slot]) {
+        MapEntry *entry = &map->entries[map->slots[slot] - 1];
+        if (entry->hash == hash && keysEqual(entry->key, key)) {
+            return slot;
+        }
+        slot = (slot + 1) & map->slotMask;
+    }
+    return slot;
+}
+
+// Moves the live entries to storage sized for twice as many and rebuilds the
+// table from their stored hashes
+void mapGrow(Map *map) {
+    int64_t capacity = MAP_MIN_CAPACITY;
+    while (capacity < map->count * 2) {
+        capacity *= 2; // The table's size must stay a power of two
+    }
+    if (capacity > MAP_MAX_CAPACITY) {
+        runtimeError(L"Runtime error: Map is too large.");
+    }
+    chargeMemory(MEMORY_MAP, mapSize(capacity));
+    MapEntry *entries = malloc(capacity * sizeof(MapEntry));
+    int32_t *slots = calloc(capacity * 2, sizeof(int32_t));
+    if (!entries || !slots) {
+        mapOutOfMemory();
+    }
+    int64_t count = 0;
+    for (int64_t i = 0; i < map->entryCount; i++) {
+        if (valueType(map->entries[i].key) != TYPE_ERROR) {
+            entries[count++] = map->entries[i];
+        }
+    }
+    int64_t slotMask = capacity * 2 - 1;
+    for (int64_t i = 0; i < count; i++) {
+        int64_t slot = (int64_t)(entries[i].hash & (uint64_t)slotMask);
+        while (slots[slot]) {
+            slot = (slot + 1) & slotMask;
+        }
+        slots[slot] = (int32_t)(i + 1);
+    }
+    releaseMemory(MEMORY_MAP, mapSize(map->entryCapacity));
+    free(map->entries);
+    free(map->slots);
+    map->entries = entries;
+    map->slots = slots;
+    map->entryCount = count;
+    map->entryCapacity = capacity;
+    map->slotMask = slotMask;
+}
+
+Value *mapFind(Map *map, Value key) {
+    int64_t slot = mapSlot(map, key, requireKey(key));
+    return map->slots[slot] ? &map->entries[map->slots[slot] - 1].value : NULL;
+}
+
+Value mapGet(Map *map, Value key) {
+    Value *value = mapFind(map, key);
+    if (!value) {
+        if (valueIsString(key)) {
+            fwprintf(scriptErrors, L"Runtime error: Key \"%ls\" not found in map.\n", valueAsString(key));
+        } else {
+            fwprintf(scriptErrors, L"Runtime error: Key %" PRId64 L" not found in map.\n", valueAsInt(key));
+        }
+        abortScript();
+    }
+    return *value;
+}
+
+void mapSet(Map *map, Value key, Value value) {
+    uint64_t hash = requireKey(key);
+    int64_t slot = mapSlot(map, key, hash);
+    if (map->slots[slot]) {
+        MapEntry *entry = &map->entries[map->slots[slot] - 1];
+        Value previous = entry->value;
+        entry->value = valueCopy(value); // Copy first in case the new value refers to the old one
+        valueFree(previous);
+        return;
+    }
+    if (map->entryCount == map->entryCapacity) {
+        mapGrow(map);
+        slot = mapSlot(map, key, hash);
+    }
+    MapEntry *entry = &map->entries[map->entryCount];
+    entry->hash = hash;
+    entry->key = valueCopy(key);
+    entry->value = valueCopy(value);
+    map->slots[slot] = (int32_t)(++map->entryCount);
+    map->count++;
+}
+
+int mapDelete(Map *map, Value key) {
+    int64_t slot = mapSlot(map, key, requireKey(key));
+    if (!map->slots[slot]) {
+        return 0;
+    }
+    // The slot keeps pointing at the entry, so probes for other keys still
+    // pass over it
+    MapEntry *entry = &map->entries[map->slots[slot] - 1];
+    Value deletedKey = entry->key;
+    Value deletedValue = entry->value;
+    entry->key = valueError();
+    entry->value = valueError();
+    map->count--;
+    valueFree(deletedKey);
+    valueFree(deletedValue);
+    return 1;
+}
+
+// Drops one reference, freeing the map, its keys and its values with the last one.
+void mapRelease(Map *map) {
+    if (--map->refCount > 0) {
+        return;
+    }
+    for (int64_t i = 0; i < map->entryCount; i++) {
+        valueFree(map->entries[i].key);
+        valueFree(map->entries[i].value);
+    }
+    releaseMemory(MEMORY_MAP, sizeof(Map) + mapSize(map->entryCapacity));
+    free(map->entries);
+    free(map->slots);
+    free(map);
+}
+
+void printMapElement(Value value) {
+    if (valueType(value) == TYPE_CHAR) {
+        fwprintf(scriptOutput, L"\"%ls\"", valueAsString(value));
+    } else {
+        printValueInline(value);
+    }
+}
+
+void printMap(Map *map) {
+    fwprintf(scriptOutput, L"{");
+    int first = 1;
+    for (int64_t i = 0; i < map->entryCount; i++) {
+        MapEntry *entry = &map->entries[i];
+        if (valueType(entry->key) == TYPE_ERROR) {
+            continue;
+        }
+        if (!first) {
+            fwprintf(scriptOutput, L", ");
+        }
+        first = 0;
+        printMapElement(entry->key);
+        fwprintf(scriptOutput, L": ");
+        printMapElement(entry->value);
+    }
+    fwprintf(scriptOutput, L"}");
+}
@@ -0,0 +1,49 @@
+// map.h
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdint.h>
+#include "value.h"
+
+// One key and its value, with the key's hash so that probing and growing
+// never hash a key again
+typedef struct {
+    uint64_t hash;
+    Value key;     // valueError() once the entry is deleted
+    Value value;
+} MapEntry;
+
+// A map from string and integer keys to values. Entries are kept in one
+// contiguous array in the order they were inserted; an open-addressed table of
+// entry numbers, probed linearly and never more than half full, finds them.
+// A deleted entry stays in the array until the map next grows, so deleting
+// moves nothing and iteration keeps the insertion order.
+typedef struct Map {
+    int refCount;
+    int64_t count;          // Live entries
+    int64_t entryCount;     // Entries used, deleted ones included
+    int64_t entryCapacity;
+    int64_t slotMask;       // The table has slotMask + 1 slots
+    int32_t *slots;         // Entry number + 1, 0 when the slot is empty
+    MapEntry *entries;
+    uint32_t visit;         // The last valueContains search that reached it
+} Map;
+
+// Creates an empty map with a reference count of one.
+Map *newMap(void);
+
+// Returns the value of the key, borrowed from the map, or NULL if it is not
+// there. Looking up a key allocates nothing.
+Value *mapFind(Map *map, Value key);
+Value mapGet(Map *map, Value key);
+
+// Adds the key or replaces its value. Replacing reuses the key's entry and
+// only the copy of the value may allocate, e.g. for a borrowed string.
+void mapSet(Map *map, Value key, Value value);
+
+// Returns 1 if the key was there
+int mapDelete(Map *map, Value key);
+void mapRelease(Map *map);
+void printMap(Map *map);
+
+#endif // MAP_H
@@ -0,0 +1,510 @@
+#include "parallel.h"
+#include "interpreter.h"
+#include "array.h"
+#include "script.h"
+#include "budget.h"
+#include "pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+int loopThreadCount = 1;
+int parallelMinIterations = PARALLEL_MIN_ITERATIONS;
+
+// The body works on plain numbers rather than Values, so that no thread has
+// to allocate for an integer too wide to store inline
+typedef struct {
+    int isDouble;
+    int64_t integer;
+    double real;
+} LoopNumber;
+
+typedef struct {
+    Node *loop;
+    int64_t start;
+    uint64_t iterations;
+    uint64_t chunkSize;
+    int64_t chunkCount;
+    unsigned *roles;
+    Value *captured;
+    LoopNumber *partials;      // Each chunk's copies of the reductions, loop->argCount per chunk
+    double deadline;           // 0 without a time limit
+    _Atomic int64_t nextChunk;
+    _Atomic int failed;        // No chunk after the one that failed needs to start
+    pthread_mutex_t errorLock;
+    int64_t errorChunk;        // The first chunk that stopped with an error, or -1
+    wchar_t *error;            // Its message
+} LoopRun;
+
+// What a loop body does with its captured variables
+
+// Adds what the expression does to roles. Returns the first node a loop
+// cannot evaluate on several threads at once, with the reason.
+Node *expressionRoles(Node *node, unsigned *roles, const wchar_t **reason) {
+    switch (node->kind) {
+        case NODE_LITERAL:
+            if (valueIsNumber(node->value)) {
+                return NULL;
+            }
+            break;
+        case NODE_LOOP_INDEX:
+            return NULL;
+        case NODE_CAPTURED:
+            roles[node->slot] |= LOOP_READ;
+            return NULL;
+        case NODE_BINARY:
+            {
+                Node *bad = expressionRoles(node->left, roles, reason);
+                return bad ? bad : expressionRoles(node->right, roles, reason);
+            }
+        case NODE_INDEX:
+            if (node->left->kind != NODE_CAPTURED) {
+                *reason = L"A parallel loop can only index a variable";
+                return node;
+            }
+            roles[node->left->slot] |= LOOP_READ | (node->right->kind == NODE_LOOP_INDEX ? 0 : LOOP_INDEXED_ELSEWHERE);
+            return expressionRoles(node->right, roles, reason);
+        case NODE_BUILTIN:
+            if (wcscmp(builtins[node->slot].name, L"طول") == 0 && node->args[0]->kind == NODE_CAPTURED) {
+                roles[node->args[0]->slot] |= LOOP_READ;
+                return NULL;
+            }
+            break;
+        default:
+            break;
+    }
+    *reason = L"A parallel loop can only compute with numbers, variables, array elements and طول";
+    return node;
+}
+
+// The parser has made sure a statement is an assignment to an element or a
+// variable update with += or *=
+Node *statementRoles(Node *statement, unsigned *roles, const wchar_t **reason) {
+    Node *bad = expressionRoles(statement->left, roles, reason);
+    if (bad) {
+        return bad;
+    }
+    Node *target = statement->target;
+    if (target->kind == NODE_CAPTURED) {
+        roles[target->slot] |= statement->op == TOKEN_INCREMENT_BY ? LOOP_ADDED : LOOP_MULTIPLIED;
+        return NULL;
+    }
+    if (target->left->kind != NODE_CAPTURED || target->right->kind != NODE_LOOP_INDEX) {
+        *reason = L"A parallel loop can only assign the element of an array at the loop variable";
+        return target;
+    }
+    roles[target->left->slot] |= LOOP_ASSIGNED;
+    return NULL;
+}
+
+void loopRoles(Node *loop, unsigned *roles) {
+    const wchar_t *reason;
+    memset(roles, 0, loop->argCount * sizeof(unsigned));
+    for (Node *statement = loop->body; statement; statement = statement->next) {
+        statementRoles(statement, roles, &reason);
+    }
+}
+
+// A reduction is only updated, one way, and an array whose elements are
+// assigned is only read at the loop variable; otherwise one iteration could
+// see what another wrote
+const wchar_t *roleConflict(unsigned roles) {
+    if ((roles & LOOP_REDUCED) && roles != LOOP_ADDED && roles != LOOP_MULTIPLIED) {
+        return L"%ls is updated with += or *= in the loop and cannot be used otherwise there";
+    }
+    if ((roles & LOOP_ASSIGNED) && (roles & LOOP_INDEXED_ELSEWHERE)) {
+        return L"%ls has elements assigned in the loop and can only be read there at the loop variable";
+    }
+    return NULL;
+}
+
+Node *checkParallelLoop(Node *loop, wchar_t *message, size_t size) {
+    unsigned roles[loop->argCount + 1];
+    memset(roles, 0, sizeof(roles));
+    for (Node *statement = loop->body; statement; statement = statement->next) {
+        const wchar_t *reason = NULL;
+        Node *bad = statementRoles(statement, roles, &reason);
+        if (bad) {
+            swprintf(message, size, L"%ls", reason);
+            return bad;
+        }
+        for (int i = 0; i < loop->argCount; i++) {
+            const wchar_t *format = roleConflict(roles[i]);
+            if (format) {
+                swprintf(message, size, format, loop->args[i]->name);
+                return statement;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Running the body
+
+LoopNumber loopNumber(Value value) {
+    if (valueIsInt(value)) {
+        return (LoopNumber){0, valueAsInt(value), 0};
+    }
+    if (valueIsDouble(value)) {
+        return (LoopNumber){1, 0, valueAsDouble(value)};
+    }
+    ValueType type = valueType(value);
+    if (type == TYPE_CHAR) {
+        runtimeError(L"Type error: arithmetic on a string value");
+    } else if (type == TYPE_ARRAY) {
+        runtimeError(L"Type error: arithmetic on an array value");
+    } else if (type == TYPE_MAP) {
+        runtimeError(L"Type error: arithmetic on a map value");
+    }
+    runtimeError(L"Type error: arithmetic on a missing value");
+    return (LoopNumber){0, 0, 0};
+}
+
+Value numberValue(LoopNumber number) {
+    return number.isDouble ? valueFromDouble(number.real) : valueFromInt(number.integer);
+}
+
+// performCompoundAssignment for numbers
+LoopNumber updateNumber(LoopNumber current, LoopNumber operand, TokenType operation) {
+    if (operation == TOKEN_MOD_BY && operand.isDouble) {
+        runtimeError(L"Modulo operation not supported for double");
+    }
+    if (!current.isDouble) {
+        // Integer variables stay integers; a double operand is truncated
+        int64_t value = operand.isDouble ? truncateDouble(operand.real) : operand.integer;
+        current.integer = performIntegerOperation(current.integer, value, compoundOperator(operation));
+        return current;
+    }
+    double value = operand.isDouble ? operand.real : (double)operand.integer;
+    if (operation == TOKEN_INCREMENT_BY) {
+        current.real += value;
+    } else if (operation == TOKEN_DECREASE_BY) {
+        current.real -= value;
+    } else if (operation == TOKEN_MULTIPLY_BY) {
+        current.real *= value;
+    } else if (operation == TOKEN_DIVIDE_BY) {
+        current.real /= value;
+    }
+    return current;
+}
+
+Array *loopArray(Value value) {
+    if (valueIsMap(value)) {
+        runtimeError(L"Type error: a parallel loop cannot index a map");
+    }
+    return requireArray(value);
+}
+
+LoopNumber evaluateInLoop(LoopRun *run, Node *node, int64_t index) {
+    switch (node->kind) {
+        case NODE_LITERAL:
+            return loopNumber(node->value);
+        case NODE_LOOP_INDEX:
+            return (LoopNumber){0, index, 0};
+        case NODE_CAPTURED:
+            return loopNumber(run->captured[node->slot]);
+        case NODE_BINARY:
+            {
+                LoopNumber left = evaluateInLoop(run, node->left, index);
+                LoopNumber right = evaluateInLoop(run, node->right, index);
+                if (!left.isDouble && !right.isDouble) {
+                    left.integer = performIntegerOperation(left.integer, right.integer, node->op);
+                    return left;
+                }
+                double leftValue = left.isDouble ? left.real : (double)left.integer;
+                double rightValue = right.isDouble ? right.real : (double)right.integer;
+                return (LoopNumber){1, 0, performDoubleOperation(leftValue, rightValue, node->op)};
+            }
+        case NODE_INDEX:
+            {
+                Array *array = loopArray(run->captured[node->left->slot]);
+                LoopNumber element = evaluateInLoop(run, node->right, index);
+                if (element.isDouble) {
+                    runtimeError(L"Type error: array index is not an integer");
+                }
+                checkArrayIndex(array, element.integer);
+                switch (array->kind) {
+                    case ARRAY_INT:
+                        return (LoopNumber){0, array->ints[element.integer], 0};
+                    case ARRAY_DOUBLE:
+                        return (LoopNumber){1, 0, array->doubles[element.integer]};
+                    default:
+                        return loopNumber(array->values[element.integer]);
+                }
+            }
+        default:
+            {
+                // طول, the only builtin a loop may call
+                Value value = run->captured[node->args[0]->slot];
+                if (valueIsArray(value)) {
+                    return (LoopNumber){0, valueAsArray(value)->length, 0};
+                }
+                if (valueIsString(value)) {
+                    return (LoopNumber){0, (int64_t)wcslen(valueAsString(value)), 0};
+                }
+                if (valueIsMap(value)) {
+                    return (LoopNumber){0, valueAsMap(value)->count, 0};
+                }
+                runtimeError(L"Type error: length of a value that is not an array, a string or a map");
+                return (LoopNumber){0, 0, 0};
+            }
+    }
+}
+
+// Stores into unboxed storage only: boxing the array or changing a boxed
+// element's reference counts would touch what other threads are reading
+void storeInLoop(LoopRun *run, Node *statement, int64_t index, LoopNumber value) {
+    Array *array = loopArray(run->captured[statement->target->left->slot]);
+    checkArrayIndex(array, index);
+    if (array->kind == ARRAY_INT) {
+        if (statement->op != TOKEN_ASSIGNMENT) {
+            value = updateNumber((LoopNumber){0, array->ints[index], 0}, value, statement->op);
+        }
+        if (value.isDouble) {
+            runtimeError(L"Type error: a parallel loop cannot store a double in an array of integers");
+        }
+        array->ints[index] = value.integer;
+    } else if (array->kind == ARRAY_DOUBLE) {
+        if (statement->op != TOKEN_ASSIGNMENT) {
+            value = updateNumber((LoopNumber){1, 0, array->doubles[index]}, value, statement->op);
+        }
+        if (!value.isDouble) {
+            runtimeError(L"Type error: a parallel loop cannot store an integer in an array of doubles");
+        }
+        array->doubles[index] = value.real;
+    } else {
+        runtimeError(L"Type error: a parallel loop can only assign elements of arrays of integers or of doubles");
+    }
+}
+
+void runChunk(LoopRun *run, int64_t chunk) {
+    Node *loop = run->loop;
+    LoopNumber *partials = &run->partials[chunk * loop->argCount];
+    for (int i = 0; i < loop->argCount; i++) {
+        if (run->roles[i] & LOOP_REDUCED) {
+            // Start from nothing, as an integer or a double like the variable
+            int64_t identity = (run->roles[i] & LOOP_ADDED) ? 0 : 1;
+            partials[i] = valueIsInt(run->captured[i]) ? (LoopNumber){0, identity, 0}
+                                                       : (LoopNumber){1, 0, (double)identity};
+        }
+    }
+
+    uint64_t first = (uint64_t)chunk * run->chunkSize;
+    uint64_t last = run->iterations - first < run->chunkSize ? run->iterations : first + run->chunkSize;
+    for (uint64_t i = first; i < last; i++) {
+        int64_t index = (int64_t)((uint64_t)run->start + i);
+        for (Node *statement = loop->body; statement; statement = statement->next) {
+            LoopNumber value = evaluateInLoop(run, statement->left, index);
+            Node *target = statement->target;
+            if (target->kind == NODE_CAPTURED) {
+                partials[target->slot] = updateNumber(partials[target->slot], value, statement->op);
+            } else {
+                storeInLoop(run, statement, index, value);
+            }
+        }
+    }
+}
+
+// Takes chunks in order until there are none left or one has failed. An
+// error stops this thread only; the message of the first chunk to fail is
+// kept for the calling thread to report, as running the chunks one after
+// another would have.
+void runLoopChunks(LoopRun *run) {
+    if (atomic_load(&run->nextChunk) >= run->chunkCount) {
+        return;
+    }
+    FILE *errors = scriptErrors;
+    int running = scriptRunning;
+    jmp_buf outer;
+    memcpy(outer, scriptRecovery, sizeof(jmp_buf));
+
+    wchar_t *message = NULL;
+    size_t messageSize = 0;
+    scriptErrors = open_wmemstream(&message, &messageSize);
+    if (!scriptErrors) {
+        fwprintf(stderr, L"Failed to allocate memory for loop messages\n");
+        exit(EXIT_FAILURE);
+    }
+    scriptRunning = 1;
+    volatile int64_t chunk = -1;
+    if (setjmp(scriptRecovery) == 0) {
+        while (!atomic_load(&run->failed)) {
+            chunk = atomic_fetch_add(&run->nextChunk, 1);
+            if (chunk >= run->chunkCount) {
+                break;
+            }
+            if (run->deadline > 0 && monotonicSeconds() > run->deadline) {
+                runtimeError(L"Runtime error: Time limit exceeded.");
+            }
+            runChunk(run, chunk);
+        }
+    } else {
+        atomic_store(&run->failed, 1);
+    }
+    fclose(scriptErrors);
+
+    pthread_mutex_lock(&run->errorLock);
+    if (messageSize > 0 && (run->errorChunk < 0 || chunk < run->errorChunk)) {
+        free(run->error);
+        run->error = message;
+        run->errorChunk = chunk;
+        message = NULL;
+    }
+    pthread_mutex_unlock(&run->errorLock);
+    free(message);
+
+    scriptErrors = errors;
+    scriptRunning = running;
+    memcpy(scriptRecovery, outer, sizeof(jmp_buf));
+}
+
+// Threads that help run loops, started with the first loop long enough to
+// need them. One loop at a time has them; a loop that finds them busy with
+// another batch worker's loop runs on its own thread.
+pthread_mutex_t loopPoolLock = PTHREAD_MUTEX_INITIALIZER; // Held by the thread whose loop they run
+pthread_mutex_t loopLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t loopStarted = PTHREAD_COND_INITIALIZER;
+pthread_cond_t loopFinished = PTHREAD_COND_INITIALIZER;
+int loopHelperCount = 0;
+int loopHelpersStarted = 0;
+LoopRun *loopJob = NULL;
+uint64_t loopGeneration = 0;
+int loopHelpersBusy = 0;
+
+void *runLoopHelper(void *argument) {
+    (void)argument;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&loopLock);
+    for (;;) {
+        while (loopGeneration == seen) {
+            pthread_cond_wait(&loopStarted, &loopLock);
+        }
+        seen = loopGeneration;
+        LoopRun *run = loopJob;
+        pthread_mutex_unlock(&loopLock);
+        runLoopChunks(run);
+        pthread_mutex_lock(&loopLock);
+        if (--loopHelpersBusy == 0) {
+            pthread_cond_signal(&loopFinished);
+        }
+    }
+    return NULL;
+}
+
+// Called with loopPoolLock held
+void startLoopHelpers(void) {
+    if (loopHelpersStarted) {
+        return;
+    }
+    loopHelpersStarted = 1;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, WORKER_STACK_SIZE);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    for (int i = 1; i < loopThreadCount; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, runLoopHelper, NULL) != 0) {
+            break; // Run with the helpers there are
+        }
+        loopHelperCount++;
+    }
+    pthread_attr_destroy(&attributes);
+}
+
+// Whether an array whose elements are assigned is also read elsewhere under
+// another name, which the parser cannot see
+int loopAliased(Node *loop, unsigned *roles, Value *captured) {
+    for (int i = 0; i < loop->argCount; i++) {
+        if (!(roles[i] & LOOP_ASSIGNED) || !valueIsArray(captured[i])) {
+            continue;
+        }
+        for (int j = 0; j < loop->argCount; j++) {
+            if ((roles[j] & LOOP_INDEXED_ELSEWHERE) && captured[j] == captured[i]) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void runParallelLoop(Node *loop, int64_t start, int64_t end, unsigned *roles, Value *captured) {
+    if (end <= start) {
+        return;
+    }
+    uint64_t iterations = (uint64_t)end - (uint64_t)start;
+    int64_t statementCount = 0;
+    for (Node *statement = loop->body; statement; statement = statement->next) {
+        statementCount++;
+    }
+    // The loop's steps are taken when it starts; other threads cannot count
+    // them as they go
+    countSteps(iterations > (uint64_t)(INT64_MAX / 4) / (statementCount + 1)
+                   ? INT64_MAX / 4 : (int64_t)iterations * statementCount);
+
+    LoopRun run;
+    run.loop = loop;
+    run.start = start;
+    run.iterations = iterations;
+    run.chunkCount = iterations < LOOP_CHUNKS ? (int64_t)iterations : LOOP_CHUNKS;
+    run.chunkSize = iterations / run.chunkCount + (iterations % run.chunkCount != 0);
+    run.chunkCount = (int64_t)((iterations + run.chunkSize - 1) / run.chunkSize);
+    run.roles = roles;
+    run.captured = captured;
+    run.partials = malloc((run.chunkCount * loop->argCount + 1) * sizeof(LoopNumber));
+    if (!run.partials) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for loop\n");
+        abortScript();
+    }
+    run.deadline = budgetDeadline();
+    atomic_init(&run.nextChunk, 0);
+    atomic_init(&run.failed, 0);
+    pthread_mutex_init(&run.errorLock, NULL);
+    run.errorChunk = -1;
+    run.error = NULL;
+
+    int helped = loopThreadCount > 1 && iterations >= (uint64_t)parallelMinIterations &&
+                 !loopAliased(loop, roles, captured) && pthread_mutex_trylock(&loopPoolLock) == 0;
+    if (helped) {
+        startLoopHelpers();
+        pthread_mutex_lock(&loopLock);
+        loopJob = &run;
+        loopGeneration++;
+        loopHelpersBusy = loopHelperCount;
+        pthread_cond_broadcast(&loopStarted);
+        pthread_mutex_unlock(&loopLock);
+    }
+    runLoopChunks(&run);
+    if (helped) {
+        pthread_mutex_lock(&loopLock);
+        while (loopHelpersBusy > 0) {
+            pthread_cond_wait(&loopFinished, &loopLock);
+        }
+        pthread_mutex_unlock(&loopLock);
+        pthread_mutex_unlock(&loopPoolLock);
+    }
+    pthread_mutex_destroy(&run.errorLock);
+
+    if (run.error) {
+        fputws(run.error, scriptErrors);
+        free(run.error);
+        free(run.partials);
+        abortScript();
+    }
+
+    // Merge each chunk's copies into the variables, in chunk order
+    for (int i = 0; i < loop->argCount; i++) {
+        if (!(roles[i] & LOOP_REDUCED)) {
+            continue;
+        }
+        TokenType operation = (roles[i] & LOOP_ADDED) ? TOKEN_INCREMENT_BY : TOKEN_MULTIPLY_BY;
+        LoopNumber result = loopNumber(captured[i]);
+        for (int64_t chunk = 0; chunk < run.chunkCount; chunk++) {
+            result = updateNumber(result, run.partials[chunk * loop->argCount + i], operation);
+        }
+        captured[i] = numberValue(result);
+    }
+    free(run.partials);
+}
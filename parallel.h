@@ -0,0 +1,47 @@
+// parallel.h
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ast.h"
+#include "value.h"
+
+// Parallel loops, ل ع من أ إلى ب { ... }, run the body for every integer ع
+// from أ up to but not including ب, with the iterations split across
+// threads. The body may only assign the element of an array at the loop
+// variable, أ[ع] = ...; or update a variable with += or *=, which each thread
+// does to a private copy that is merged into the variable when the loop
+// ends. Anything else the body writes could be shared between iterations, so
+// the parser rejects it.
+//
+// The range is cut into the same chunks whatever the number of threads, and
+// the copies are merged in chunk order, so a loop gives the same result on
+// one thread as on many.
+#define LOOP_CHUNKS 256               // Pieces a range is split into, at most
+#define PARALLEL_MIN_ITERATIONS 4096  // Shorter loops run on the calling thread
+
+extern int loopThreadCount; // Threads a loop runs on, the calling one included
+extern int parallelMinIterations; // PARALLEL_MIN_ITERATIONS, lowered by the fuzzer
+
+// What a loop body does with each variable it captures
+#define LOOP_READ              1u  // Reads it, its length or any of its elements
+#define LOOP_INDEXED_ELSEWHERE 2u  // Reads an element other than the loop variable's
+#define LOOP_ASSIGNED          4u  // Assigns its element at the loop variable
+#define LOOP_ADDED             8u  // Updates it with +=
+#define LOOP_MULTIPLIED        16u // Updates it with *=
+#define LOOP_REDUCED (LOOP_ADDED | LOOP_MULTIPLIED)
+
+// Fills roles[i] for loop->args[i]
+void loopRoles(Node *loop, unsigned *roles);
+
+// Returns the node of the first thing in a parsed loop body that its
+// iterations could not run independently, with the reason in message, or
+// NULL if there is none
+Node *checkParallelLoop(Node *loop, wchar_t *message, size_t size);
+
+// Runs the iterations [start, end) of a loop. captured holds the values of
+// loop->args; a reduction's value is replaced by its result.
+void runParallelLoop(Node *loop, int64_t start, int64_t end, unsigned *roles, Value *captured);
+
+#endif // PARALLEL_H
@@ -0,0 +1,211 @@
+#include "parlex.h"
+#include "script.h"
+#include "pool.h"
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int lexerThreadCount = 1;
+int verifyLexer = 0;
+
+typedef struct {
+    wchar_t *start;
+    wchar_t *end;       // NULL for the last chunk
+    Token *tokens;
+    int tokenCount;
+    int errorCount;     // Characters the chunk could not read
+    int failed;         // The chunk stopped at an error
+    wchar_t *errors;
+    size_t errorsSize;
+} LexChunk;
+
+// The sequential lexer skips the character after these keywords. A skipped
+// quote does not start a string, which counting quotes cannot follow.
+int swallowsNextCharacter(wchar_t *source, wchar_t *position) {
+    const wchar_t *keywords[] = {L"إذا", L"وإلا", L"بينما", L"ل"};
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        size_t length = wcslen(keywords[i]);
+        if ((size_t)(position - source) >= length && wcsncmp(position - length, keywords[i], length) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Picks up to chunkCount pieces of at least minimumChunk characters, each one
+// ending just after a semicolon outside string literals. No token spans such
+// a semicolon, so lexing the pieces separately gives the same tokens. String
+// literals have no escapes, so counting quotes from the start tells whether a
+// semicolon is inside one.
+int splitSource(wchar_t *source, size_t length, LexChunk *chunks, int chunkCount, size_t minimumChunk) {
+    size_t target = length / chunkCount;
+    if (target < minimumChunk) {
+        target = minimumChunk;
+    }
+
+    int count = 0;
+    int inString = 0;
+    wchar_t *start = source;
+    for (wchar_t *position = source; *position; position++) {
+        if (*position == L'"') {
+            if (swallowsNextCharacter(source, position)) {
+                break; // Keep the rest in one piece
+            }
+            inString = !inString;
+        } else if (*position == L';' && !inString && (size_t)(position - start) >= target &&
+                   count < chunkCount - 1) {
+            chunks[count].start = start;
+            chunks[count].end = position + 1;
+            count++;
+            start = position + 1;
+        }
+    }
+    chunks[count].start = start;
+    chunks[count].end = NULL;
+    return count + 1;
+}
+
+// Lexes one chunk with its error messages kept in a buffer. An error that
+// stops the lexer jumps back here rather than ending the thread's script.
+void *lexChunk(void *argument) {
+    LexChunk *chunk = argument;
+    scriptErrors = open_wmemstream(&chunk->errors, &chunk->errorsSize);
+    if (!scriptErrors) {
+        fwprintf(stderr, L"Failed to allocate memory for lexer messages\n");
+        exit(EXIT_FAILURE);
+    }
+    scriptRunning = 1;
+    if (setjmp(scriptRecovery) == 0) {
+        chunk->tokens = tokenizeRange(chunk->start, chunk->end, &chunk->tokenCount);
+        chunk->errorCount = lexerErrorCount;
+    } else {
+        chunk->failed = 1;
+    }
+    scriptRunning = 0;
+    fclose(scriptErrors);
+    return NULL;
+}
+
+Token *tokenizeParallel(wchar_t *source, int chunkCount, size_t minimumChunk) {
+    if (chunkCount > MAX_LEX_CHUNKS) {
+        chunkCount = MAX_LEX_CHUNKS;
+    }
+    size_t length = chunkCount > 1 ? wcslen(source) : 0;
+    if (length < 2 * minimumChunk) {
+        return tokenize(source);
+    }
+    LexChunk chunks[MAX_LEX_CHUNKS] = {0};
+    chunkCount = splitSource(source, length, chunks, chunkCount, minimumChunk);
+    if (chunkCount == 1) {
+        return tokenize(source);
+    }
+
+    pthread_t threads[MAX_LEX_CHUNKS];
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, WORKER_STACK_SIZE);
+    for (int i = 0; i < chunkCount; i++) {
+        if (pthread_create(&threads[i], &attributes, lexChunk, &chunks[i]) != 0) {
+            fwprintf(stderr, L"Failed to start lexer thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_attr_destroy(&attributes);
+    for (int i = 0; i < chunkCount; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Replay the messages in source order; the sequential lexer would have
+    // stopped at the first chunk that failed.
+    int total = 0;
+    int failed = 0;
+    lexerErrorCount = 0;
+    for (int i = 0; i < chunkCount; i++) {
+        if (!failed) {
+            fputws(chunks[i].errors, scriptErrors);
+            failed = chunks[i].failed;
+            total += chunks[i].tokenCount;
+            lexerErrorCount += chunks[i].errorCount;
+        }
+        free(chunks[i].errors);
+    }
+    if (failed) {
+        for (int i = 0; i < chunkCount; i++) {
+            if (chunks[i].tokens) {
+                freeTokens(chunks[i].tokens);
+            }
+        }
+        abortScript();
+    }
+
+    Token *tokens = malloc((total + 1) * sizeof(Token));
+    if (!tokens) {
+        fwprintf(scriptErrors, L"Failed to allocate memory\n");
+        abortScript();
+    }
+    Token *next = tokens;
+    for (int i = 0; i < chunkCount; i++) {
+        memcpy(next, chunks[i].tokens, chunks[i].tokenCount * sizeof(Token)); // The strings move with their tokens
+        for (int j = 0; j < chunks[i].tokenCount; j++) {
+            next[j].offset += (int)(chunks[i].start - source);
+        }
+        next += chunks[i].tokenCount;
+        if (i == chunkCount - 1) {
+            next->offset = chunks[i].tokens[chunks[i].tokenCount].offset + (int)(chunks[i].start - source);
+        }
+        free(chunks[i].tokens);
+    }
+    next->type = TOKEN_EOF;
+    return tokens;
+}
+
+int sameToken(Token left, Token right) {
+    if (left.type != right.type || left.offset != right.offset) {
+        return 0;
+    }
+    switch (left.type) {
+        case TOKEN_VARIABLE:
+        case TOKEN_CHAR:
+            return wcscmp(left.varName, right.varName) == 0;
+        case TOKEN_INT:
+        case TOKEN_DOUBLE:
+            return left.intValue == right.intValue; // Compares the double's bits
+        default:
+            return 1;
+    }
+}
+
+int checkParallelLexer(wchar_t *source) {
+    const int chunkings[] = {2, 3, 4, 7, 16, MAX_LEX_CHUNKS};
+    Token *expected = tokenize(source);
+    int expectedErrors = lexerErrorCount;
+    int tokenCount = 0;
+    while (expected[tokenCount].type != TOKEN_EOF) {
+        tokenCount++;
+    }
+
+    int mismatches = 0;
+    for (size_t i = 0; i < sizeof(chunkings) / sizeof(chunkings[0]); i++) {
+        Token *tokens = tokenizeParallel(source, chunkings[i], 1);
+        int index = 0;
+        while (expected[index].type != TOKEN_EOF && sameToken(expected[index], tokens[index])) {
+            index++;
+        }
+        if (!sameToken(expected[index], tokens[index])) {
+            fwprintf(scriptOutput, L"lexer check: %d chunks differ at token %d\n", chunkings[i], index);
+            mismatches++;
+        } else if (lexerErrorCount != expectedErrors) {
+            fwprintf(scriptOutput, L"lexer check: %d chunks report %d errors instead of %d\n",
+                     chunkings[i], lexerErrorCount, expectedErrors);
+            mismatches++;
+        }
+        freeTokens(tokens);
+    }
+    if (!mismatches) {
+        fwprintf(scriptOutput, L"lexer check: %d tokens, identical in every chunking\n", tokenCount);
+    }
+    freeTokens(expected);
+    return mismatches != 0;
+}
@@ -0,0 +1,25 @@
+// parlex.h
+#ifndef PARLEX_H
+#define PARLEX_H
+
+#include <wchar.h>
+#include "lexer.h"
+
+// Sources shorter than this are lexed on the calling thread
+#define PARALLEL_LEX_MIN_LENGTH (1 << 20)
+#define MAX_LEX_CHUNKS 64
+
+extern int lexerThreadCount; // 1 lexes every script sequentially
+extern int verifyLexer;      // Set by --verify-lexer
+
+// Splits the source after semicolons outside string literals, lexes the
+// pieces on separate threads and joins the token streams. The result is the
+// same as tokenize(source), including error messages and their order.
+Token *tokenizeParallel(wchar_t *source, int chunkCount, size_t minimumChunk);
+
+// Lexes the source sequentially and in several chunkings and reports
+// whether all of them produced the same tokens. Returns 0 if
+// they did.
+int checkParallelLexer(wchar_t *source);
+
+#endif // PARLEX_H
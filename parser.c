@@ -1,622 +1,733 @@
 #include "lexer.h"
+#include "script.h"
+#include "diagnostic.h"
+#include "cache.h"
 #include "parser.h"
+#include "ast.h"
+#include "interpreter.h"
+#include "value.h"
+#include "parallel.h"
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <wchar.h>
 #include <locale.h>
 
 
-int currentTokenIndex = 0;
-Token currentToken;
-
-typedef enum {
-    TYPE_INT,
-    TYPE_DOUBLE,
-    TYPE_CHAR,
-    TYPE_ERROR
-} ValueType;
-
-typedef struct {
-    wchar_t *name;  // Variable name
-    ValueType type;  // Type of the value
-    union {
-        int intValue;
-        double doubleValue;
-        wchar_t *charValue;
-    } value;
-} Symbol;
-
-#define MAX_SYMBOLS 100
-Symbol symbolTable[MAX_SYMBOLS];
-int symbolCount = 0;
-
-Token evaluateExpression();
-
-int variableExists(wchar_t *name) {
-    for (int i = 0; i < symbolCount; i++) {
-        if (wcscmp(symbolTable[i].name, name) == 0) {
-            return 1; // Variable found
-        }
+_Thread_local int currentTokenIndex = 0;
+_Thread_local void (*skippedAssignment)(wchar_t *name) = NULL;
+_Thread_local Token currentToken;
+
+// Compile-time state for the function whose body is being parsed. Parameters
+// and variables first assigned inside the body are locals; each one is given a
+// fixed slot in the function's frame.
+#define MAX_LOCALS 256
+_Thread_local Function *compilingFunction = NULL;
+_Thread_local wchar_t *localNames[MAX_LOCALS];
+_Thread_local int localCount = 0;
+
+// The parallel loop whose body is being parsed. Its body refers to the
+// variables it uses through loop->args, so that the loop can read each one
+// once before its iterations start.
+_Thread_local Node *parallelLoop = NULL;
+
+Node *evaluateExpression();
+Node *parseStatement();
+Node *parseRecovering(Node *(*parse)());
+int startsStatement(TokenType type);
+
+void nextToken() {
+    currentToken = tokens[currentTokenIndex++];
+    if (tokenStrings && tokenHasString(currentToken.type)) {
+        currentToken.varName = cachedString(tokenStrings, currentToken);
     }
-    return 0; // Variable not found
 }
 
-ValueType variableType(wchar_t *name) {
-    for (int i = 0; i < symbolCount; i++) {
-        if (wcscmp(symbolTable[i].name, name) == 0) {
-            return symbolTable[i].type;
+// Type of the token after the current one
+TokenType peekToken() {
+    return tokens[currentTokenIndex - 1].type == TOKEN_EOF ? TOKEN_EOF : tokens[currentTokenIndex].type;
+}
+
+void parseError(wchar_t* message) {
+    if (diagnosticList) {
+        if (currentToken.type != TOKEN_ERROR) { // The lexer has reported it already
+            addDiagnostic(diagnosticList, currentToken.offset, message);
         }
+        abortScript();
     }
-    return TYPE_ERROR;
+    fwprintf(scriptErrors, L"Parse error: %ls\n", message);
+    printToken(currentToken);
+    fwprintf(scriptErrors, L"\n");
+    abortScript();
 }
 
-void addSymbol(wchar_t *name, ValueType type, int intValue, double doubleValue, wchar_t *charValue) {
-    if (symbolCount >= MAX_SYMBOLS) {
-        fwprintf(stderr, L"Symbol table overflow\n");
-        exit(EXIT_FAILURE);
+void expect(TokenType expectedType) {
+    if (currentToken.type == expectedType) {
+        nextToken();
+    } else {
+        if (!diagnosticList) {
+            fwprintf(scriptErrors, L"%d\n", expectedType);
+        }
+        parseError(L"Unexpected token");
     }
+}
 
-    wchar_t* nameCopy = wcsdup(name);
-    if (!nameCopy) {
-        fwprintf(stderr, L"Failed to allocate memory for symbol name\n");
-        exit(EXIT_FAILURE);
+// Every node made since the current top-level statement began, so that an
+// error cutting statements short can free theirs. A finished top-level
+// statement or function definition owns its nodes and takes them off.
+_Thread_local Node **parsedNodes = NULL;
+_Thread_local int parsedNodeCount = 0;
+_Thread_local int parsedNodeCapacity = 0;
+
+// Frees the nodes made since the mark-th one. Their children are on the list
+// as well, so each node is freed on its own.
+void freeParsedNodes(int mark) {
+    while (parsedNodeCount > mark) {
+        Node *node = parsedNodes[--parsedNodeCount];
+        if (node->kind == NODE_LITERAL) {
+            valueFree(node->value);
+        }
+        free(node->args);
+        free(node);
     }
+}
 
-    symbolTable[symbolCount].name = nameCopy;
-    symbolTable[symbolCount].type = type;
+// Frees a statement that an error left half parsed
+void discardParsedNodes() {
+    freeParsedNodes(0);
+}
 
-    switch (type) {
-        case TYPE_INT:
-            symbolTable[symbolCount].value.intValue = intValue;
-            break;
-        case TYPE_DOUBLE:
-            symbolTable[symbolCount].value.doubleValue = doubleValue;
-            break;
-        case TYPE_CHAR:
-            {
-                wchar_t* charValueCopy = wcsdup(charValue);
-                if (!charValueCopy) {
-                    fwprintf(stderr, L"Failed to allocate memory for char value\n");
-                    free(nameCopy);  // Free the previously allocated name before exiting
-                    exit(EXIT_FAILURE);
-                }
-                symbolTable[symbolCount].value.charValue = charValueCopy;
-            }
-            break;
-        default:
-            fwprintf(stderr, L"Unknown type\n");
-            free(nameCopy);  // Free the name in case of an error
-            exit(EXIT_FAILURE);
-    }
-
-    symbolCount++;
-}
-
-void updateSymbol(wchar_t *name, ValueType type, int intValue, double doubleValue, wchar_t *charValue) {
-    for (int i = 0; i < symbolCount; i++) {
-        if (wcscmp(symbolTable[i].name, name) == 0) {
-            symbolTable[i].type = type; // Update type in case it changes
-            switch (type) {
-                case TYPE_INT:
-                    symbolTable[i].value.intValue = intValue;
-                    break;
-                case TYPE_DOUBLE:
-                    symbolTable[i].value.doubleValue = doubleValue;
-                    break;
-                case TYPE_CHAR:
-                    free(symbolTable[i].value.charValue); // Free existing string
-                    symbolTable[i].value.charValue = wcsdup(charValue); // Duplicate new string
-                    if (!symbolTable[i].value.charValue) {
-                        fwprintf(stderr, L"Failed to allocate memory for char value\n");
-                        exit(EXIT_FAILURE);
-                    }
-                    break;
-                default:
-                    fwprintf(stderr, L"Unknown type\n");
-                    exit(EXIT_FAILURE);
-            }
-            return;
+Node *newNode(NodeKind kind) {
+    if (parsedNodeCount == parsedNodeCapacity) {
+        int capacity = parsedNodeCapacity ? parsedNodeCapacity * 2 : 64;
+        Node **grown = realloc(parsedNodes, capacity * sizeof(Node *));
+        if (!grown) {
+            fwprintf(scriptErrors, L"Failed to reallocate memory\n");
+            abortScript();
         }
-    }
-    fwprintf(stderr, L"Variable not found for update: %ls\n", name);
-    exit(EXIT_FAILURE);
+        parsedNodes = grown;
+        parsedNodeCapacity = capacity;
+    }
+    Node *node = calloc(1, sizeof(Node));
+    if (!node) {
+        fwprintf(scriptErrors, L"Failed to allocate memory\n");
+        abortScript();
+    }
+    parsedNodes[parsedNodeCount++] = node;
+    node->kind = kind;
+    node->offset = currentToken.offset;
+    return node;
 }
 
-void handleAssignment(wchar_t *varName, ValueType valueType, int intValue, double doubleValue, wchar_t *charValue) {
-    if (variableExists(varName)) {
-        // Update existing variable
-        updateSymbol(varName, valueType, intValue, doubleValue, charValue);
-    } else {
-        // Add new variable
-        addSymbol(varName, valueType, intValue, doubleValue, charValue);
+int findLocal(wchar_t *name) {
+    for (int i = 0; i < localCount; i++) {
+        if (wcscmp(localNames[i], name) == 0) {
+            return i;
+        }
     }
+    return -1;
 }
 
-int getIntValue(wchar_t *name) {
-    for (int i = 0; i < symbolCount; i++) {
-        if (wcscmp(symbolTable[i].name, name) == 0) {
-            if (symbolTable[i].type == TYPE_INT) {
-                return symbolTable[i].value.intValue;
-            } else {
-                fwprintf(stderr, L"Type error: %ls is not an integer\n", name);
-                exit(EXIT_FAILURE);
-            }
-        }
+int declareLocal(wchar_t *name) {
+    if (localCount >= MAX_LOCALS) {
+        parseError(L"Too many local variables in function");
     }
-    fwprintf(stderr, L"Undefined integer variable: %ls\n", name);
-    exit(EXIT_FAILURE);
+    localNames[localCount] = name; // Borrowed from the token array
+    return localCount++;
 }
 
-double getDoubleValue(wchar_t *name) {
-    for (int i = 0; i < symbolCount; i++) {
-        if (wcscmp(symbolTable[i].name, name) == 0) {
-            if (symbolTable[i].type == TYPE_DOUBLE) {
-                return symbolTable[i].value.doubleValue;
-            } else {
-                fwprintf(stderr, L"Type error: %ls is not a double\n", name);
-                exit(EXIT_FAILURE);
-            }
+Node *variableNode(wchar_t *name);
+
+// Resolves a variable name inside a parallel loop body to the loop variable
+// or to a variable the loop captures
+Node *loopVariableNode(wchar_t *name) {
+    Node *loop = parallelLoop;
+    Node *node = newNode(wcscmp(name, loop->name) == 0 ? NODE_LOOP_INDEX : NODE_CAPTURED);
+    node->name = name;
+    if (node->kind == NODE_LOOP_INDEX) {
+        return node;
+    }
+    for (node->slot = 0; node->slot < loop->argCount; node->slot++) {
+        if (wcscmp(loop->args[node->slot]->name, name) == 0) {
+            return node;
         }
     }
-    fwprintf(stderr, L"Undefined double variable: %ls\n", name);
-    exit(EXIT_FAILURE);
+    loop->args = realloc(loop->args, (loop->argCount + 1) * sizeof(Node *));
+    if (!loop->args) {
+        fwprintf(scriptErrors, L"Failed to reallocate memory\n");
+        abortScript();
+    }
+    parallelLoop = NULL; // The capture itself resolves as it would outside the loop
+    loop->args[loop->argCount++] = variableNode(name);
+    parallelLoop = loop;
+    return node;
+}
+
+// Resolves a variable name to a frame slot if it is a local of the function
+// being compiled, and to a symbol table lookup otherwise.
+Node *variableNode(wchar_t *name) {
+    if (parallelLoop) {
+        return loopVariableNode(name);
+    }
+    int slot = compilingFunction ? findLocal(name) : -1;
+    Node *node = newNode(slot >= 0 ? NODE_LOCAL : NODE_GLOBAL);
+    node->slot = slot;
+    node->name = name;
+    return node;
 }
 
-wchar_t* getCharValue(wchar_t *name) {
-    for (int i = 0; i < symbolCount; i++) {
-        if (wcscmp(symbolTable[i].name, name) == 0) {
-            if (symbolTable[i].type == TYPE_CHAR) {
-                return symbolTable[i].value.charValue;
-            } else {
-                fwprintf(stderr, L"Type error: %ls is not a string\n", name);
-                exit(EXIT_FAILURE);
+// Parses a comma-separated expression list up to and including the closing
+// token into node->args.
+void parseArguments(Node *node, TokenType closing) {
+    int capacity = 0;
+    while (currentToken.type != closing) {
+        if (node->argCount > 0) {
+            expect(TOKEN_COMMA);
+        }
+        if (node->argCount >= capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            node->args = realloc(node->args, capacity * sizeof(Node *));
+            if (!node->args) {
+                fwprintf(scriptErrors, L"Failed to reallocate memory\n");
+                abortScript();
             }
         }
+        node->args[node->argCount++] = evaluateExpression();
     }
-    fwprintf(stderr, L"Undefined string variable: %ls\n", name);
-    exit(EXIT_FAILURE);
+    nextToken(); // Consume the closing token
 }
 
+// Parses a call; the current token is the function name.
+Node *parseCall() {
+    int builtin = findBuiltin(currentToken.varName);
+    Node *node = newNode(builtin >= 0 ? NODE_BUILTIN : NODE_CALL);
+    node->slot = builtin >= 0 ? builtin : declareFunction(currentToken.varName);
+    nextToken(); // Consume the function name
+    expect(TOKEN_LPAREN);
+    parseArguments(node, TOKEN_RPAREN);
 
-void nextToken() {
-    currentToken = tokens[currentTokenIndex++];
-}
-
-void parseError(wchar_t* message) {
-    fprintf(stderr, "Parse error: %ls\n", message);
-    printToken(currentToken);
-    exit(EXIT_FAILURE);
-}
-
-void expect(TokenType expectedType) {
-    if (currentToken.type == expectedType) {
-        nextToken();
-    } else {
-        printf("%d\n", expectedType);
-        parseError(L"Unexpected token");
+    int paramCount = builtin >= 0 ? builtinParamCount(builtin) : functions[node->slot].paramCount;
+    if (paramCount >= 0 && paramCount != node->argCount) {
+        parseError(L"Wrong number of arguments in call");
     }
+    return node;
 }
 
-void parsePrintStatement() {
+Node *parsePrintStatement() {
+    int offset = currentToken.offset;
     nextToken(); // Consume the print token
 
     // Expect the left parenthesis
     expect(TOKEN_LPAREN);
 
-    switch (currentToken.type) {
-        case TOKEN_CHAR:
-            // Print the string literal
-            printf("%ls\n", currentToken.charValue);
-            nextToken(); // Consume the char token
-            break;
-        case TOKEN_INT:
-            // Print the string literal
-            printf("%d\n", currentToken.intValue);
-            nextToken(); // Consume the char token
-            break;   
-        case TOKEN_DOUBLE:
-            // Print the string literal
-            printf("%lf\n", currentToken.doubleValue);
-            nextToken(); // Consume the char token
-            break; 
-        case TOKEN_VARIABLE:
-            // Print the value of the variable
-            if (variableType(currentToken.varName) == TYPE_INT){
-                printf("%d\n", getIntValue(currentToken.varName));
-            }
-            else if(variableType(currentToken.varName) == TYPE_DOUBLE){
-                printf("%lf\n", getDoubleValue(currentToken.varName));
-            }
-            else if(variableType(currentToken.varName) == TYPE_CHAR){
-                wprintf(L"%ls\n", getCharValue(currentToken.varName));
-            }
-            nextToken(); // Consume the variable token
-            break;
-        default:
-            parseError(L"Expected a string or a variable in print statement");
-    }
+    Node *node = newNode(NODE_PRINT);
+    node->offset = offset;
+    node->left = evaluateExpression();
 
     // Expect the right parenthesis and semicolon
     expect(TOKEN_RPAREN);
     expect(TOKEN_SEMICOLON);
+    return node;
 }
 
-// Converts a token from integer to double type.
-void convertToDouble(Token *token) {
-    if (token->type == TOKEN_INT) {
-        token->doubleValue = (double)token->intValue; // Convert int to double
-        token->type = TOKEN_DOUBLE; // Update the token type
-    }
-}
-
-
-// Performs arithmetic operations based on the operator type.
-Token performArithmeticOperation(Token left, Token right, TokenType operatorType) {
-    Token result;
-
-    // Handle type conversion if operands are of different types
-    if (left.type != right.type) {
-        if (left.type == TOKEN_DOUBLE || right.type == TOKEN_DOUBLE) {
-            convertToDouble(&left);
-            convertToDouble(&right);
-        }
+// Parses any number of [index] suffixes after an expression.
+Node *parseIndexing(Node *result) {
+    while (currentToken.type == TOKEN_LEFT_BRACKET) {
+        Node *node = newNode(NODE_INDEX);
+        nextToken(); // Move past the '['
+        node->left = result;
+        node->right = evaluateExpression();
+        expect(TOKEN_RIGHT_BRACKET);
+        result = node;
     }
-
-    // Determine the result type (double if any operand is double)
-    result.type = (left.type == TOKEN_DOUBLE || right.type == TOKEN_DOUBLE) ? TOKEN_DOUBLE : TOKEN_INT;
-
-    // Perform the arithmetic operation based on the result type
-    if (result.type == TOKEN_INT) {
-        // Integer arithmetic
-        switch (operatorType) {
-            case TOKEN_PLUS:
-                result.intValue = left.intValue + right.intValue;
-                break;
-            case TOKEN_MINUS:
-                result.intValue = left.intValue - right.intValue;
-                break;
-            case TOKEN_STAR:
-                result.intValue = left.intValue * right.intValue;
-                break;
-            case TOKEN_SLASH:
-                if (right.intValue == 0) {
-                    parseError(L"Runtime error: Division by zero in expression.\n");
-                    exit(EXIT_FAILURE);
-                }
-                result.intValue = left.intValue / right.intValue; // Handle division by zero
-                break;
-            default:
-                parseError(L"Unexpected token in statement");
-        }
-    } else if (result.type == TOKEN_DOUBLE) {
-        // Floating-point arithmetic
-        switch (operatorType) {
-            case TOKEN_PLUS:
-                result.doubleValue = left.doubleValue + right.doubleValue;
-                break;
-            case TOKEN_MINUS:
-                result.doubleValue = left.doubleValue - right.doubleValue;
-                break;
-            case TOKEN_STAR:
-                result.doubleValue = left.doubleValue * right.doubleValue;
-                break;
-            case TOKEN_SLASH:
-                if (right.doubleValue == 0) {
-                        parseError(L"Runtime error: Division by zero in expression.\n");
-                        exit(EXIT_FAILURE);
-                    }
-                result.doubleValue = left.doubleValue / right.doubleValue; // Handle division by zero
-                break;
-            default:
-                parseError(L"Unexpected token in statement");
-        }
-    }
-
     return result;
 }
 
 // Parses primary expressions like numbers and parenthesized expressions.
-Token parsePrimaryExpression() {
-    Token result;
-    if (currentToken.type == TOKEN_INT || currentToken.type == TOKEN_DOUBLE) {
+Node *parsePrimaryExpression() {
+    Node *result;
+    if (currentToken.type == TOKEN_INT) {
         // If the current token is a number, return it as the result
-        result = currentToken;
+        result = newNode(NODE_LITERAL);
+        result->value = valueCopy(valueFromInt(currentToken.intValue));
+        nextToken(); // Move past the number
+        return result;
+    } else if (currentToken.type == TOKEN_DOUBLE) {
+        result = newNode(NODE_LITERAL);
+        result->value = valueFromDouble(currentToken.doubleValue);
         nextToken(); // Move past the number
         return result;
     } else if (currentToken.type == TOKEN_LPAREN) {
         nextToken(); // Move past the '('
-        result = evaluateExpression(); // Evaluate the expression inside the parentheses
+        result = evaluateExpression(); // Parse the expression inside the parentheses
         if (currentToken.type != TOKEN_RPAREN) {
             parseError(L"Expected ')'");
         }
         nextToken(); // Move past the ')'
-        return result;
+        return parseIndexing(result);
     } else if (currentToken.type == TOKEN_VARIABLE) {
-        // Handle variable
-        ValueType varType = variableType(currentToken.varName);
-        switch (varType) {
-            case TYPE_INT:
-                result.type = TOKEN_INT;
-                result.intValue = getIntValue(currentToken.varName);
-                break;
-            case TYPE_DOUBLE:
-                result.type = TOKEN_DOUBLE;
-                result.doubleValue = getDoubleValue(currentToken.varName);
-                break;
-            default:
-                parseError(L"Variable type not supported in expression");
-                // Fall through to return an error token
+        if (peekToken() == TOKEN_LPAREN) {
+            return parseIndexing(parseCall());
         }
+        // Handle variable
+        result = variableNode(currentToken.varName);
         nextToken(); // Consume the variable token
+        return parseIndexing(result);
+    } else if (currentToken.type == TOKEN_LEFT_BRACKET) {
+        // Array literal
+        result = newNode(NODE_ARRAY);
+        nextToken(); // Move past the '['
+        parseArguments(result, TOKEN_RIGHT_BRACKET);
+        return parseIndexing(result);
+    } else if (currentToken.type == TOKEN_CHAR) {
+        result = newNode(NODE_LITERAL);
+        result->value = valueCopy(valueFromString(currentToken.charValue));
+        nextToken(); // Consume the string token
         return result;
-    }else if (currentToken.type == TOKEN_CHAR){
-
-        result.type = TOKEN_CHAR;
-        result.charValue = getCharValue(currentToken.charValue);
-
-        nextToken(); // Consume the variable token
-        return result;        
-        
     } else {
         // If the token is not a number or a parenthesis, it's an error
         parseError(L"Expected a primary expression");
-        Token errorToken;
-        errorToken.type = TOKEN_ERROR; // Assuming TOKEN_ERROR is a defined error type
-        return errorToken;
+        return NULL;
     }
 }
 
+Node *binaryNode(Token operator, Node *left, Node *right) {
+    Node *node = newNode(NODE_BINARY);
+    node->op = operator.type;
+    node->offset = operator.offset;
+    node->left = left;
+    node->right = right;
+    return node;
+}
+
 // Parses multiplication and division.
-Token parseMultiplicationDivision() {
+Node *parseMultiplicationDivision() {
     // Parse a primary expression, which could be a number or a parenthesized expression
-    Token result = parsePrimaryExpression();
+    Node *result = parsePrimaryExpression();
 
     // Loop to handle a series of multiplication/division operations
     while (currentToken.type == TOKEN_STAR || currentToken.type == TOKEN_SLASH) {
-        TokenType operatorType = currentToken.type;
+        Token operator = currentToken;
         nextToken(); // Move past the '*' or '/' operator
-        Token right = parsePrimaryExpression(); // Parse the right operand
+        Node *right = parsePrimaryExpression(); // Parse the right operand
 
-        // Perform the arithmetic operation and update the result
-        result = performArithmeticOperation(result, right, operatorType);
+        result = binaryNode(operator, result, right);
     }
 
     return result;
 }
 
 // Parses addition and subtraction, which have lower precedence than multiplication and division.
-Token parseAdditionSubtraction() {
+Node *parseAdditionSubtraction() {
     // First, parse the higher precedence operations (multiplication and division)
-    Token result = parseMultiplicationDivision();
+    Node *result = parseMultiplicationDivision();
 
     // Loop to handle a series of addition/subtraction operations
     while (currentToken.type == TOKEN_PLUS || currentToken.type == TOKEN_MINUS) {
-        TokenType operatorType = currentToken.type;
+        Token operator = currentToken;
         nextToken(); // Move past the '+' or '-' operator
-        Token right = parseMultiplicationDivision(); // Parse the right operand
+        Node *right = parseMultiplicationDivision(); // Parse the right operand
 
-        // Perform the arithmetic operation and update the result
-        result = performArithmeticOperation(result, right, operatorType);
+        result = binaryNode(operator, result, right);
     }
 
     return result;
 }
 
-// Entry point for evaluating an expression.
-Token evaluateExpression() {
-    // If the current token is a character or string literal, return it
-    if (currentToken.type == TOKEN_CHAR) {
-        Token result = currentToken;
-        nextToken(); // Move past the char token
-        return result;
-    }
-
-    // For other types, continue with arithmetic operations
+// Entry point for parsing an expression.
+Node *evaluateExpression() {
     return parseAdditionSubtraction();
 }
 
+Node *parseAssignment() {
+    if (currentToken.type != TOKEN_VARIABLE) {
+        parseError(L"Expected variable name");
+    }
 
-void parseIncrementation(wchar_t *varName, double value, TokenType operation) {
-    for (int i = 0; i < symbolCount; i++) {
-        if (wcscmp(symbolTable[i].name, varName) == 0) {
-            if (symbolTable[i].type == TYPE_INT) {
-                if (operation == TOKEN_INCREMENT_BY)
-                    symbolTable[i].value.intValue += (int)value;
-                else if (operation == TOKEN_DECREASE_BY)
-                    symbolTable[i].value.intValue -= (int)value;
-                else if (operation == TOKEN_MULTIPLY_BY)
-                    symbolTable[i].value.intValue *= (int)value;
-                else if (operation == TOKEN_DIVIDE_BY)
-                    symbolTable[i].value.intValue /= (int)value;
-                else if (operation == TOKEN_MOD_BY)
-                    symbolTable[i].value.intValue %= (int)value;
-            } else if (symbolTable[i].type == TYPE_DOUBLE) {
-                if (operation == TOKEN_INCREMENT_BY)
-                    symbolTable[i].value.doubleValue += value;
-                else if (operation == TOKEN_DECREASE_BY)
-                    symbolTable[i].value.doubleValue -= value;
-                else if (operation == TOKEN_MULTIPLY_BY)
-                    symbolTable[i].value.doubleValue *= value;
-                else if (operation == TOKEN_DIVIDE_BY)
-                    symbolTable[i].value.doubleValue /= value;
-                // Note: Modulo operation not applicable for doubles
-            }
-            return;
+    if (peekToken() == TOKEN_LPAREN) {
+        // A call evaluated for its side effects
+        Node *node = newNode(NODE_EXPRESSION);
+        node->left = parseCall();
+        expect(TOKEN_SEMICOLON);
+        return node;
+    }
+
+    wchar_t *varName = currentToken.varName; // Store the variable name
+    int offset = currentToken.offset;
+    nextToken(); // Move to the assignment operator or '['
+
+    Node *indexTarget = NULL;
+    if (currentToken.type == TOKEN_LEFT_BRACKET) {
+        // Element assignment; the array itself is only read
+        indexTarget = parseIndexing(variableNode(varName));
+    }
+
+    TokenType assignmentType = currentToken.type; // Store the assignment type
+    switch (assignmentType) {
+        case TOKEN_ASSIGNMENT:
+        case TOKEN_INCREMENT_BY:
+        case TOKEN_DECREASE_BY:
+        case TOKEN_MULTIPLY_BY:
+        case TOKEN_DIVIDE_BY:
+        case TOKEN_MOD_BY:
+            break;
+        default:
+            parseError(L"Expected assignment operator");
+    }
+    if (parallelLoop && !indexTarget) {
+        // Iterations can only combine what they add or multiply into a variable
+        if (wcscmp(varName, parallelLoop->name) == 0) {
+            parseError(L"The loop variable cannot be assigned");
+        }
+        if (assignmentType != TOKEN_INCREMENT_BY && assignmentType != TOKEN_MULTIPLY_BY) {
+            parseError(L"A parallel loop can only update a variable with += or *=");
         }
     }
-    fwprintf(stderr, L"Variable not found for update: %ls\n", varName);
-    exit(EXIT_FAILURE);
-}
+    nextToken(); // Move past the assignment operator
 
-// Implementation of parseIncrementBy
-void parseIncrementBy(wchar_t *varName, TokenType type, int intValue, double doubleValue) {
-    double value = (type == TYPE_INT) ? (double)intValue : doubleValue;
-    parseIncrementation(varName, value, TOKEN_INCREMENT_BY);
-}
+    Node *node = newNode(NODE_ASSIGN);
+    node->op = assignmentType;
+    node->offset = offset;
+    // Parse the right-hand side before declaring a new local, so that it still
+    // sees a global of the same name
+    node->left = evaluateExpression();
 
-// Implementation of parseDivideBy
-void parseDivideBy(wchar_t *varName, TokenType type, int intValue, double doubleValue) {
-    double value = (type == TYPE_INT) ? (double)intValue : doubleValue;
-    parseIncrementation(varName, value, TOKEN_DIVIDE_BY);
-}
+    if (indexTarget) {
+        node->target = indexTarget;
+    } else {
+        if (compilingFunction && assignmentType == TOKEN_ASSIGNMENT && findLocal(varName) < 0) {
+            declareLocal(varName);
+        }
+        node->target = variableNode(varName);
+        node->target->offset = offset;
+    }
 
-// Implementation of parseDecreaseBy
-void parseDecreaseBy(wchar_t *varName, TokenType type, int intValue, double doubleValue) {
-    double value = (type == TYPE_INT) ? (double)intValue : doubleValue;
-    parseIncrementation(varName, value, TOKEN_DECREASE_BY);
+    expect(TOKEN_SEMICOLON); // Expect a semicolon at the end of the assignment
+    return node;
 }
 
-// Implementation of parseMultiplyBy
-void parseMultiplyBy(wchar_t *varName, TokenType type, int intValue, double doubleValue) {
-    double value = (type == TYPE_INT) ? (double)intValue : doubleValue;
-    parseIncrementation(varName, value, TOKEN_MULTIPLY_BY);
-}
+Node *parseReturnStatement() {
+    if (!compilingFunction) {
+        parseError(L"Return outside of a function");
+    }
+    Node *node = newNode(NODE_RETURN);
+    nextToken(); // Consume the return token
 
-// Implementation of parseModBy
-void parseModBy(wchar_t *varName, TokenType type, int intValue, double doubleValue) {
-    if (type != TYPE_INT) {
-        fwprintf(stderr, L"Modulo operation not supported for double\n");
-        exit(EXIT_FAILURE);
+    if (currentToken.type != TOKEN_SEMICOLON) {
+        node->left = evaluateExpression();
     }
-    parseIncrementation(varName, (double)intValue, TOKEN_MOD_BY);
+    expect(TOKEN_SEMICOLON);
+    return node;
 }
 
-void parseAssignment() {
+// Parses a function definition and registers it; it produces no statement.
+void parseFunctionDefinition() {
+    if (compilingFunction) {
+        parseError(L"Functions cannot be nested");
+    }
+    int mark = parsedNodeCount;
+    nextToken(); // Consume the function keyword
+
     if (currentToken.type != TOKEN_VARIABLE) {
-        parseError(L"Expected variable name");
+        parseError(L"Expected function name");
+    }
+    if (findBuiltin(currentToken.varName) >= 0) {
+        parseError(L"Function name is reserved for a builtin");
+    }
+    Function *function = &functions[declareFunction(currentToken.varName)];
+    if (function->paramCount >= 0) {
+        parseError(L"Function already defined");
     }
+    nextToken(); // Consume the function name
+    compilingFunction = function;
 
-    wchar_t *varName = wcsdup(currentToken.varName); // Store the variable name
-    nextToken(); // Move to the assignment operator
+    // Parameters occupy the first slots of the frame
+    localCount = 0;
+    expect(TOKEN_LPAREN);
+    while (currentToken.type != TOKEN_RPAREN) {
+        if (localCount > 0) {
+            expect(TOKEN_COMMA);
+        }
+        if (currentToken.type != TOKEN_VARIABLE) {
+            parseError(L"Expected parameter name");
+        }
+        if (findLocal(currentToken.varName) >= 0) {
+            parseError(L"Duplicate parameter name");
+        }
+        declareLocal(currentToken.varName);
+        nextToken();
+    }
+    nextToken(); // Consume the ')'
+    function->paramCount = localCount; // Known before the body so recursive calls are checked
 
-    TokenType assignmentType = currentToken.type; // Store the assignment type
-    nextToken(); // Move past the assignment operator
+    expect(TOKEN_LEFT_BRACE);
 
-    // Evaluate the right-hand side expression
-    Token rhsResult = evaluateExpression();
-
-    if (assignmentType == TOKEN_ASSIGNMENT) {
-        // Handle different types of right-hand side expressions
-        switch (rhsResult.type) {
-            case TOKEN_INT:
-                handleAssignment(varName, TYPE_INT, rhsResult.intValue, 0, NULL);
-                break;
-            case TYPE_DOUBLE:
-                handleAssignment(varName, TYPE_DOUBLE, 0, rhsResult.doubleValue, NULL);
-                break;
-            case TOKEN_CHAR:
-                handleAssignment(varName, TYPE_CHAR, 0, 0, rhsResult.charValue);
-                break;
-            default:
-                parseError(L"Invalid right-hand side in assignment");
+    Node *body = NULL;
+    Node **tail = &body;
+    while (currentToken.type != TOKEN_RIGHT_BRACE) {
+        // When collecting errors, a function keyword most likely means this
+        // body is missing its '}'
+        if (currentToken.type == TOKEN_EOF || (diagnosticList && currentToken.type == TOKEN_FUNCTION)) {
+            parseError(L"Expected '}'");
         }
-    }
-    else if(assignmentType == TOKEN_INCREMENT_BY) {
-        if (rhsResult.type == TOKEN_INT) {
-            parseIncrementBy(varName, TOKEN_INT, rhsResult.intValue, 0);
-        } else if (rhsResult.type == TOKEN_DOUBLE) {
-            parseIncrementBy(varName, TOKEN_DOUBLE, 0, rhsResult.doubleValue);
-        } else {
-            parseError(L"Invalid right-hand side in assignment");
+        Node *statement = diagnosticList ? parseRecovering(parseStatement) : parseStatement();
+        if (statement) {
+            *tail = statement;
+            tail = &statement->next;
         }
     }
-    else if(assignmentType == TOKEN_DIVIDE_BY) {
-        if (rhsResult.type == TOKEN_INT) {
-            parseDivideBy(varName, TOKEN_INT, rhsResult.intValue, 0);
-        } else if (rhsResult.type == TOKEN_DOUBLE) {
-            parseDivideBy(varName, TOKEN_DOUBLE, 0, rhsResult.doubleValue);
-        } else {
-            parseError(L"Invalid right-hand side in assignment");
-        }
+    nextToken(); // Consume the '}'
+
+    function->body = body;
+    function->localCount = localCount;
+    compilingFunction = NULL;
+    localCount = 0;
+    parsedNodeCount = mark; // The function owns its body now
+}
+
+// Reports an error found in a whole parsed statement, at node
+void nodeError(Node *node, wchar_t *message) {
+    if (diagnosticList) {
+        addDiagnostic(diagnosticList, node->offset, message);
+        return;
     }
-    else if(assignmentType == TOKEN_DECREASE_BY) {
-        if (rhsResult.type == TOKEN_INT) {
-            parseDecreaseBy(varName, TOKEN_INT, rhsResult.intValue, 0);
-        } else if (rhsResult.type == TOKEN_DOUBLE) {
-            parseDecreaseBy(varName, TOKEN_DOUBLE, 0, rhsResult.doubleValue);
-        } else {
-            parseError(L"Invalid right-hand side in assignment");
-        }
+    fwprintf(scriptErrors, L"Parse error: %ls\n", message);
+    abortScript();
+}
+
+// Consumes a word that is only a keyword where it appears, like من
+void expectWord(wchar_t *word) {
+    if (currentToken.type != TOKEN_VARIABLE || wcscmp(currentToken.varName, word) != 0) {
+        wchar_t message[32];
+        swprintf(message, 32, L"Expected %ls", word);
+        parseError(message);
     }
-    else if(assignmentType == TOKEN_MULTIPLY_BY) {
-        if (rhsResult.type == TOKEN_INT) {
-            parseMultiplyBy(varName, TOKEN_INT, rhsResult.intValue, 0);
-        } else if (rhsResult.type == TOKEN_DOUBLE) {
-            parseMultiplyBy(varName, TOKEN_DOUBLE, 0, rhsResult.doubleValue);
-        } else {
-            parseError(L"Invalid right-hand side in assignment");
-        }
+    nextToken();
+}
+
+// A statement of a parallel loop body: an assignment that the parser then
+// limits to an element at the loop variable or a variable update
+Node *parseLoopStatement() {
+    if (currentToken.type != TOKEN_VARIABLE || peekToken() == TOKEN_LPAREN) {
+        parseError(L"A parallel loop body can only assign array elements and update variables with += or *=");
     }
-    else if(assignmentType == TOKEN_MOD_BY) {
-        if (rhsResult.type == TOKEN_INT) {
-            parseModBy(varName, TOKEN_INT, rhsResult.intValue, 0);
-        } else if (rhsResult.type == TOKEN_DOUBLE) {
-            parseModBy(varName, TOKEN_DOUBLE, 0, rhsResult.doubleValue);
-        } else {
-            parseError(L"Invalid right-hand side in assignment");
+    return parseAssignment();
+}
+
+// Parses a parallel loop, ل ع من أ إلى ب { ... }
+Node *parseForStatement() {
+    int mark = parsedNodeCount;
+    Node *loop = newNode(NODE_FOR);
+    nextToken(); // Consume the ل
+    if (currentToken.type != TOKEN_VARIABLE) {
+        parseError(L"Expected loop variable name");
+    }
+    loop->name = currentToken.varName;
+    nextToken();
+    expectWord(L"من");
+    loop->left = evaluateExpression();
+    expectWord(L"إلى");
+    loop->right = evaluateExpression();
+    expect(TOKEN_LEFT_BRACE);
+
+    parallelLoop = loop;
+    Node **tail = &loop->body;
+    while (currentToken.type != TOKEN_RIGHT_BRACE) {
+        if (currentToken.type == TOKEN_EOF || (diagnosticList && currentToken.type == TOKEN_FUNCTION)) {
+            parseError(L"Expected '}'");
+        }
+        Node *statement = diagnosticList ? parseRecovering(parseLoopStatement) : parseLoopStatement();
+        if (statement) {
+            *tail = statement;
+            tail = &statement->next;
         }
     }
-    else {
-        parseError(L"Expected assignment operator");
-    }
+    parallelLoop = NULL;
+    nextToken(); // Consume the '}'
 
-    free(varName); // Clean up the allocated variable name
-    expect(TOKEN_SEMICOLON); // Expect a semicolon at the end of the assignment
+    wchar_t message[256];
+    Node *bad = checkParallelLoop(loop, message, 256);
+    if (bad) {
+        nodeError(bad, message);
+        freeParsedNodes(mark);
+        return NULL;
+    }
+    return loop;
 }
 
-void parseStatement() {
+Node *parseStatement() {
     switch (currentToken.type) {
         case TOKEN_VARIABLE:
-            parseAssignment();  // Handle variable assignment
-            break;
-        /*
+            return parseAssignment();  // Handle variable assignment or call
         case TOKEN_FOR:
-            parseForStatement();  // Handle for loop
-            break;
+            return parseForStatement();  // Handle parallel loop
+        /*
         case TOKEN_IF:
             parseIfStatement();  // Handle if statement
             break;
         case TOKEN_WHILE:
             parseWhileStatement();  // Handle while loop
-            break; 
+            break;
         */
         case TOKEN_PRINT:
-            parsePrintStatement();  // Handle print statement
-            break;
-        /*
+            return parsePrintStatement();  // Handle print statement
         case TOKEN_RETURN:
-            parseReturnStatement();  // Handle return statement
-            break;
-        */
+            return parseReturnStatement();  // Handle return statement
         default:
             parseError(L"Unexpected token in statement");
+            return NULL;
     }
 }
 
-void parseProgram() {
-    
-    nextToken(); // Start parsing by fetching the first token
-    
-    while (currentToken.type != TOKEN_EOF) {
-        parseStatement();
+// Parses the next top-level statement, or returns NULL at the end of the
+// input. Function definitions are registered as they are parsed and do not
+// produce a statement.
+Node *parseTopLevelStatement() {
+    if (currentTokenIndex == 0) {
+        nextToken(); // Start parsing by fetching the first token
+    }
+
+    while (currentToken.type == TOKEN_FUNCTION) {
+        parseFunctionDefinition();
     }
+    if (currentToken.type == TOKEN_EOF) {
+        return NULL;
+    }
+    Node *statement = parseStatement();
+    parsedNodeCount = 0; // The caller owns the statement now
+    return statement;
+}
+
+// Rewinds to the start of a new token stream.
+void resetParser() {
+    currentTokenIndex = 0;
+    compilingFunction = NULL;
+    localCount = 0;
+    parallelLoop = NULL;
+}
+
+// Leaves a function whose definition an error cut short undefined, so it can
+// be written again.
+void abandonFunction() {
+    if (compilingFunction && !compilingFunction->body) {
+        compilingFunction->paramCount = -1;
+    }
+    compilingFunction = NULL;
+    localCount = 0;
+    parallelLoop = NULL;
+}
+
+// Continues parsing at tokenIndex, after more tokens were appended or after
+// an error cut a statement short.
+void resumeParser(int tokenIndex) {
+    abandonFunction();
+    currentTokenIndex = tokenIndex;
+    nextToken();
 }
 
-void freeSymbolTable() {
-    for (int i = 0; i < symbolCount; i++) {
-        // Free the memory allocated for the name of the symbol
-        free(symbolTable[i].name);
-        symbolTable[i].name = NULL;
+// Keywords that only ever begin a statement
+int startsStatement(TokenType type) {
+    return type == TOKEN_FUNCTION || type == TOKEN_PRINT || type == TOKEN_RETURN ||
+           type == TOKEN_IF || type == TOKEN_WHILE || type == TOKEN_FOR;
+}
 
-        // If the symbol is of string type, also free the memory allocated for the string value
-        if (symbolTable[i].type == TYPE_CHAR) {
-            free(symbolTable[i].value.charValue);
-            symbolTable[i].value.charValue = NULL;
+// Skips the rest of a statement after an error: up to and including a ';' or
+// a braced block, or up to a keyword that starts the next statement. A '}'
+// that closes an enclosing block is left for it.
+void synchronize() {
+    int depth = 0;
+    while (currentToken.type != TOKEN_EOF) {
+        if (currentToken.type == TOKEN_SEMICOLON && depth == 0) {
+            nextToken();
+            return;
+        } else if (currentToken.type == TOKEN_LEFT_BRACE) {
+            depth++;
+        } else if (currentToken.type == TOKEN_RIGHT_BRACE) {
+            if (depth == 0) {
+                return;
+            }
+            if (--depth == 0) {
+                nextToken();
+                return;
+            }
+        } else if (depth == 0 && startsStatement(currentToken.type)) {
+            return;
         }
+        nextToken();
     }
+}
 
-    // Reset the symbol count to 0
-    symbolCount = 0;
+// Runs parse with diagnosticList set. An error is added to the list, the
+// rest of the statement is skipped and NULL is returned, so one error does
+// not hide the ones after it. The nodes of the statement cut short are freed.
+Node *parseRecovering(Node *(*parse)()) {
+    jmp_buf outer;
+    memcpy(outer, scriptRecovery, sizeof(jmp_buf));
+    int start = currentTokenIndex;
+    int mark = parsedNodeCount;
+    Node *loop = parallelLoop; // Still being parsed if the statement is in its body
+    int captures = loop ? loop->argCount : 0;
+    // The variable the statement assigns, if it is an assignment
+    wchar_t *volatile assigned =
+        currentToken.type == TOKEN_VARIABLE && peekToken() != TOKEN_LPAREN ? currentToken.varName : NULL;
+    int errors = diagnosticList->count;
+    Node *volatile statement = NULL;
+    if (setjmp(scriptRecovery) == 0) {
+        statement = parse();
+    } else {
+        memcpy(scriptRecovery, outer, sizeof(jmp_buf));
+        parallelLoop = loop;
+        freeParsedNodes(mark);
+        if (loop) {
+            loop->argCount = captures; // Those the statement added were freed with it
+        }
+        // Errors such as a full function table are only printed
+        if (diagnosticList->count == errors && currentToken.type != TOKEN_ERROR) {
+            addDiagnostic(diagnosticList, currentToken.offset, L"Statement could not be checked");
+        }
+        if (parse == parseTopLevelStatement) {
+            abandonFunction();
+        }
+        if (skippedAssignment && assigned) {
+            skippedAssignment(assigned);
+        }
+        synchronize();
+        if (currentTokenIndex == start && currentToken.type != TOKEN_EOF) {
+            nextToken(); // A stray '}' or keyword; step over it so parsing moves on
+        }
+    }
+    memcpy(scriptRecovery, outer, sizeof(jmp_buf));
+    return statement;
 }
 
+// Parses the rest of the token stream without running it, adding every parse
+// error to diagnosticList, which must be set. check, if not NULL, is given
+// every top-level statement that parsed. Returns the number of errors added.
+int collectParseErrors(void (*check)(Node *statement)) {
+    int errors = diagnosticList->count;
+    if (currentTokenIndex == 0) {
+        nextToken(); // Start parsing by fetching the first token
+    }
+    while (currentToken.type != TOKEN_EOF) {
+        Node *statement = parseRecovering(parseTopLevelStatement);
+        if (statement && check) {
+            check(statement);
+        }
+        freeNode(statement);
+    }
+    return diagnosticList->count - errors;
+}
+
+// Parses the whole program into a statement list.
+Node *parseProgram() {
+    Node *program = NULL;
+    Node **tail = &program;
+    Node *statement;
 
+    while ((statement = parseTopLevelStatement())) {
+        *tail = statement;
+        tail = &statement->next;
+    }
+    return program;
+}
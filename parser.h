@@ -3,7 +3,23 @@
 #define PARSER_H
 
 #include "lexer.h" // Assuming Token is defined in lexer.h
+#include "ast.h"
 
-extern Token *tokens; // Global declaration
+extern _Thread_local Token *tokens; // Global declaration
+// The string table of tokens loaded from a cache, whose string tokens hold
+// offsets into it; NULL when the tokens were lexed
+extern _Thread_local wchar_t *tokenStrings;
+
+Node *parseTopLevelStatement();
+Node *parseProgram();
+void resetParser();
+void resumeParser(int tokenIndex);
+int collectParseErrors(void (*check)(Node *statement));
+// Frees the nodes of a statement whose parsing an error cut short
+void discardParsedNodes();
+
+// When set, called with the variable of every assignment that
+// collectParseErrors skips because of an error
+extern _Thread_local void (*skippedAssignment)(wchar_t *name);
 
 #endif // PARSER_H
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "pool.h"
+#include "interpreter.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+// A worker's share of the scripts, [next, end). The owner takes scripts from
+// the front and an idle worker steals the back half, so a worker that drew
+// slow scripts hands the rest of them on.
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+} WorkQueue;
+
+typedef struct {
+    wchar_t *output;
+    size_t outputSize;
+    wchar_t *errors;
+    size_t errorsSize;
+    int failed;
+    int done;
+} ScriptResult;
+
+typedef struct {
+    Script *scripts;
+    ScriptResult *results;
+    WorkQueue *queues;
+    int workerCount;
+    pthread_mutex_t doneLock;
+    pthread_cond_t doneSignal;
+} Pool;
+
+typedef struct {
+    Pool *pool;
+    int index;
+} Worker;
+
+int takeScript(WorkQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    int script = queue->next < queue->end ? queue->next++ : -1;
+    pthread_mutex_unlock(&queue->lock);
+    return script;
+}
+
+// Moves the back half of another worker's remaining scripts into the thief's
+// empty queue. Returns 0 once every queue is empty.
+int stealScripts(Pool *pool, int thief) {
+    for (int offset = 1; offset < pool->workerCount; offset++) {
+        WorkQueue *victim = &pool->queues[(thief + offset) % pool->workerCount];
+        pthread_mutex_lock(&victim->lock);
+        int remaining = victim->end - victim->next;
+        if (remaining > 0) {
+            int end = victim->end;
+            victim->end -= (remaining + 1) / 2;
+            int start = victim->end;
+            pthread_mutex_unlock(&victim->lock);
+
+            WorkQueue *queue = &pool->queues[thief];
+            pthread_mutex_lock(&queue->lock);
+            queue->next = start;
+            queue->end = end;
+            pthread_mutex_unlock(&queue->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return 0;
+}
+
+void runBufferedScript(Pool *pool, int index) {
+    ScriptResult *result = &pool->results[index];
+    Script script = pool->scripts[index];
+    scriptOutput = open_wmemstream(&result->output, &result->outputSize);
+    scriptErrors = open_wmemstream(&result->errors, &result->errorsSize);
+    if (!scriptOutput || !scriptErrors) {
+        fwprintf(stderr, L"Failed to allocate memory for script output\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (checkOnly) {
+        // Every error already names the script
+        result->failed = checkScript(script);
+    } else {
+        fwprintf(scriptOutput, L"==> %s <==\n", scriptName(script));
+        result->failed = runScript(script);
+        if (result->failed) {
+            fwprintf(scriptErrors, L"%s: stopped after an error\n", scriptName(script));
+        }
+    }
+    fclose(scriptOutput);
+    fclose(scriptErrors);
+
+    pthread_mutex_lock(&pool->doneLock);
+    result->done = 1;
+    pthread_cond_broadcast(&pool->doneSignal);
+    pthread_mutex_unlock(&pool->doneLock);
+}
+
+void *runWorker(void *argument) {
+    Worker *worker = argument;
+    Pool *pool = worker->pool;
+    for (;;) {
+        int index = takeScript(&pool->queues[worker->index]);
+        if (index >= 0) {
+            runBufferedScript(pool, index);
+        } else if (!stealScripts(pool, worker->index)) {
+            break;
+        }
+    }
+    freeSymbolTable(); // Releases this thread's temporary arenas
+    return NULL;
+}
+
+int runScriptsInParallel(Script *scripts, int count, int jobs) {
+    if (jobs > count) {
+        jobs = count;
+    }
+    Pool pool;
+    pool.scripts = scripts;
+    pool.results = calloc(count, sizeof(ScriptResult));
+    pool.queues = calloc(jobs, sizeof(WorkQueue));
+    pool.workerCount = jobs;
+    Worker *workers = calloc(jobs, sizeof(Worker));
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    if (!pool.results || !pool.queues || !workers || !threads) {
+        fwprintf(stderr, L"Failed to allocate memory for the worker pool\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&pool.doneLock, NULL);
+    pthread_cond_init(&pool.doneSignal, NULL);
+
+    // Each worker starts with a contiguous block of the scripts
+    for (int i = 0; i < jobs; i++) {
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+        pool.queues[i].next = (int)((int64_t)count * i / jobs);
+        pool.queues[i].end = (int)((int64_t)count * (i + 1) / jobs);
+    }
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, WORKER_STACK_SIZE);
+    for (int i = 0; i < jobs; i++) {
+        workers[i] = (Worker){&pool, i};
+        if (pthread_create(&threads[i], &attributes, runWorker, &workers[i]) != 0) {
+            fwprintf(stderr, L"Failed to start worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_attr_destroy(&attributes);
+
+    // Write out each script's buffers as soon as it and all before it are done
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        ScriptResult *result = &pool.results[i];
+        pthread_mutex_lock(&pool.doneLock);
+        while (!result->done) {
+            pthread_cond_wait(&pool.doneSignal, &pool.doneLock);
+        }
+        pthread_mutex_unlock(&pool.doneLock);
+
+        fputws(result->output, stdout);
+        fflush(stdout);
+        fputws(result->errors, stderr);
+        free(result->output);
+        free(result->errors);
+        failures += result->failed;
+    }
+
+    for (int i = 0; i < jobs; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < jobs; i++) {
+        pthread_mutex_destroy(&pool.queues[i].lock);
+    }
+    pthread_mutex_destroy(&pool.doneLock);
+    pthread_cond_destroy(&pool.doneSignal);
+    free(pool.results);
+    free(pool.queues);
+    free(workers);
+    free(threads);
+    return failures;
+}
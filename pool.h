@@ -0,0 +1,16 @@
+// pool.h
+#ifndef POOL_H
+#define POOL_H
+
+#include "script.h"
+
+// Workers get a deep stack for recursive scripts; the per-thread interpreter
+// state is carved out of it too.
+#define WORKER_STACK_SIZE (16 * 1024 * 1024)
+
+// Runs the scripts on a pool of worker threads. Each script prints into its
+// own buffers, which are written to stdout and stderr in the order the
+// scripts were given. Returns the number of scripts that failed.
+int runScriptsInParallel(Script *scripts, int count, int jobs);
+
+#endif // POOL_H
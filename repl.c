@@ -0,0 +1,164 @@
+#include "repl.h"
+#include "script.h"
+#include "lexer.h"
+#include "parser.h"
+#include "interpreter.h"
+#include "state.h"
+#include "budget.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wchar.h>
+
+// The session's token stream. Function bodies borrow names from earlier
+// inputs, so the tokens of entries that define functions are kept for the
+// whole session.
+int replTokenCount = 0;
+int replTokenCapacity = 0;
+Node *replStatement = NULL;
+
+// Frees the tokens of the last entry, from start, if no function kept them.
+// Every other node was freed once it ran, and globals own their names and
+// values, so a session that defines nothing more stays the same size.
+void dropEntryTokens(int start) {
+    for (int i = start; i < replTokenCount; i++) {
+        if (tokens[i].type == TOKEN_FUNCTION) {
+            return;
+        }
+    }
+    for (int i = start; i < replTokenCount; i++) {
+        if (tokens[i].type == TOKEN_VARIABLE || tokens[i].type == TOKEN_CHAR) {
+            free(tokens[i].varName);
+        }
+    }
+    tokens[start] = tokens[replTokenCount]; // The TOKEN_EOF
+    replTokenCount = start;
+}
+
+// An entry is complete once its braces and quotes are closed and it ends
+// with ';' or '}', so a function can be typed over several lines.
+int entryComplete(const char *entry) {
+    int depth = 0;
+    int inString = 0;
+    char last = '\0';
+    for (const char *c = entry; *c; c++) {
+        if (*c == '"') {
+            inString = !inString;
+        } else if (!inString && *c == '{') {
+            depth++;
+        } else if (!inString && *c == '}') {
+            depth--;
+        }
+        if (*c != ' ' && *c != '\t' && *c != '\r' && *c != '\n') {
+            last = *c;
+        }
+    }
+    return !inString && depth <= 0 && (last == ';' || last == '}' || last == '\0');
+}
+
+// Reads lines until the entry is complete. Returns NULL at the end of input.
+char *readEntry(int interactive) {
+    size_t capacity = 256;
+    size_t length = 0;
+    char *entry = malloc(capacity);
+    if (!entry) {
+        fwprintf(stderr, L"Failed to allocate memory for input\n");
+        exit(EXIT_FAILURE);
+    }
+    entry[0] = '\0';
+    for (;;) {
+        if (interactive && (length == 0 || entry[length - 1] == '\n')) {
+            fwprintf(stdout, length ? L"... " : L">>> ");
+            fflush(stdout);
+        }
+        if (length + 1 >= capacity) {
+            capacity *= 2;
+            char *grown = realloc(entry, capacity);
+            if (!grown) {
+                fwprintf(stderr, L"Failed to allocate memory for input\n");
+                exit(EXIT_FAILURE);
+            }
+            entry = grown;
+        }
+        if (!fgets(entry + length, capacity - length, stdin)) {
+            if (length) {
+                return entry; // Run what was typed before the input ended
+            }
+            free(entry);
+            return NULL;
+        }
+        length += strlen(entry + length);
+        // A line longer than the buffer arrives in several pieces
+        if ((length > 0 && entry[length - 1] == '\n') || feof(stdin)) {
+            if (entryComplete(entry)) {
+                return entry;
+            }
+        }
+    }
+}
+
+int runRepl(void) {
+    int interactive = isatty(STDIN_FILENO);
+    char *entry;
+    resetMemoryCounts();
+    scriptRunning = 1;
+    if (setjmp(scriptRecovery) == 0) {
+        restoreState(); // The session starts from --load-state's globals
+    }
+    scriptRunning = 0;
+    while ((entry = readEntry(interactive))) {
+        size_t length = mbstowcs(NULL, entry, 0);
+        wchar_t *input = length == (size_t)-1 ? NULL : malloc((length + 1) * sizeof(wchar_t));
+        if (!input) {
+            fwprintf(stderr, L"Error reading input: not valid text in the current locale\n");
+            free(entry);
+            continue;
+        }
+        mbstowcs(input, entry, length + 1);
+        free(entry);
+
+        // Only the new entry is lexed and parsed
+        int start = replTokenCount;
+        startBudget(); // Each entry gets the whole step and time limit
+        scriptRunning = 1;
+        if (setjmp(scriptRecovery) == 0) {
+            tokens = tokenizeMore(tokens, &replTokenCount, &replTokenCapacity, input);
+            resumeParser(start);
+            while ((replStatement = parseTopLevelStatement())) {
+                runStatement(replStatement);
+                freeNode(replStatement);
+                replStatement = NULL;
+            }
+        } else {
+            freeNode(replStatement);
+            replStatement = NULL;
+            discardParsedNodes();
+            unwindFrames();
+            if (tokens) {
+                resumeParser(replTokenCount); // Skip what is left of the entry
+            }
+        }
+        scriptRunning = 0;
+        if (tokens) {
+            dropEntryTokens(start);
+        }
+        free(input);
+        fflush(stdout);
+    }
+    if (interactive) {
+        fwprintf(stdout, L"\n");
+    }
+    if (memoryStats) {
+        printMemoryStats(stderr, "-i");
+    }
+
+    resetInterpreter();
+    if (tokens) {
+        freeTokens(tokens);
+        tokens = NULL;
+    }
+    replTokenCount = 0;
+    replTokenCapacity = 0;
+    return 0;
+}
@@ -0,0 +1,11 @@
+// repl.h
+#ifndef REPL_H
+#define REPL_H
+
+// Reads statements from standard input and runs each one as soon as it is
+// complete. Variables and functions stay defined for the whole session, and
+// an error only discards the input it occurred in. Returns when the input
+// ends.
+int runRepl(void);
+
+#endif // REPL_H
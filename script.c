@@ -0,0 +1,236 @@
+#include "script.h"
+#include "lexer.h"
+#include "parser.h"
+#include "interpreter.h"
+#include "cache.h"
+#include "parlex.h"
+#include "checker.h"
+#include "diagnostic.h"
+#include "budget.h"
+#include "state.h"
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+_Thread_local Token *tokens;
+_Thread_local wchar_t *tokenStrings = NULL;
+int useTokenCache = 1;
+int checkOnly = 0;
+_Thread_local FILE *scriptOutput;
+_Thread_local FILE *scriptErrors;
+
+// State of the running script. It lives outside runScript so that it is still
+// valid after abortScript jumps back there.
+_Thread_local jmp_buf scriptRecovery;
+_Thread_local int scriptRunning = 0;
+_Thread_local wchar_t *scriptInput = NULL;
+_Thread_local CacheImage scriptCache = {0};
+_Thread_local Node *runningStatement = NULL;
+_Thread_local DiagnosticList scriptDiagnostics = {0};
+
+_Noreturn void abortScript(void) {
+    if (scriptRunning) {
+        longjmp(scriptRecovery, 1);
+    }
+    exit(EXIT_FAILURE);
+}
+
+const char *scriptName(Script script) {
+    switch (script.kind) {
+        case SCRIPT_STDIN:
+            return "-";
+        case SCRIPT_INLINE:
+            return "-e";
+        default:
+            return script.text;
+    }
+}
+
+// Reads a whole stream. Pipes cannot be measured with fseek, so the buffer
+// grows as it fills.
+char *readStream(FILE *file, size_t *length) {
+    size_t capacity = 4096;
+    size_t size = 0;
+    char *bytes = malloc(capacity);
+    while (bytes) {
+        size += fread(bytes + size, 1, capacity - size - 1, file);
+        if (size < capacity - 1) {
+            break;
+        }
+        capacity *= 2;
+        char *grown = realloc(bytes, capacity);
+        if (!grown) {
+            free(bytes);
+        }
+        bytes = grown;
+    }
+    if (!bytes) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for file content\n");
+        return NULL;
+    }
+    bytes[size] = '\0';
+    *length = size;
+    return bytes;
+}
+
+char *readScript(Script script, size_t *length) {
+    if (script.kind == SCRIPT_INLINE) {
+        *length = strlen(script.text);
+        return strdup(script.text);
+    }
+    if (script.kind == SCRIPT_STDIN) {
+        return readStream(stdin, length);
+    }
+    FILE *file = fopen(script.text, "rb");
+    if (!file) {
+        fwprintf(scriptErrors, L"Error opening %s: %s\n", script.text, strerror(errno));
+        return NULL;
+    }
+    char *bytes = readStream(file, length);
+    fclose(file);
+    return bytes;
+}
+
+wchar_t *decodeScript(const char *bytes, const char *name) {
+    size_t length = mbstowcs(NULL, bytes, 0);
+    if (length == (size_t)-1) {
+        fwprintf(scriptErrors, L"Error reading %s: not valid text in the current locale\n", name);
+        abortScript();
+    }
+    wchar_t *input = malloc((length + 1) * sizeof(wchar_t));
+    if (!input) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for file content\n");
+        abortScript();
+    }
+    mbstowcs(input, bytes, length + 1);
+    return input;
+}
+
+int runScript(Script script) {
+    const char *name = scriptName(script);
+    size_t length;
+    char *bytes = readScript(script, &length);
+    if (!bytes) {
+        return 1;
+    }
+
+    // Only scripts read from a path have somewhere to keep a cache
+    char *cachePath = NULL;
+    uint64_t sourceHash = 0;
+    tokens = NULL;
+    if (script.kind == SCRIPT_FILE && useTokenCache && !verifyLexer) {
+        cachePath = malloc(strlen(script.text) + sizeof(".hbc"));
+        if (cachePath) {
+            sprintf(cachePath, "%s.hbc", script.text);
+            sourceHash = hashSource(bytes, length);
+            tokens = loadTokenCache(cachePath, sourceHash, &scriptCache);
+            tokenStrings = scriptCache.strings;
+        }
+    }
+
+    int failed = 0;
+    resetParser();
+    resetMemoryCounts(); // The last script's values have all been freed
+    startBudget();
+    scriptRunning = 1;
+    if (setjmp(scriptRecovery) == 0) {
+        scriptInput = tokens ? NULL : decodeScript(bytes, name);
+        if (verifyLexer) {
+            failed = checkParallelLexer(scriptInput);
+        } else {
+            if (!tokens) {
+                tokens = tokenizeParallel(scriptInput, lexerThreadCount, PARALLEL_LEX_MIN_LENGTH);
+                if (cachePath && lexerErrorCount == 0) {
+                    writeTokenCache(cachePath, sourceHash, tokens);
+                }
+            }
+
+            // Compile and run one top-level statement at a time
+            restoreState();
+            while ((runningStatement = parseTopLevelStatement())) {
+                runStatement(runningStatement);
+                freeNode(runningStatement);
+                runningStatement = NULL;
+            }
+            if (saveStatePath && !saveState(saveStatePath)) {
+                failed = 1;
+            }
+        }
+    } else {
+        // An error stopped the script, while running a statement or while
+        // parsing one
+        failed = 1;
+        freeNode(runningStatement);
+        runningStatement = NULL;
+        discardParsedNodes();
+    }
+    scriptRunning = 0;
+
+    if (memoryStats) {
+        printMemoryStats(scriptErrors, name); // What the script's globals still hold
+    }
+    resetInterpreter();
+    if (scriptCache.base) {
+        releaseTokenCache(&scriptCache);
+        tokenStrings = NULL;
+    } else if (tokens) {
+        freeTokens(tokens);
+    }
+    tokens = NULL;
+    free(scriptInput);
+    scriptInput = NULL;
+    free(cachePath);
+    free(bytes);
+    return failed;
+}
+
+int checkScript(Script script) {
+    const char *name = scriptName(script);
+    size_t length;
+    char *bytes = readScript(script, &length);
+    if (!bytes) {
+        return 1;
+    }
+
+    int failed = 0;
+    tokens = NULL;
+    resetParser();
+    scriptRunning = 1;
+    diagnosticList = &scriptDiagnostics;
+    skippedAssignment = skipAssignment;
+    if (setjmp(scriptRecovery) == 0) {
+        scriptInput = decodeScript(bytes, name);
+        tokens = tokenize(scriptInput);
+        checkStateGlobals();
+        // Statements are checked as they are parsed, so each one sees the
+        // globals and functions defined before it, as it would when running
+        collectParseErrors(checkStatement);
+        checkFunctions();
+    } else {
+        // The script could not be decoded, or memory ran out
+        failed = 1;
+    }
+    scriptRunning = 0;
+    diagnosticList = NULL;
+    skippedAssignment = NULL;
+
+    if (scriptDiagnostics.count > 0) {
+        failed = 1;
+        sortDiagnostics(&scriptDiagnostics);
+        printDiagnostics(scriptErrors, name, scriptInput, &scriptDiagnostics);
+    }
+    clearDiagnostics(&scriptDiagnostics);
+    clearChecker();
+    resetInterpreter();
+    if (tokens) {
+        freeTokens(tokens);
+    }
+    tokens = NULL;
+    free(scriptInput);
+    scriptInput = NULL;
+    free(bytes);
+    return failed;
+}
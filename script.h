@@ -0,0 +1,49 @@
+// script.h
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <setjmp.h>
+
+typedef enum {
+    SCRIPT_FILE,    // text is a path
+    SCRIPT_STDIN,   // text is unused
+    SCRIPT_INLINE   // text is the code itself (-e)
+} ScriptKind;
+
+typedef struct {
+    ScriptKind kind;
+    const char *text;
+} Script;
+
+extern int useTokenCache; // Cleared by --no-cache
+extern int checkOnly;     // Set by --check
+
+// Where the running script prints its output and its error messages. main
+// points them at stdout and stderr; batch workers give every script its own
+// buffers.
+extern _Thread_local FILE *scriptOutput;
+extern _Thread_local FILE *scriptErrors;
+
+// Lexes, parses and runs one script, then clears the interpreter for the next
+// one. Returns 0 on success and 1 if the script could not be read or stopped
+// with an error.
+int runScript(Script script);
+
+// Lexes, parses and checks one script without running it or writing its
+// cache, and prints every error found to scriptErrors with its line and
+// column. Returns 0 if there were none.
+int checkScript(Script script);
+const char *scriptName(Script script);
+char *readStream(FILE *file, size_t *length);
+
+// Stops the running script after an error has been reported. Outside of
+// runScript this exits the process.
+_Noreturn void abortScript(void);
+
+// Where abortScript jumps to on this thread while scriptRunning is set
+extern _Thread_local jmp_buf scriptRecovery;
+extern _Thread_local int scriptRunning;
+
+#endif // SCRIPT_H
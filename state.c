@@ -0,0 +1,507 @@
+#include "state.h"
+#include "interpreter.h"
+#include "map.h"
+#include "checker.h"
+#include "script.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char *saveStatePath = NULL;
+
+// The loaded snapshot. It is only read once mapped, so batch workers share it.
+char *stateBase = NULL;
+size_t stateSize = 0;
+
+// Where each array or map written so far went, so shared ones are written once
+typedef struct {
+    void *container;
+    uint64_t index;
+} SavedArray;
+
+typedef struct {
+    StateValue *values;
+    size_t valueCount;
+    size_t valueCapacity;
+    StateArray *arrays;
+    size_t arrayCount;
+    size_t arrayCapacity;
+    uint64_t *words;
+    size_t wordCount;
+    size_t wordCapacity;
+    SavedArray *saved;     // Open-addressed by array address
+    size_t savedSlots;
+    InternTable strings;
+} StateWriter;
+
+// Makes room for count more items of size itemSize
+void *growState(void *items, size_t *capacity, size_t needed, size_t itemSize) {
+    if (needed <= *capacity) {
+        return items;
+    }
+    size_t grown = *capacity ? *capacity * 2 : 64;
+    while (grown < needed) {
+        grown *= 2;
+    }
+    items = realloc(items, grown * itemSize);
+    if (!items) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for state snapshot\n");
+        abortScript();
+    }
+    *capacity = grown;
+    return items;
+}
+
+// Returns the index of the first of count new values
+size_t reserveValues(StateWriter *writer, size_t count) {
+    writer->values = growState(writer->values, &writer->valueCapacity, writer->valueCount + count,
+                               sizeof(StateValue));
+    size_t first = writer->valueCount;
+    writer->valueCount += count;
+    return first;
+}
+
+size_t savedSlot(SavedArray *saved, size_t slotCount, void *container) {
+    size_t slot = ((uintptr_t)container / sizeof(Array)) & (slotCount - 1);
+    while (saved[slot].container && saved[slot].container != container) {
+        slot = (slot + 1) & (slotCount - 1);
+    }
+    return slot;
+}
+
+void growSavedArrays(StateWriter *writer) {
+    size_t slotCount = writer->savedSlots ? writer->savedSlots * 2 : 64;
+    SavedArray *saved = calloc(slotCount, sizeof(SavedArray));
+    if (!saved) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for state snapshot\n");
+        abortScript();
+    }
+    for (size_t i = 0; i < writer->savedSlots; i++) {
+        if (writer->saved[i].container) {
+            saved[savedSlot(saved, slotCount, writer->saved[i].container)] = writer->saved[i];
+        }
+    }
+    free(writer->saved);
+    writer->saved = saved;
+    writer->savedSlots = slotCount;
+}
+
+void saveValue(StateWriter *writer, size_t index, Value value);
+
+// Sets *index to where the array or map goes. Returns 1 the first time, when
+// the caller must write it.
+int reserveArray(StateWriter *writer, void *container, uint64_t *index) {
+    if ((writer->arrayCount + 1) * 2 > writer->savedSlots) {
+        growSavedArrays(writer);
+    }
+    size_t slot = savedSlot(writer->saved, writer->savedSlots, container);
+    if (writer->saved[slot].container) {
+        *index = writer->saved[slot].index;
+        return 0;
+    }
+    *index = writer->arrayCount++;
+    writer->saved[slot] = (SavedArray){container, *index};
+    writer->arrays = growState(writer->arrays, &writer->arrayCapacity, writer->arrayCount, sizeof(StateArray));
+    return 1;
+}
+
+// Returns the index of the array, writing it and its elements the first time
+uint64_t saveArray(StateWriter *writer, Array *array) {
+    uint64_t index;
+    if (!reserveArray(writer, array, &index)) {
+        return index;
+    }
+
+    StateArray record = {0};
+    record.kind = array->kind;
+    record.length = (uint64_t)array->length;
+    if (array->kind == ARRAY_BOXED) {
+        record.first = reserveValues(writer, array->length);
+        writer->arrays[index] = record;
+        for (int64_t i = 0; i < array->length; i++) {
+            saveValue(writer, record.first + i, array->values[i]);
+        }
+    } else {
+        writer->words = growState(writer->words, &writer->wordCapacity, writer->wordCount + array->length,
+                                  sizeof(uint64_t));
+        record.first = writer->wordCount;
+        memcpy(writer->words + record.first, array->ints, array->length * sizeof(uint64_t));
+        writer->wordCount += array->length;
+        writer->arrays[index] = record;
+    }
+    return index;
+}
+
+uint64_t saveMap(StateWriter *writer, Map *map) {
+    uint64_t index;
+    if (!reserveArray(writer, map, &index)) {
+        return index;
+    }
+    StateArray record = {0};
+    record.kind = STATE_MAP;
+    record.length = (uint64_t)map->count;
+    record.first = reserveValues(writer, map->count * 2);
+    writer->arrays[index] = record;
+    size_t next = record.first;
+    for (int64_t i = 0; i < map->entryCount; i++) {
+        if (valueType(map->entries[i].key) != TYPE_ERROR) {
+            saveValue(writer, next++, map->entries[i].key);
+            saveValue(writer, next++, map->entries[i].value);
+        }
+    }
+    return index;
+}
+
+void saveValue(StateWriter *writer, size_t index, Value value) {
+    StateValue record = {0};
+    record.type = valueType(value);
+    switch (record.type) {
+        case TYPE_INT:
+            record.bits = (uint64_t)valueAsInt(value);
+            break;
+        case TYPE_DOUBLE:
+            record.bits = value;
+            break;
+        case TYPE_CHAR:
+            record.bits = internString(&writer->strings, valueAsString(value)) * sizeof(wchar_t);
+            break;
+        case TYPE_ARRAY:
+            record.bits = saveArray(writer, valueAsArray(value));
+            break;
+        case TYPE_MAP:
+            record.bits = saveMap(writer, valueAsMap(value));
+            break;
+        default:
+            break;
+    }
+    writer->values[index] = record; // Saving an array may have moved the values
+}
+
+int saveState(const char *path) {
+    if (functionCount > 0) {
+        fwprintf(scriptErrors, L"Cannot save state to %s: functions are not saved, and %ls is defined\n", path,
+                 functions[0].name);
+        return 0;
+    }
+
+    StateWriter writer = {0};
+    uint64_t names[MAX_SYMBOLS];
+    reserveValues(&writer, symbolCount);
+    for (int i = 0; i < symbolCount; i++) {
+        names[i] = internString(&writer.strings, symbolTable[i].name) * sizeof(wchar_t);
+        saveValue(&writer, i, symbolTable[i].value);
+    }
+
+    StateHeader header = {0};
+    memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+    header.version = STATE_VERSION;
+    header.wcharSize = sizeof(wchar_t);
+    header.symbolCount = symbolCount;
+    header.valueCount = writer.valueCount;
+    header.arrayCount = writer.arrayCount;
+    header.wordCount = writer.wordCount;
+    header.stringsSize = writer.strings.length * sizeof(wchar_t);
+
+    // Written beside the snapshot and renamed over it, as the token cache is
+    size_t pathLength = strlen(path);
+    char *temporaryPath = malloc(pathLength + sizeof(".XXXXXX"));
+    int written = 0;
+    if (temporaryPath) {
+        sprintf(temporaryPath, "%s.XXXXXX", path);
+        int descriptor = mkstemp(temporaryPath);
+        FILE *file = descriptor >= 0 ? fdopen(descriptor, "wb") : NULL;
+        if (file) {
+            written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                      writeRecords(writer.values, sizeof(StateValue), writer.valueCount, file) &&
+                      writeRecords(writer.arrays, sizeof(StateArray), writer.arrayCount, file) &&
+                      writeRecords(names, sizeof(uint64_t), symbolCount, file) &&
+                      writeRecords(writer.words, sizeof(uint64_t), writer.wordCount, file) &&
+                      writeRecords(writer.strings.data, sizeof(wchar_t), writer.strings.length, file);
+            written = fclose(file) == 0 && written;
+            if (written) {
+                written = rename(temporaryPath, path) == 0;
+            }
+        } else if (descriptor >= 0) {
+            close(descriptor);
+        }
+        if (descriptor >= 0 && !written) {
+            remove(temporaryPath);
+        }
+        free(temporaryPath);
+    }
+    if (!written) {
+        fwprintf(scriptErrors, L"Cannot save state to %s\n", path);
+    }
+
+    free(writer.values);
+    free(writer.arrays);
+    free(writer.words);
+    free(writer.saved);
+    free(writer.strings.data);
+    free(writer.strings.slots);
+    return written;
+}
+
+// The sections of the mapped snapshot
+StateHeader *stateHeader(void) {
+    return (StateHeader *)stateBase;
+}
+
+StateValue *stateValues(void) {
+    return (StateValue *)(stateBase + sizeof(StateHeader));
+}
+
+StateArray *stateArrays(void) {
+    return (StateArray *)(stateValues() + stateHeader()->valueCount);
+}
+
+uint64_t *stateNames(void) {
+    return (uint64_t *)(stateArrays() + stateHeader()->arrayCount);
+}
+
+uint64_t *stateWords(void) {
+    return stateNames() + stateHeader()->symbolCount;
+}
+
+wchar_t *stateStrings(void) {
+    return (wchar_t *)(stateWords() + stateHeader()->wordCount);
+}
+
+int stateStringValid(uint64_t offset, size_t stringsLength) {
+    return offset % sizeof(wchar_t) == 0 && offset / sizeof(wchar_t) < stringsLength;
+}
+
+// The index of the array or map that the value at position refers to, or -1.
+// Positions count over the values of a boxed array, or the keys and values
+// of a map, whose keys are never containers.
+int64_t stateChild(StateArray *container, uint64_t position) {
+    StateValue *value = &stateValues()[container->first + position];
+    return value->type == TYPE_ARRAY || value->type == TYPE_MAP ? (int64_t)value->bits : -1;
+}
+
+// Whether an array or map of the snapshot holds itself at some depth. Stores
+// refuse to make such a cycle, but a damaged file can have one, and restoring
+// it would leak on every run. The depth-first search keeps its own stack,
+// since the file sets how deep the containers nest.
+int stateHasCycle(void) {
+    StateHeader *header = stateHeader();
+    uint64_t count = header->arrayCount;
+    unsigned char *visited = calloc(count + 1, 1); // 1 while on the stack, 2 once searched
+    uint64_t *stack = malloc((count + 1) * sizeof(uint64_t));
+    uint64_t *positions = malloc((count + 1) * sizeof(uint64_t)); // The next child of each on the stack
+    int cycle = !visited || !stack || !positions; // Without memory, refuse the file
+    for (uint64_t root = 0; root < count && !cycle; root++) {
+        if (visited[root]) {
+            continue;
+        }
+        uint64_t depth = 0;
+        stack[depth] = root;
+        positions[depth++] = 0;
+        visited[root] = 1;
+        while (depth > 0 && !cycle) {
+            StateArray *container = &stateArrays()[stack[depth - 1]];
+            uint64_t length = container->kind == STATE_MAP ? container->length * 2
+                            : container->kind == ARRAY_BOXED ? container->length : 0;
+            if (positions[depth - 1] == length) {
+                visited[stack[--depth]] = 2;
+                continue;
+            }
+            int64_t child = stateChild(container, positions[depth - 1]++);
+            if (child < 0 || visited[child] == 2) {
+                continue;
+            }
+            if (visited[child] == 1) {
+                cycle = 1;
+                continue;
+            }
+            visited[child] = 1;
+            stack[depth] = (uint64_t)child;
+            positions[depth++] = 0;
+        }
+    }
+    free(visited);
+    free(stack);
+    free(positions);
+    return cycle;
+}
+
+// Checks every count, offset and index, so restoring can trust them
+int stateValid(size_t size) {
+    StateHeader *header = stateHeader();
+    if (size < sizeof(StateHeader) || memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != STATE_VERSION || header->wcharSize != sizeof(wchar_t) ||
+        header->symbolCount > MAX_SYMBOLS || header->symbolCount > header->valueCount ||
+        header->valueCount > size / sizeof(StateValue) || header->arrayCount > size / sizeof(StateArray) ||
+        header->wordCount > size / sizeof(uint64_t) || header->stringsSize > size ||
+        header->stringsSize % sizeof(wchar_t) != 0) {
+        return 0;
+    }
+    size_t expected = sizeof(StateHeader) + header->valueCount * sizeof(StateValue) +
+                      header->arrayCount * sizeof(StateArray) +
+                      (header->symbolCount + header->wordCount) * sizeof(uint64_t) + header->stringsSize;
+    if (expected != size) {
+        return 0;
+    }
+
+    size_t stringsLength = header->stringsSize / sizeof(wchar_t);
+    if (stringsLength > 0 && stateStrings()[stringsLength - 1] != L'\0') {
+        return 0; // Every string must end inside the table
+    }
+    for (uint64_t i = 0; i < header->symbolCount; i++) {
+        if (!stateStringValid(stateNames()[i], stringsLength)) {
+            return 0;
+        }
+    }
+    for (uint64_t i = 0; i < header->valueCount; i++) {
+        StateValue *value = &stateValues()[i];
+        if (value->type > TYPE_ERROR ||
+            (value->type == TYPE_CHAR && !stateStringValid(value->bits, stringsLength))) {
+            return 0;
+        }
+        if (value->type == TYPE_ARRAY || value->type == TYPE_MAP) {
+            if (value->bits >= header->arrayCount ||
+                (stateArrays()[value->bits].kind == STATE_MAP) != (value->type == TYPE_MAP)) {
+                return 0;
+            }
+        }
+    }
+    for (uint64_t i = 0; i < header->arrayCount; i++) {
+        StateArray *array = &stateArrays()[i];
+        uint64_t available = array->kind >= ARRAY_BOXED ? header->valueCount : header->wordCount;
+        uint64_t length = array->kind == STATE_MAP ? array->length * 2 : array->length;
+        if (array->kind > STATE_MAP || array->length > available || array->first > available ||
+            length > available - array->first) {
+            return 0;
+        }
+        for (uint64_t j = 0; array->kind == STATE_MAP && j < array->length; j++) {
+            uint32_t keyType = stateValues()[array->first + 2 * j].type;
+            if (keyType != TYPE_INT && keyType != TYPE_CHAR) {
+                return 0;
+            }
+        }
+    }
+    return !stateHasCycle();
+}
+
+int loadState(const char *path) {
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return 0;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size <= 0) {
+        close(descriptor);
+        return 0;
+    }
+    size_t size = (size_t)status.st_size;
+    char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (base == MAP_FAILED) {
+        return 0;
+    }
+    releaseState();
+    stateBase = base;
+    stateSize = size;
+    if (!stateValid(size)) {
+        releaseState();
+        return 0;
+    }
+    return 1;
+}
+
+void releaseState(void) {
+    if (stateBase) {
+        munmap(stateBase, stateSize);
+        stateBase = NULL;
+        stateSize = 0;
+    }
+}
+
+// The value a record stands for, borrowing its string from the snapshot
+Value stateValue(StateValue *record, void **containers) {
+    switch (record->type) {
+        case TYPE_INT:
+            return valueFromInt((int64_t)record->bits);
+        case TYPE_DOUBLE:
+            return valueFromDouble(valueAsDouble(record->bits));
+        case TYPE_CHAR:
+            return valueFromString(stateStrings() + record->bits / sizeof(wchar_t));
+        case TYPE_ARRAY:
+            return valueFromArray(containers[record->bits]);
+        case TYPE_MAP:
+            return valueFromMap(containers[record->bits]);
+        default:
+            return valueError();
+    }
+}
+
+void restoreState(void) {
+    if (!stateBase) {
+        return;
+    }
+    StateHeader *header = stateHeader();
+
+    // Every array and map is made before any is filled, since they may refer
+    // to each other. Each one holds a reference of its own until the globals
+    // hold theirs.
+    void **containers = malloc((header->arrayCount + 1) * sizeof(void *));
+    if (!containers) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for state snapshot\n");
+        abortScript();
+    }
+    for (uint64_t i = 0; i < header->arrayCount; i++) {
+        StateArray *record = &stateArrays()[i];
+        if (record->kind == STATE_MAP) {
+            containers[i] = newMap();
+            continue;
+        }
+        Array *array = newArrayOfKind(record->kind, record->length);
+        if (record->kind == ARRAY_BOXED) {
+            for (uint64_t j = 0; j < record->length; j++) {
+                array->values[j] = valueError(); // Nothing to free if filling stops
+            }
+        }
+        containers[i] = array;
+    }
+    for (uint64_t i = 0; i < header->arrayCount; i++) {
+        StateArray *record = &stateArrays()[i];
+        StateValue *values = &stateValues()[record->first];
+        if (record->kind == STATE_MAP) {
+            for (uint64_t j = 0; j < record->length; j++) {
+                mapSet(containers[i], stateValue(&values[2 * j], containers),
+                       stateValue(&values[2 * j + 1], containers));
+            }
+        } else if (record->kind == ARRAY_BOXED) {
+            Array *array = containers[i];
+            for (uint64_t j = 0; j < record->length; j++) {
+                array->values[j] = valueCopy(stateValue(&values[j], containers));
+            }
+        } else {
+            memcpy(((Array *)containers[i])->ints, stateWords() + record->first, record->length * sizeof(uint64_t));
+        }
+    }
+    for (uint64_t i = 0; i < header->symbolCount; i++) {
+        addSymbol(stateStrings() + stateNames()[i] / sizeof(wchar_t), stateValue(&stateValues()[i], containers));
+    }
+    for (uint64_t i = 0; i < header->arrayCount; i++) {
+        if (stateArrays()[i].kind == STATE_MAP) {
+            mapRelease(containers[i]);
+        } else {
+            arrayRelease(containers[i]);
+        }
+    }
+    free(containers);
+}
+
+void checkStateGlobals(void) {
+    if (!stateBase) {
+        return;
+    }
+    for (uint64_t i = 0; i < stateHeader()->symbolCount; i++) {
+        setCheckedGlobal(stateStrings() + stateNames()[i] / sizeof(wchar_t), TYPE_BIT(stateValues()[i].type));
+    }
+}
@@ -0,0 +1,72 @@
+// state.h
+#ifndef STATE_H
+#define STATE_H
+
+#include <stdint.h>
+
+// A snapshot of the global variables left by a script, written by
+// --save-state and restored by --load-state before each script runs, so a
+// shared prelude of constants and string tables is executed once. The file
+// holds a header, the values of the globals and of the elements of their
+// arrays and maps, the arrays and maps, and an interned string table for
+// names and strings. Everything refers to everything else by index or
+// offset, so the file can be mapped anywhere and is read in place. Functions
+// are not saved.
+#define STATE_MAGIC "HBBSTATE"
+#define STATE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t wcharSize;    // sizeof(wchar_t) of the writer
+    uint64_t symbolCount;  // The first symbolCount values are the globals'
+    uint64_t valueCount;
+    uint64_t arrayCount;
+    uint64_t wordCount;    // Elements of integer and double arrays
+    uint64_t stringsSize;  // Size of the string table in bytes
+} StateHeader;
+
+// A value; bits holds the integer, the double's bits, the byte offset of a
+// string in the string table or the index of an array or map
+typedef struct {
+    uint32_t type;         // ValueType
+    uint32_t reserved;
+    uint64_t bits;
+} StateValue;
+
+// An array or map; its elements start at first in the words for ARRAY_INT
+// and ARRAY_DOUBLE, and in the values for ARRAY_BOXED. A map's entries are
+// 2 * length values, each key followed by its value. Globals and elements
+// that share an array or map refer to one entry.
+#define STATE_MAP 3
+
+typedef struct {
+    uint32_t kind;         // ArrayKind, or STATE_MAP
+    uint32_t reserved;
+    uint64_t length;
+    uint64_t first;
+} StateArray;
+
+// After the header come StateValue[valueCount], StateArray[arrayCount], the
+// byte offsets of the globals' names as uint64_t[symbolCount],
+// uint64_t[wordCount] and the strings.
+
+extern const char *saveStatePath; // Set by --save-state
+
+// Writes the running script's globals to path. Reports why and returns 0 if
+// it could not.
+int saveState(const char *path);
+
+// Maps a snapshot for every later script to start from. Returns 0 if the file
+// is missing or is not a snapshot this build can read.
+int loadState(const char *path);
+void releaseState(void);
+
+// Gives the running script the loaded snapshot's globals; does nothing if no
+// snapshot is loaded
+void restoreState(void);
+
+// Tells the checker about the snapshot's globals and their types
+void checkStateGlobals(void);
+
+#endif // STATE_H
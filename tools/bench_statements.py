@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+# Writes the straight-line scripts the fused statements are measured with, and
+# times builds of the interpreter on them:
+#
+#     python3 tools/bench_statements.py DIR [BINARY...]
+#
+# The scripts are the statements of source_code.txt scaled up: assignments of
+# a variable and a number, compound assignments by a number, and prints of a
+# variable, all on eight globals.
+#
+#     function.txt        300 statements in a function called 30000 times
+#     function_quiet.txt  the same with every print replaced by x -= 1
+#     top_level.txt       1000000 top-level statements run once
+#
+# Each binary runs each script with --no-cache and stdout discarded, once with
+# wrapping arithmetic and once with --checked, since fused statements check
+# for overflow on their own paths. The best of seven runs of each is printed.
+# To compare fused with unfused statements, pass a binary built each way.
+import os
+import subprocess
+import sys
+import time
+
+NAMES = ["ا", "ب", "ج", "د", "ه", "و", "ز", "ح"]
+RUNS = 7
+MODES = [[], ["--checked"]]
+
+
+# The n-th group of eight statements
+def group(n, quiet):
+    def show(name):
+        return f"{name} -= 1;" if quiet else f"طباعة({name});"
+    return [
+        f"ا = ب + {n % 7 + 1};",
+        f"ب += {(1 + 3 * n) % 5 + 1};",
+        "ج = ح * 1;",
+        show("د"),
+        f"ه = و + {(n + 4) % 7 + 1};",
+        f"و += {3 * n % 5 + 1};",
+        "ز = د * 1;",
+        show("ح"),
+    ]
+
+
+def statements(count, quiet=False):
+    lines = []
+    n = 0
+    while len(lines) < count:
+        lines.extend(group(n, quiet))
+        n += 1
+    return lines[:count]
+
+
+def globals_():
+    return [f"{name} = {i};" for i, name in enumerate(NAMES)]
+
+
+def function_script(quiet):
+    body = ["    " + line for line in statements(300, quiet) + ["ارجع 0;"]]
+    calls = ["عمل();"] * 30000
+    return globals_() + ["دالة عمل() {"] + body + ["}"] + calls
+
+
+def write_scripts(directory):
+    scripts = {
+        "function.txt": function_script(False),
+        "function_quiet.txt": function_script(True),
+        "top_level.txt": globals_() + statements(1000000),
+    }
+    paths = []
+    for name, lines in scripts.items():
+        path = os.path.join(directory, name)
+        with open(path, "w", encoding="utf-8") as file:
+            file.write("\n".join(lines) + "\n")
+        paths.append(path)
+    return paths
+
+
+def best_time(binary, mode, path):
+    environment = dict(os.environ, LC_ALL="C.UTF-8")
+    best = None
+    for _ in range(RUNS):
+        start = time.perf_counter()
+        subprocess.run([binary, "--no-cache"] + mode + [path], stdout=subprocess.DEVNULL, env=environment,
+                       check=False)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(f"usage: {sys.argv[0]} DIR [BINARY...]")
+    os.makedirs(sys.argv[1], exist_ok=True)
+    paths = write_scripts(sys.argv[1])
+    for path in paths:
+        for binary in sys.argv[2:]:
+            for mode in MODES:
+                label = " ".join([binary] + mode)
+                print(f"{os.path.basename(path):20} {label:30} {best_time(binary, mode, path):.3f} s")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+# Generates charclass.c, the lexer's character class tables:
+#
+#     python3 tools/charclass.py > charclass.c
+#
+# Names are made of the letters of the Arabic blocks, with their combining
+# marks, digits, '_' and the joiners after the first character. Digits are the
+# ASCII, Arabic-Indic and Eastern Arabic-Indic ones. Spaces are the Unicode
+# White_Space characters plus the invisible marks that editors put in Arabic
+# text: the byte order mark and the bidirectional controls.
+import sys
+import unicodedata
+
+NAME_START = 0x01
+NAME = 0x02
+DIGIT = 0x04
+SPACE = 0x08
+DIGIT_SHIFT = 4
+
+BLOCK_BITS = 7
+BLOCK_SIZE = 1 << BLOCK_BITS
+LIMIT = 0x10000  # Everything above is class 0
+
+ARABIC_BLOCKS = [
+    (0x0600, 0x06FF),  # Arabic
+    (0x0750, 0x077F),  # Arabic Supplement
+    (0x0870, 0x089F),  # Arabic Extended-B
+    (0x08A0, 0x08FF),  # Arabic Extended-A
+    (0xFB50, 0xFDFF),  # Arabic Presentation Forms-A
+    (0xFE70, 0xFEFF),  # Arabic Presentation Forms-B
+]
+
+DIGIT_ZEROS = [0x0030, 0x0660, 0x06F0]
+
+WHITE_SPACE = [
+    (0x0009, 0x000D), (0x0020, 0x0020), (0x0085, 0x0085), (0x00A0, 0x00A0),
+    (0x1680, 0x1680), (0x2000, 0x200A), (0x2028, 0x2029), (0x202F, 0x202F),
+    (0x205F, 0x205F), (0x3000, 0x3000),
+]
+
+IGNORED = [
+    (0x061C, 0x061C),  # Arabic letter mark
+    (0x200E, 0x200F),  # Left-to-right and right-to-left marks
+    (0x202A, 0x202E),  # Bidirectional embeddings and overrides
+    (0x2066, 0x2069),  # Bidirectional isolates
+    (0xFEFF, 0xFEFF),  # Byte order mark
+]
+
+JOINERS = [0x200C, 0x200D]
+
+
+def classify(code):
+    bits = 0
+    category = unicodedata.category(chr(code))
+    if any(first <= code <= last for first, last in ARABIC_BLOCKS):
+        if category in ("Lo", "Lm"):
+            bits |= NAME_START | NAME
+        elif category in ("Mn", "Mc"):
+            bits |= NAME
+    for zero in DIGIT_ZEROS:
+        if zero <= code <= zero + 9:
+            bits |= NAME | DIGIT | (code - zero) << DIGIT_SHIFT
+    if code == ord("_") or code in JOINERS:
+        bits |= NAME
+    if any(first <= code <= last for first, last in WHITE_SPACE + IGNORED):
+        bits |= SPACE
+    return bits
+
+
+def main():
+    blocks = []
+    index = {}
+    stage1 = []
+    for start in range(0, LIMIT, BLOCK_SIZE):
+        block = tuple(classify(code) for code in range(start, start + BLOCK_SIZE))
+        if block not in index:
+            index[block] = len(blocks)
+            blocks.append(block)
+        stage1.append(index[block])
+    assert len(blocks) < 256
+
+    out = sys.stdout
+    out.write("// Generated by tools/charclass.py from Unicode %s; do not edit.\n" % unicodedata.unidata_version)
+    out.write('#include "charclass.h"\n\n')
+    out.write("const uint8_t charBlocks[CHAR_BLOCK_COUNT] = {\n")
+    for row in range(0, len(stage1), 16):
+        out.write("    " + ", ".join("%d" % n for n in stage1[row:row + 16]) + ",\n")
+    out.write("};\n\n")
+    out.write("const uint8_t charClasses[][CHAR_BLOCK_SIZE] = {\n")
+    for number, block in enumerate(blocks):
+        out.write("    { // %d\n" % number)
+        for row in range(0, BLOCK_SIZE, 16):
+            out.write("        " + ", ".join("0x%02x" % n for n in block[row:row + 16]) + ",\n")
+        out.write("    },\n")
+    out.write("};\n")
+
+
+main()
@@ -0,0 +1,374 @@
+#include "value.h"
+#include "script.h"
+#include "array.h"
+#include "map.h"
+#include "budget.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+// Integers outside the inline 48-bit range produced while evaluating a
+// statement live in this arena until the statement finishes. Values that are
+// stored in a symbol are copied out with valueCopy.
+#define WIDE_INT_BLOCK_SIZE 256
+
+typedef struct WideIntBlock {
+    struct WideIntBlock *next;
+    int used;
+    int64_t cells[WIDE_INT_BLOCK_SIZE];
+} WideIntBlock;
+
+_Thread_local WideIntBlock *wideIntBlocks = NULL;
+_Thread_local WideIntBlock *currentWideIntBlock = NULL;
+
+// Other values owned by temporaries, released with them.
+_Thread_local Value *temporaryValues = NULL;
+_Thread_local int temporaryCount = 0;
+_Thread_local int temporaryCapacity = 0;
+
+// Owned strings and wide integers are carved from blocks of 8 << n bytes,
+// up to 1 KiB; longer strings get a block of their own. A freed block goes
+// on its class's free list for the next value of that size, so a script that
+// keeps replacing its strings stops calling malloc once the lists fill.
+#define BLOCK_CLASS_COUNT 8
+#define LARGEST_BLOCK ((size_t)8 << (BLOCK_CLASS_COUNT - 1))
+#define FREE_LIST_LIMIT 1024 // Blocks kept per class; more are given back
+
+typedef struct FreeBlock {
+    struct FreeBlock *next;
+} FreeBlock;
+
+_Thread_local FreeBlock *freeBlocks[BLOCK_CLASS_COUNT];
+_Thread_local int freeBlockCounts[BLOCK_CLASS_COUNT];
+
+// A string value's characters follow its header
+typedef struct {
+    int refCount;
+    size_t size; // Bytes of the block, header included
+    wchar_t chars[];
+} String;
+
+static inline String *stringOf(Value value) {
+    return (String *)((char *)valuePointer(value) - offsetof(String, chars));
+}
+
+// Smallest class a block of this many bytes fits in, or -1 if there is none
+int blockClass(size_t bytes) {
+    if (bytes > LARGEST_BLOCK) {
+        return -1;
+    }
+    int sizeClass = 0;
+    while (((size_t)8 << sizeClass) < bytes) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+size_t blockSize(size_t bytes) {
+    int sizeClass = blockClass(bytes);
+    return sizeClass < 0 ? bytes : (size_t)8 << sizeClass;
+}
+
+// Returns a block of blockSize(bytes) bytes, charged to the script
+void *allocateBlock(MemoryKind kind, size_t bytes) {
+    int sizeClass = blockClass(bytes);
+    size_t size = blockSize(bytes);
+    chargeMemory(kind, size);
+    if (sizeClass >= 0 && freeBlocks[sizeClass]) {
+        FreeBlock *block = freeBlocks[sizeClass];
+        freeBlocks[sizeClass] = block->next;
+        freeBlockCounts[sizeClass]--;
+        reusedBlocks[kind]++;
+        return block;
+    }
+    void *block = malloc(size);
+    if (!block) {
+        releaseMemory(kind, size);
+        fwprintf(scriptErrors, L"Failed to allocate memory for value\n");
+        abortScript();
+    }
+    return block;
+}
+
+void freeBlock(MemoryKind kind, void *block, size_t size) {
+    releaseMemory(kind, size);
+    int sizeClass = blockClass(size);
+    if (sizeClass < 0 || freeBlockCounts[sizeClass] >= FREE_LIST_LIMIT) {
+        free(block);
+        return;
+    }
+    FreeBlock *freed = block;
+    freed->next = freeBlocks[sizeClass];
+    freeBlocks[sizeClass] = freed;
+    freeBlockCounts[sizeClass]++;
+}
+
+size_t freeListBytes(void) {
+    size_t bytes = 0;
+    for (int sizeClass = 0; sizeClass < BLOCK_CLASS_COUNT; sizeClass++) {
+        bytes += (size_t)freeBlockCounts[sizeClass] << (sizeClass + 3);
+    }
+    return bytes;
+}
+
+void releaseFreeLists(void) {
+    for (int sizeClass = 0; sizeClass < BLOCK_CLASS_COUNT; sizeClass++) {
+        while (freeBlocks[sizeClass]) {
+            FreeBlock *next = freeBlocks[sizeClass]->next;
+            free(freeBlocks[sizeClass]);
+            freeBlocks[sizeClass] = next;
+        }
+        freeBlockCounts[sizeClass] = 0;
+    }
+}
+
+Value valueFromWideInt(int64_t number) {
+    if (!currentWideIntBlock || currentWideIntBlock->used == WIDE_INT_BLOCK_SIZE) {
+        WideIntBlock *next = currentWideIntBlock ? currentWideIntBlock->next : wideIntBlocks;
+        if (!next) {
+            next = malloc(sizeof(WideIntBlock));
+            if (!next) {
+                fwprintf(scriptErrors, L"Failed to allocate memory for integer value\n");
+                abortScript();
+            }
+            next->next = NULL;
+            if (currentWideIntBlock) {
+                currentWideIntBlock->next = next;
+            } else {
+                wideIntBlocks = next;
+            }
+        }
+        next->used = 0;
+        currentWideIntBlock = next;
+    }
+
+    int64_t *cell = &currentWideIntBlock->cells[currentWideIntBlock->used++];
+    *cell = number;
+    return valueBox(VALUE_TAG_WIDE_INT, (uint64_t)(uintptr_t)cell);
+}
+
+// Releases every temporary; the wide integer blocks are kept for reuse.
+void resetTemporaryValues(void) {
+    for (int i = 0; i < temporaryCount; i++) {
+        valueFree(temporaryValues[i]);
+    }
+    temporaryCount = 0;
+    currentWideIntBlock = NULL;
+}
+
+void freeTemporaryValues(void) {
+    resetTemporaryValues();
+    free(temporaryValues);
+    temporaryValues = NULL;
+    temporaryCapacity = 0;
+    while (wideIntBlocks) {
+        WideIntBlock *next = wideIntBlocks->next;
+        free(wideIntBlocks);
+        wideIntBlocks = next;
+    }
+    currentWideIntBlock = NULL;
+    releaseFreeLists();
+}
+
+ValueType valueType(Value value) {
+    if (valueIsDouble(value)) {
+        return TYPE_DOUBLE;
+    }
+    switch (valueTag(value)) {
+        case VALUE_TAG_INT:
+        case VALUE_TAG_WIDE_INT:
+            return TYPE_INT;
+        case VALUE_TAG_CHAR:
+        case VALUE_TAG_STRING:
+            return TYPE_CHAR;
+        case VALUE_TAG_ARRAY:
+            return TYPE_ARRAY;
+        case VALUE_TAG_MAP:
+            return TYPE_MAP;
+        default:
+            return TYPE_ERROR;
+    }
+}
+
+// Returns a copy of the value that owns its heap storage, for keeping in a
+// symbol. Strings are shared: copying an owned one only counts a reference.
+Value valueCopy(Value value) {
+    if (!valueIsBoxed(value)) {
+        return value;
+    }
+    switch (valueTag(value)) {
+        case VALUE_TAG_WIDE_INT:
+            {
+                int64_t *cell = allocateBlock(MEMORY_WIDE_INT, sizeof(int64_t));
+                *cell = valueAsInt(value);
+                return valueBox(VALUE_TAG_WIDE_INT, (uint64_t)(uintptr_t)cell);
+            }
+        case VALUE_TAG_CHAR:
+            {
+                size_t length = wcslen(valueAsString(value));
+                String *string = allocateBlock(MEMORY_STRING, sizeof(String) + (length + 1) * sizeof(wchar_t));
+                string->refCount = 1;
+                string->size = blockSize(sizeof(String) + (length + 1) * sizeof(wchar_t));
+                wmemcpy(string->chars, valueAsString(value), length + 1);
+                return valueBox(VALUE_TAG_STRING, (uint64_t)(uintptr_t)string->chars);
+            }
+        case VALUE_TAG_STRING:
+            stringOf(value)->refCount++;
+            return value;
+        case VALUE_TAG_ARRAY:
+            // Arrays are shared by reference
+            valueAsArray(value)->refCount++;
+            return value;
+        case VALUE_TAG_MAP:
+            valueAsMap(value)->refCount++;
+            return value;
+        default:
+            return value;
+    }
+}
+
+// Hands an owned value over to the temporaries, to be freed when they are reset.
+Value valueTemporary(Value value) {
+    if (temporaryCount >= temporaryCapacity) {
+        temporaryCapacity = temporaryCapacity ? temporaryCapacity * 2 : 16;
+        temporaryValues = realloc(temporaryValues, temporaryCapacity * sizeof(Value));
+        if (!temporaryValues) {
+            fwprintf(scriptErrors, L"Failed to reallocate memory\n");
+            abortScript();
+        }
+    }
+    temporaryValues[temporaryCount++] = value;
+    return value;
+}
+
+// Returns a copy of the value that stays valid until the temporaries are reset,
+// for results that must outlive the storage they were read from.
+Value valueCopyTemporary(Value value) {
+    if (!valueIsBoxed(value)) {
+        return value;
+    }
+    switch (valueTag(value)) {
+        case VALUE_TAG_WIDE_INT:
+            return valueFromWideInt(valueAsInt(value));
+        case VALUE_TAG_CHAR:
+        case VALUE_TAG_STRING:
+        case VALUE_TAG_ARRAY:
+        case VALUE_TAG_MAP:
+            return valueTemporary(valueCopy(value));
+        default:
+            return value;
+    }
+}
+
+// Frees the heap storage of a value returned by valueCopy, or drops its
+// reference to a shared string, array or map.
+void valueFree(Value value) {
+    if (!valueIsBoxed(value)) {
+        return;
+    }
+    switch (valueTag(value)) {
+        case VALUE_TAG_WIDE_INT:
+            freeBlock(MEMORY_WIDE_INT, valuePointer(value), blockSize(sizeof(int64_t)));
+            break;
+        case VALUE_TAG_STRING:
+            {
+                String *string = stringOf(value);
+                if (--string->refCount == 0) {
+                    freeBlock(MEMORY_STRING, string, string->size);
+                }
+                break;
+            }
+        case VALUE_TAG_ARRAY:
+            arrayRelease(valueAsArray(value));
+            break;
+        case VALUE_TAG_MAP:
+            mapRelease(valueAsMap(value));
+            break;
+    }
+}
+
+// Marks the arrays and maps the current valueContains search has been
+// through, so that one reached by many paths is searched once
+_Thread_local uint32_t containsVisit = 0;
+
+int searchContains(Value value, const void *container) {
+    if (valueIsArray(value)) {
+        Array *array = valueAsArray(value);
+        if (array == container) {
+            return 1;
+        }
+        if (array->visit == containsVisit || array->kind != ARRAY_BOXED) {
+            return 0;
+        }
+        array->visit = containsVisit;
+        for (int64_t i = 0; i < array->length; i++) {
+            if (searchContains(array->values[i], container)) {
+                return 1;
+            }
+        }
+    } else if (valueIsMap(value)) {
+        Map *map = valueAsMap(value);
+        if (map == container) {
+            return 1;
+        }
+        if (map->visit == containsVisit) {
+            return 0;
+        }
+        map->visit = containsVisit;
+        for (int64_t i = 0; i < map->entryCount; i++) {
+            // Keys are only integers and strings; deleted entries hold errors
+            if (searchContains(map->entries[i].value, container)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int valueContains(Value value, const void *container) {
+    if (!valueIsArray(value) && !valueIsMap(value)) {
+        return 0;
+    }
+    if (++containsVisit == 0) {
+        containsVisit = 1; // Fresh containers start at 0
+    }
+    return searchContains(value, container);
+}
+
+void printValueInline(Value value) {
+    switch (valueType(value)) {
+        case TYPE_INT:
+            fwprintf(scriptOutput, L"%" PRId64, valueAsInt(value));
+            break;
+        case TYPE_DOUBLE:
+            fwprintf(scriptOutput, L"%lf", valueAsDouble(value));
+            break;
+        case TYPE_CHAR:
+            fwprintf(scriptOutput, L"%ls", valueAsString(value));
+            break;
+        case TYPE_ARRAY:
+            printArray(valueAsArray(value));
+            break;
+        case TYPE_MAP:
+            printMap(valueAsMap(value));
+            break;
+        default:
+            fwprintf(scriptOutput, L"<error>");
+            break;
+    }
+}
+
+void printValue(Value value) {
+    // Numbers, the commonest case, with their line ending in one call
+    if (valueIsInt(value)) {
+        fwprintf(scriptOutput, L"%" PRId64 L"\n", valueAsInt(value));
+        return;
+    }
+    if (valueIsDouble(value)) {
+        fwprintf(scriptOutput, L"%lf\n", valueAsDouble(value));
+        return;
+    }
+    printValueInline(value);
+    fwprintf(scriptOutput, L"\n");
+}
@@ -0,0 +1,160 @@
+// value.h
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+
+// Runtime type of a value
+typedef enum {
+    TYPE_INT,
+    TYPE_DOUBLE,
+    TYPE_CHAR,
+    TYPE_ARRAY,
+    TYPE_MAP,
+    TYPE_ERROR
+} ValueType;
+
+// A NaN-boxed 8-byte value. Doubles are stored as their IEEE-754 bits; every
+// other type lives in the payload of a negative quiet NaN, with a 3-bit tag in
+// bits 48-50 and a 48-bit payload below it.
+typedef uint64_t Value;
+
+struct Array;
+struct Map;
+
+#define VALUE_BOX_MASK      0xFFF8000000000000ULL
+#define VALUE_PAYLOAD_MASK  0x0000FFFFFFFFFFFFULL
+#define VALUE_CANONICAL_NAN 0x7FF8000000000000ULL
+#define VALUE_TAG_SHIFT     48
+
+#define VALUE_TAG_INT      0 // 48-bit signed integer stored inline
+#define VALUE_TAG_WIDE_INT 1 // Pointer to an int64_t cell for integers that do not fit inline
+#define VALUE_TAG_CHAR     2 // Pointer to a wchar_t string borrowed from a token, a line or a snapshot
+#define VALUE_TAG_ERROR    3
+#define VALUE_TAG_ARRAY    4 // Pointer to a reference-counted Array
+#define VALUE_TAG_MAP      5 // Pointer to a reference-counted Map
+#define VALUE_TAG_STRING   6 // Pointer to the characters of a reference-counted String
+
+#define VALUE_INT_MIN (-((int64_t)1 << 47))
+#define VALUE_INT_MAX (((int64_t)1 << 47) - 1)
+
+static inline int valueIsBoxed(Value value) {
+    return (value & VALUE_BOX_MASK) == VALUE_BOX_MASK;
+}
+
+static inline int valueTag(Value value) {
+    return (int)((value >> VALUE_TAG_SHIFT) & 7);
+}
+
+static inline Value valueBox(int tag, uint64_t payload) {
+    return VALUE_BOX_MASK | ((uint64_t)tag << VALUE_TAG_SHIFT) | (payload & VALUE_PAYLOAD_MASK);
+}
+
+static inline void *valuePointer(Value value) {
+    return (void *)(uintptr_t)(value & VALUE_PAYLOAD_MASK);
+}
+
+static inline int valueIsDouble(Value value) {
+    return !valueIsBoxed(value);
+}
+
+static inline int valueIsInt(Value value) {
+    return valueIsBoxed(value) && valueTag(value) <= VALUE_TAG_WIDE_INT;
+}
+
+static inline int valueIsNumber(Value value) {
+    return valueIsDouble(value) || valueIsInt(value);
+}
+
+// Borrowed and owned strings differ only in the tag's top bit
+static inline int valueIsString(Value value) {
+    return valueIsBoxed(value) && (valueTag(value) & 3) == VALUE_TAG_CHAR;
+}
+
+static inline Value valueFromDouble(double number) {
+    Value bits;
+    if (number != number) {
+        return VALUE_CANONICAL_NAN; // Keep NaNs out of the boxed space
+    }
+    memcpy(&bits, &number, sizeof bits);
+    return bits;
+}
+
+static inline double valueAsDouble(Value value) {
+    double number;
+    memcpy(&number, &value, sizeof number);
+    return number;
+}
+
+Value valueFromWideInt(int64_t number);
+
+static inline Value valueFromInt(int64_t number) {
+    if (number < VALUE_INT_MIN || number > VALUE_INT_MAX) {
+        return valueFromWideInt(number);
+    }
+    return valueBox(VALUE_TAG_INT, (uint64_t)number);
+}
+
+static inline int64_t valueAsInt(Value value) {
+    if (valueTag(value) == VALUE_TAG_WIDE_INT) {
+        return *(int64_t *)valuePointer(value);
+    }
+    // Sign-extend the 48-bit payload
+    return (int64_t)(value << 16) >> 16;
+}
+
+static inline Value valueFromString(wchar_t *string) {
+    return valueBox(VALUE_TAG_CHAR, (uint64_t)(uintptr_t)string);
+}
+
+static inline wchar_t *valueAsString(Value value) {
+    return (wchar_t *)valuePointer(value);
+}
+
+static inline int valueIsArray(Value value) {
+    return valueIsBoxed(value) && valueTag(value) == VALUE_TAG_ARRAY;
+}
+
+static inline Value valueFromArray(struct Array *array) {
+    return valueBox(VALUE_TAG_ARRAY, (uint64_t)(uintptr_t)array);
+}
+
+static inline struct Array *valueAsArray(Value value) {
+    return (struct Array *)valuePointer(value);
+}
+
+static inline int valueIsMap(Value value) {
+    return valueIsBoxed(value) && valueTag(value) == VALUE_TAG_MAP;
+}
+
+static inline Value valueFromMap(struct Map *map) {
+    return valueBox(VALUE_TAG_MAP, (uint64_t)(uintptr_t)map);
+}
+
+static inline struct Map *valueAsMap(Value value) {
+    return (struct Map *)valuePointer(value);
+}
+
+static inline Value valueError(void) {
+    return valueBox(VALUE_TAG_ERROR, 0);
+}
+
+ValueType valueType(Value value);
+Value valueCopy(Value value);
+size_t freeListBytes(void);
+Value valueCopyTemporary(Value value);
+Value valueTemporary(Value value);
+void valueFree(Value value);
+void resetTemporaryValues(void);
+void freeTemporaryValues(void);
+void printValueInline(Value value);
+void printValue(Value value);
+
+// Whether the array or map container is value or is held by it at any depth.
+// Stores that would make a container hold itself are refused with this, since
+// reference counts never free a cycle.
+int valueContains(Value value, const void *container);
+
+#endif // VALUE_H
@@ -0,0 +1,778 @@
+#include "vector.h"
+#include "script.h"
+#include "interpreter.h"
+#include "array.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define VECTOR_X86 1
+#include <immintrin.h>
+#endif
+
+int vectorLevel = -1; // Detected on first use
+
+// Double sums, dot products, minimums and maximums round or pick differently
+// depending on the order elements are combined in, so every level uses one
+// layout: element i of each full group of eight goes to lane i % 8, lane j is
+// then combined with lane j + 4, those four results as (0, 1) with (2, 3), and
+// the elements after the last full group follow in order. AVX2 keeps the
+// lanes in two registers, SSE2 in four and the scalar loops in an array.
+#define VECTOR_LANES 8
+
+// ((l0 + l4) + (l1 + l5)) + ((l2 + l6) + (l3 + l7))
+double addLanes(const double *lanes) {
+    return ((lanes[0] + lanes[4]) + (lanes[1] + lanes[5])) + ((lanes[2] + lanes[6]) + (lanes[3] + lanes[7]));
+}
+
+// Whether a minimum or maximum replaces best with candidate. Ties and NaN
+// keep best.
+static inline int beats(double candidate, double best, int wantMax) {
+    return wantMax ? candidate > best : candidate < best;
+}
+
+double pickLanes(const double *lanes, int wantMax) {
+    double picked[4];
+    for (int lane = 0; lane < 4; lane++) {
+        picked[lane] = beats(lanes[lane + 4], lanes[lane], wantMax) ? lanes[lane + 4] : lanes[lane];
+    }
+    double first = beats(picked[1], picked[0], wantMax) ? picked[1] : picked[0];
+    double second = beats(picked[3], picked[2], wantMax) ? picked[3] : picked[2];
+    return beats(second, first, wantMax) ? second : first;
+}
+
+// Scalar multiplies and adds stay two roundings, as in the vector kernels,
+// rather than being contracted into fused multiply-adds
+#if defined(__GNUC__) && !defined(__clang__)
+#define SEPARATE_ROUNDING __attribute__((optimize("fp-contract=off")))
+#else
+#define SEPARATE_ROUNDING
+#endif
+
+int detectVectorLevel() {
+    if (vectorLevel < 0) {
+#ifdef VECTOR_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            vectorLevel = VECTOR_AVX2;
+        } else {
+            vectorLevel = VECTOR_SSE2; // Part of the x86-64 baseline
+        }
+#else
+        vectorLevel = VECTOR_SCALAR;
+#endif
+    }
+    return vectorLevel;
+}
+
+#ifdef VECTOR_X86
+
+__attribute__((target("avx2")))
+int64_t sumIntAvx2(const int64_t *data, int64_t length) {
+    __m256i total = _mm256_setzero_si256();
+    int64_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        total = _mm256_add_epi64(total, _mm256_loadu_si256((const __m256i *)(data + i)));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, total);
+    uint64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < length; i++) {
+        sum += (uint64_t)data[i];
+    }
+    return (int64_t)sum;
+}
+
+int64_t sumIntSse2(const int64_t *data, int64_t length) {
+    __m128i total = _mm_setzero_si128();
+    int64_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        total = _mm_add_epi64(total, _mm_loadu_si128((const __m128i *)(data + i)));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, total);
+    uint64_t sum = lanes[0] + lanes[1];
+    for (; i < length; i++) {
+        sum += (uint64_t)data[i];
+    }
+    return (int64_t)sum;
+}
+
+__attribute__((target("avx2")))
+double sumDoubleAvx2(const double *data, int64_t length) {
+    __m256d low = _mm256_setzero_pd();  // Lanes 0-3
+    __m256d high = _mm256_setzero_pd(); // Lanes 4-7
+    int64_t i = 0;
+    for (; i + VECTOR_LANES <= length; i += VECTOR_LANES) {
+        low = _mm256_add_pd(low, _mm256_loadu_pd(data + i));
+        high = _mm256_add_pd(high, _mm256_loadu_pd(data + i + 4));
+    }
+    double lanes[VECTOR_LANES];
+    _mm256_storeu_pd(lanes, low);
+    _mm256_storeu_pd(lanes + 4, high);
+    double sum = addLanes(lanes);
+    for (; i < length; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+double sumDoubleSse2(const double *data, int64_t length) {
+    __m128d totals[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    int64_t i = 0;
+    for (; i + VECTOR_LANES <= length; i += VECTOR_LANES) {
+        for (int pair = 0; pair < 4; pair++) {
+            totals[pair] = _mm_add_pd(totals[pair], _mm_loadu_pd(data + i + 2 * pair));
+        }
+    }
+    double lanes[VECTOR_LANES];
+    for (int pair = 0; pair < 4; pair++) {
+        _mm_storeu_pd(lanes + 2 * pair, totals[pair]);
+    }
+    double sum = addLanes(lanes);
+    for (; i < length; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+// Minimum (wantMax == 0) or maximum of at least one element
+__attribute__((target("avx2")))
+int64_t extremeIntAvx2(const int64_t *data, int64_t length, int wantMax) {
+    int64_t result = data[0];
+    int64_t i = 0;
+    if (length >= 4) {
+        __m256i best = _mm256_loadu_si256((const __m256i *)data);
+        for (i = 4; i + 4 <= length; i += 4) {
+            __m256i next = _mm256_loadu_si256((const __m256i *)(data + i));
+            __m256i greater = _mm256_cmpgt_epi64(next, best);
+            best = wantMax ? _mm256_blendv_epi8(best, next, greater) : _mm256_blendv_epi8(next, best, greater);
+        }
+        int64_t lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes, best);
+        result = lanes[0];
+        for (int lane = 1; lane < 4; lane++) {
+            if (wantMax ? lanes[lane] > result : lanes[lane] < result) {
+                result = lanes[lane];
+            }
+        }
+    }
+    for (; i < length; i++) {
+        if (wantMax ? data[i] > result : data[i] < result) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+// Minimum or maximum of at least VECTOR_LANES elements. A lane takes the next
+// element only if it beats the lane strictly, as in beats; min_pd and max_pd
+// would instead pick by operand order on ties and NaN.
+__attribute__((target("avx2")))
+double extremeDoubleAvx2(const double *data, int64_t length, int wantMax) {
+    __m256d low = _mm256_loadu_pd(data);
+    __m256d high = _mm256_loadu_pd(data + 4);
+    int64_t i = VECTOR_LANES;
+    for (; i + VECTOR_LANES <= length; i += VECTOR_LANES) {
+        __m256d next = _mm256_loadu_pd(data + i);
+        low = _mm256_blendv_pd(low, next, wantMax ? _mm256_cmp_pd(next, low, _CMP_GT_OQ)
+                                                  : _mm256_cmp_pd(next, low, _CMP_LT_OQ));
+        next = _mm256_loadu_pd(data + i + 4);
+        high = _mm256_blendv_pd(high, next, wantMax ? _mm256_cmp_pd(next, high, _CMP_GT_OQ)
+                                                    : _mm256_cmp_pd(next, high, _CMP_LT_OQ));
+    }
+    double lanes[VECTOR_LANES];
+    _mm256_storeu_pd(lanes, low);
+    _mm256_storeu_pd(lanes + 4, high);
+    double result = pickLanes(lanes, wantMax);
+    for (; i < length; i++) {
+        if (beats(data[i], result, wantMax)) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+double extremeDoubleSse2(const double *data, int64_t length, int wantMax) {
+    __m128d best[4];
+    for (int pair = 0; pair < 4; pair++) {
+        best[pair] = _mm_loadu_pd(data + 2 * pair);
+    }
+    int64_t i = VECTOR_LANES;
+    for (; i + VECTOR_LANES <= length; i += VECTOR_LANES) {
+        for (int pair = 0; pair < 4; pair++) {
+            __m128d next = _mm_loadu_pd(data + i + 2 * pair);
+            __m128d better = wantMax ? _mm_cmpgt_pd(next, best[pair]) : _mm_cmplt_pd(next, best[pair]);
+            best[pair] = _mm_or_pd(_mm_and_pd(better, next), _mm_andnot_pd(better, best[pair]));
+        }
+    }
+    double lanes[VECTOR_LANES];
+    for (int pair = 0; pair < 4; pair++) {
+        _mm_storeu_pd(lanes + 2 * pair, best[pair]);
+    }
+    double result = pickLanes(lanes, wantMax);
+    for (; i < length; i++) {
+        if (beats(data[i], result, wantMax)) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+__attribute__((target("avx2")))
+double dotDoubleAvx2(const double *left, const double *right, int64_t length) {
+    __m256d low = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+    int64_t i = 0;
+    for (; i + VECTOR_LANES <= length; i += VECTOR_LANES) {
+        low = _mm256_add_pd(low, _mm256_mul_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+        high = _mm256_add_pd(high, _mm256_mul_pd(_mm256_loadu_pd(left + i + 4), _mm256_loadu_pd(right + i + 4)));
+    }
+    double lanes[VECTOR_LANES];
+    _mm256_storeu_pd(lanes, low);
+    _mm256_storeu_pd(lanes + 4, high);
+    double sum = addLanes(lanes);
+    for (; i < length; i++) {
+        double product = left[i] * right[i];
+        sum += product;
+    }
+    return sum;
+}
+
+SEPARATE_ROUNDING
+double dotDoubleSse2(const double *left, const double *right, int64_t length) {
+    __m128d totals[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    int64_t i = 0;
+    for (; i + VECTOR_LANES <= length; i += VECTOR_LANES) {
+        for (int pair = 0; pair < 4; pair++) {
+            __m128d product = _mm_mul_pd(_mm_loadu_pd(left + i + 2 * pair), _mm_loadu_pd(right + i + 2 * pair));
+            totals[pair] = _mm_add_pd(totals[pair], product);
+        }
+    }
+    double lanes[VECTOR_LANES];
+    for (int pair = 0; pair < 4; pair++) {
+        _mm_storeu_pd(lanes + 2 * pair, totals[pair]);
+    }
+    double sum = addLanes(lanes);
+    for (; i < length; i++) {
+        double product = left[i] * right[i];
+        sum += product;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+void addIntAvx2(const int64_t *left, const int64_t *right, int64_t *out, int64_t length) {
+    int64_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(left + i)),
+                                       _mm256_loadu_si256((const __m256i *)(right + i)));
+        _mm256_storeu_si256((__m256i *)(out + i), sum);
+    }
+    for (; i < length; i++) {
+        out[i] = (int64_t)((uint64_t)left[i] + (uint64_t)right[i]);
+    }
+}
+
+void addIntSse2(const int64_t *left, const int64_t *right, int64_t *out, int64_t length) {
+    int64_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        __m128i sum = _mm_add_epi64(_mm_loadu_si128((const __m128i *)(left + i)),
+                                    _mm_loadu_si128((const __m128i *)(right + i)));
+        _mm_storeu_si128((__m128i *)(out + i), sum);
+    }
+    for (; i < length; i++) {
+        out[i] = (int64_t)((uint64_t)left[i] + (uint64_t)right[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+void addDoubleAvx2(const double *left, const double *right, double *out, int64_t length) {
+    int64_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+    }
+    for (; i < length; i++) {
+        out[i] = left[i] + right[i];
+    }
+}
+
+void addDoubleSse2(const double *left, const double *right, double *out, int64_t length) {
+    int64_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+    }
+    for (; i < length; i++) {
+        out[i] = left[i] + right[i];
+    }
+}
+
+// Adds a constant to every element; subtraction passes the negated operand
+__attribute__((target("avx2")))
+void offsetIntAvx2(const int64_t *data, int64_t operand, int64_t *out, int64_t length) {
+    __m256i broadcast = _mm256_set1_epi64x(operand);
+    int64_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)(data + i)), broadcast));
+    }
+    for (; i < length; i++) {
+        out[i] = (int64_t)((uint64_t)data[i] + (uint64_t)operand);
+    }
+}
+
+__attribute__((target("avx2")))
+void mapDoubleAvx2(const double *data, TokenType operatorType, double operand, double *out, int64_t length) {
+    __m256d broadcast = _mm256_set1_pd(operand);
+    int64_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        __m256d next = _mm256_loadu_pd(data + i);
+        switch (operatorType) {
+            case TOKEN_PLUS:  next = _mm256_add_pd(next, broadcast); break;
+            case TOKEN_MINUS: next = _mm256_sub_pd(next, broadcast); break;
+            case TOKEN_STAR:  next = _mm256_mul_pd(next, broadcast); break;
+            default:          next = _mm256_div_pd(next, broadcast); break;
+        }
+        _mm256_storeu_pd(out + i, next);
+    }
+    for (; i < length; i++) {
+        switch (operatorType) {
+            case TOKEN_PLUS:  out[i] = data[i] + operand; break;
+            case TOKEN_MINUS: out[i] = data[i] - operand; break;
+            case TOKEN_STAR:  out[i] = data[i] * operand; break;
+            default:          out[i] = data[i] / operand; break;
+        }
+    }
+}
+
+void mapDoubleSse2(const double *data, TokenType operatorType, double operand, double *out, int64_t length) {
+    __m128d broadcast = _mm_set1_pd(operand);
+    int64_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        __m128d next = _mm_loadu_pd(data + i);
+        switch (operatorType) {
+            case TOKEN_PLUS:  next = _mm_add_pd(next, broadcast); break;
+            case TOKEN_MINUS: next = _mm_sub_pd(next, broadcast); break;
+            case TOKEN_STAR:  next = _mm_mul_pd(next, broadcast); break;
+            default:          next = _mm_div_pd(next, broadcast); break;
+        }
+        _mm_storeu_pd(out + i, next);
+    }
+    for (; i < length; i++) {
+        switch (operatorType) {
+            case TOKEN_PLUS:  out[i] = data[i] + operand; break;
+            case TOKEN_MINUS: out[i] = data[i] - operand; break;
+            case TOKEN_STAR:  out[i] = data[i] * operand; break;
+            default:          out[i] = data[i] / operand; break;
+        }
+    }
+}
+
+#endif // VECTOR_X86
+
+int64_t vectorSumInt(const int64_t *data, int64_t length) {
+#ifdef VECTOR_X86
+    if (detectVectorLevel() == VECTOR_AVX2) return sumIntAvx2(data, length);
+    if (detectVectorLevel() == VECTOR_SSE2) return sumIntSse2(data, length);
+#endif
+    uint64_t sum = 0;
+    for (int64_t i = 0; i < length; i++) {
+        sum += (uint64_t)data[i];
+    }
+    return (int64_t)sum;
+}
+
+double vectorSumDouble(const double *data, int64_t length) {
+#ifdef VECTOR_X86
+    if (detectVectorLevel() == VECTOR_AVX2) return sumDoubleAvx2(data, length);
+    if (detectVectorLevel() == VECTOR_SSE2) return sumDoubleSse2(data, length);
+#endif
+    double lanes[VECTOR_LANES] = {0};
+    int64_t i = 0;
+    for (; i + VECTOR_LANES <= length; i += VECTOR_LANES) {
+        for (int lane = 0; lane < VECTOR_LANES; lane++) {
+            lanes[lane] += data[i + lane];
+        }
+    }
+    double sum = addLanes(lanes);
+    for (; i < length; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+int64_t extremeIntScalar(const int64_t *data, int64_t length, int wantMax) {
+    int64_t result = data[0];
+    for (int64_t i = 1; i < length; i++) {
+        if (wantMax ? data[i] > result : data[i] < result) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+// Minimum or maximum of at least one element. Fewer than VECTOR_LANES are
+// compared in order at every level; more are split into lanes.
+double extremeDoubleScalar(const double *data, int64_t length, int wantMax) {
+    double lanes[VECTOR_LANES];
+    int64_t i = length < VECTOR_LANES ? 1 : VECTOR_LANES;
+    double result = data[0];
+    if (length >= VECTOR_LANES) {
+        memcpy(lanes, data, sizeof(lanes));
+        for (; i + VECTOR_LANES <= length; i += VECTOR_LANES) {
+            for (int lane = 0; lane < VECTOR_LANES; lane++) {
+                if (beats(data[i + lane], lanes[lane], wantMax)) {
+                    lanes[lane] = data[i + lane];
+                }
+            }
+        }
+        result = pickLanes(lanes, wantMax);
+    }
+    for (; i < length; i++) {
+        if (beats(data[i], result, wantMax)) {
+            result = data[i];
+        }
+    }
+    return result;
+}
+
+int64_t vectorMinInt(const int64_t *data, int64_t length) {
+#ifdef VECTOR_X86
+    if (detectVectorLevel() == VECTOR_AVX2) return extremeIntAvx2(data, length, 0);
+#endif
+    return extremeIntScalar(data, length, 0); // SSE2 has no 64-bit integer compare
+}
+
+int64_t vectorMaxInt(const int64_t *data, int64_t length) {
+#ifdef VECTOR_X86
+    if (detectVectorLevel() == VECTOR_AVX2) return extremeIntAvx2(data, length, 1);
+#endif
+    return extremeIntScalar(data, length, 1);
+}
+
+double vectorMinDouble(const double *data, int64_t length) {
+#ifdef VECTOR_X86
+    if (length >= VECTOR_LANES && detectVectorLevel() == VECTOR_AVX2) return extremeDoubleAvx2(data, length, 0);
+    if (length >= VECTOR_LANES && detectVectorLevel() == VECTOR_SSE2) return extremeDoubleSse2(data, length, 0);
+#endif
+    return extremeDoubleScalar(data, length, 0);
+}
+
+double vectorMaxDouble(const double *data, int64_t length) {
+#ifdef VECTOR_X86
+    if (length >= VECTOR_LANES && detectVectorLevel() == VECTOR_AVX2) return extremeDoubleAvx2(data, length, 1);
+    if (length >= VECTOR_LANES && detectVectorLevel() == VECTOR_SSE2) return extremeDoubleSse2(data, length, 1);
+#endif
+    return extremeDoubleScalar(data, length, 1);
+}
+
+SEPARATE_ROUNDING
+double vectorDotDouble(const double *left, const double *right, int64_t length) {
+#ifdef VECTOR_X86
+    if (detectVectorLevel() == VECTOR_AVX2) return dotDoubleAvx2(left, right, length);
+    if (detectVectorLevel() == VECTOR_SSE2) return dotDoubleSse2(left, right, length);
+#endif
+    double lanes[VECTOR_LANES] = {0};
+    int64_t i = 0;
+    for (; i + VECTOR_LANES <= length; i += VECTOR_LANES) {
+        for (int lane = 0; lane < VECTOR_LANES; lane++) {
+            double product = left[i + lane] * right[i + lane];
+            lanes[lane] += product;
+        }
+    }
+    double sum = addLanes(lanes);
+    for (; i < length; i++) {
+        double product = left[i] * right[i];
+        sum += product;
+    }
+    return sum;
+}
+
+void vectorAddInt(const int64_t *left, const int64_t *right, int64_t *out, int64_t length) {
+#ifdef VECTOR_X86
+    if (detectVectorLevel() == VECTOR_AVX2) { addIntAvx2(left, right, out, length); return; }
+    if (detectVectorLevel() == VECTOR_SSE2) { addIntSse2(left, right, out, length); return; }
+#endif
+    for (int64_t i = 0; i < length; i++) {
+        out[i] = (int64_t)((uint64_t)left[i] + (uint64_t)right[i]);
+    }
+}
+
+void vectorAddDouble(const double *left, const double *right, double *out, int64_t length) {
+#ifdef VECTOR_X86
+    if (detectVectorLevel() == VECTOR_AVX2) { addDoubleAvx2(left, right, out, length); return; }
+    if (detectVectorLevel() == VECTOR_SSE2) { addDoubleSse2(left, right, out, length); return; }
+#endif
+    for (int64_t i = 0; i < length; i++) {
+        out[i] = left[i] + right[i];
+    }
+}
+
+// Supports +, - and * with wrap-around; integer division goes through
+// performIntegerOperation for its zero and overflow checks.
+void vectorMapInt(const int64_t *data, TokenType operatorType, int64_t operand, int64_t *out, int64_t length) {
+#ifdef VECTOR_X86
+    if (operatorType != TOKEN_STAR && detectVectorLevel() == VECTOR_AVX2) {
+        uint64_t offset = operatorType == TOKEN_MINUS ? 0 - (uint64_t)operand : (uint64_t)operand;
+        offsetIntAvx2(data, (int64_t)offset, out, length);
+        return;
+    }
+#endif
+    for (int64_t i = 0; i < length; i++) {
+        switch (operatorType) {
+            case TOKEN_PLUS:  out[i] = (int64_t)((uint64_t)data[i] + (uint64_t)operand); break;
+            case TOKEN_MINUS: out[i] = (int64_t)((uint64_t)data[i] - (uint64_t)operand); break;
+            default:          out[i] = (int64_t)((uint64_t)data[i] * (uint64_t)operand); break;
+        }
+    }
+}
+
+void vectorMapDouble(const double *data, TokenType operatorType, double operand, double *out, int64_t length) {
+#ifdef VECTOR_X86
+    if (detectVectorLevel() == VECTOR_AVX2) { mapDoubleAvx2(data, operatorType, operand, out, length); return; }
+    if (detectVectorLevel() == VECTOR_SSE2) { mapDoubleSse2(data, operatorType, operand, out, length); return; }
+#endif
+    for (int64_t i = 0; i < length; i++) {
+        switch (operatorType) {
+            case TOKEN_PLUS:  out[i] = data[i] + operand; break;
+            case TOKEN_MINUS: out[i] = data[i] - operand; break;
+            case TOKEN_STAR:  out[i] = data[i] * operand; break;
+            default:          out[i] = data[i] / operand; break;
+        }
+    }
+}
+
+// Returns the elements of a packed array as doubles. Integer arrays are
+// converted into a buffer that the caller frees; *converted tells which.
+double *arrayDoubles(Array *array, int *converted) {
+    if (array->kind == ARRAY_DOUBLE) {
+        *converted = 0;
+        return array->doubles;
+    }
+    double *buffer = malloc((array->length ? array->length : 1) * sizeof(double));
+    if (!buffer) {
+        fwprintf(scriptErrors, L"Failed to allocate memory for array\n");
+        abortScript();
+    }
+    for (int64_t i = 0; i < array->length; i++) {
+        buffer[i] = (double)array->ints[i];
+    }
+    *converted = 1;
+    return buffer;
+}
+
+Value temporaryArray(Array *array) {
+    return valueTemporary(valueFromArray(array)); // Released with the statement unless stored
+}
+
+Value builtinSum(Value *args) {
+    Array *array = requireArray(args[0]);
+    switch (array->kind) {
+        case ARRAY_INT:
+            if (checkedArithmetic) {
+                int64_t sum = 0;
+                for (int64_t i = 0; i < array->length; i++) {
+                    sum = performIntegerOperation(sum, array->ints[i], TOKEN_PLUS);
+                }
+                return valueFromInt(sum);
+            }
+            return valueFromInt(vectorSumInt(array->ints, array->length));
+        case ARRAY_DOUBLE:
+            return valueFromDouble(vectorSumDouble(array->doubles, array->length));
+        default:
+            {
+                Value sum = valueFromInt(0);
+                for (int64_t i = 0; i < array->length; i++) {
+                    sum = performArithmeticOperation(sum, array->values[i], TOKEN_PLUS);
+                }
+                return sum;
+            }
+    }
+}
+
+// True if left < right, comparing as integers only when both are integers
+int numberLess(Value left, Value right) {
+    if (!valueIsNumber(left) || !valueIsNumber(right)) {
+        runtimeError(L"Type error: comparing a value that is not a number");
+    }
+    if (valueIsInt(left) && valueIsInt(right)) {
+        return valueAsInt(left) < valueAsInt(right);
+    }
+    double leftValue = valueIsInt(left) ? (double)valueAsInt(left) : valueAsDouble(left);
+    double rightValue = valueIsInt(right) ? (double)valueAsInt(right) : valueAsDouble(right);
+    return leftValue < rightValue;
+}
+
+Value arrayExtreme(Value arrayValue, int wantMax) {
+    Array *array = requireArray(arrayValue);
+    if (array->length == 0) {
+        runtimeError(L"Runtime error: Minimum or maximum of an empty array.");
+    }
+    switch (array->kind) {
+        case ARRAY_INT:
+            return valueFromInt(wantMax ? vectorMaxInt(array->ints, array->length)
+                                        : vectorMinInt(array->ints, array->length));
+        case ARRAY_DOUBLE:
+            return valueFromDouble(wantMax ? vectorMaxDouble(array->doubles, array->length)
+                                           : vectorMinDouble(array->doubles, array->length));
+        default:
+            {
+                Value result = array->values[0];
+                for (int64_t i = 1; i < array->length; i++) {
+                    Value next = array->values[i];
+                    if (wantMax ? numberLess(result, next) : numberLess(next, result)) {
+                        result = next;
+                    }
+                }
+                if (!valueIsNumber(result)) {
+                    runtimeError(L"Type error: comparing a value that is not a number");
+                }
+                return result;
+            }
+    }
+}
+
+Value builtinMin(Value *args) {
+    return arrayExtreme(args[0], 0);
+}
+
+Value builtinMax(Value *args) {
+    return arrayExtreme(args[0], 1);
+}
+
+// Applies "element op operand" to every element into a new array.
+Value mapArray(Array *array, TokenType operatorType, Value operand) {
+    if (!valueIsNumber(operand)) {
+        performArithmeticOperation(valueFromInt(0), operand, operatorType); // Reports the type error
+    }
+
+    if (array->kind == ARRAY_BOXED
+        || (array->kind == ARRAY_INT && valueIsInt(operand) && (operatorType == TOKEN_SLASH || checkedArithmetic))) {
+        // Generic path, one element at a time
+        Array *result = newArray(array->length);
+        Value resultValue = temporaryArray(result);
+        for (int64_t i = 0; i < array->length; i++) {
+            arrayAppend(result, performArithmeticOperation(arrayGet(array, i), operand, operatorType));
+        }
+        return resultValue;
+    }
+
+    if (array->kind == ARRAY_INT && valueIsInt(operand)) {
+        Array *result = newArrayOfKind(ARRAY_INT, array->length);
+        vectorMapInt(array->ints, operatorType, valueAsInt(operand), result->ints, array->length);
+        return temporaryArray(result);
+    }
+
+    double number = valueIsInt(operand) ? (double)valueAsInt(operand) : valueAsDouble(operand);
+    if (operatorType == TOKEN_SLASH && number == 0) {
+        runtimeError(L"Runtime error: Division by zero in expression.");
+    }
+    int converted;
+    double *data = arrayDoubles(array, &converted);
+    Array *result = newArrayOfKind(ARRAY_DOUBLE, array->length);
+    vectorMapDouble(data, operatorType, number, result->doubles, array->length);
+    if (converted) {
+        free(data);
+    }
+    return temporaryArray(result);
+}
+
+// Builtin تحجيم: multiplies every element by a number
+Value builtinScale(Value *args) {
+    return mapArray(requireArray(args[0]), TOKEN_STAR, args[1]);
+}
+
+// Builtin تطبيق: applies "+", "-", "*" or "/" with a number to every element
+Value builtinMap(Value *args) {
+    if (!valueIsString(args[1])) {
+        runtimeError(L"Type error: map operator must be a string");
+    }
+    wchar_t *name = valueAsString(args[1]);
+    TokenType operatorType;
+    if (wcscmp(name, L"+") == 0) {
+        operatorType = TOKEN_PLUS;
+    } else if (wcscmp(name, L"-") == 0) {
+        operatorType = TOKEN_MINUS;
+    } else if (wcscmp(name, L"*") == 0) {
+        operatorType = TOKEN_STAR;
+    } else if (wcscmp(name, L"/") == 0) {
+        operatorType = TOKEN_SLASH;
+    } else {
+        fwprintf(scriptErrors, L"Unknown operator in map: %ls\n", name);
+        abortScript();
+    }
+    return mapArray(requireArray(args[0]), operatorType, args[2]);
+}
+
+void requireSameLength(Array *left, Array *right) {
+    if (left->length != right->length) {
+        runtimeError(L"Runtime error: Arrays have different lengths.");
+    }
+}
+
+// Builtin جمع_متجهات: element-wise sum of two arrays
+Value builtinAddArrays(Value *args) {
+    Array *left = requireArray(args[0]);
+    Array *right = requireArray(args[1]);
+    requireSameLength(left, right);
+
+    if (left->kind == ARRAY_BOXED || right->kind == ARRAY_BOXED
+        || (left->kind == ARRAY_INT && right->kind == ARRAY_INT && checkedArithmetic)) {
+        Array *result = newArray(left->length);
+        Value resultValue = temporaryArray(result);
+        for (int64_t i = 0; i < left->length; i++) {
+            arrayAppend(result, performArithmeticOperation(arrayGet(left, i), arrayGet(right, i), TOKEN_PLUS));
+        }
+        return resultValue;
+    }
+
+    if (left->kind == ARRAY_INT && right->kind == ARRAY_INT) {
+        Array *result = newArrayOfKind(ARRAY_INT, left->length);
+        vectorAddInt(left->ints, right->ints, result->ints, left->length);
+        return temporaryArray(result);
+    }
+
+    int leftConverted, rightConverted;
+    double *leftData = arrayDoubles(left, &leftConverted);
+    double *rightData = arrayDoubles(right, &rightConverted);
+    Array *result = newArrayOfKind(ARRAY_DOUBLE, left->length);
+    vectorAddDouble(leftData, rightData, result->doubles, left->length);
+    if (leftConverted) free(leftData);
+    if (rightConverted) free(rightData);
+    return temporaryArray(result);
+}
+
+// Builtin ضرب_نقطي: dot product of two arrays
+Value builtinDot(Value *args) {
+    Array *left = requireArray(args[0]);
+    Array *right = requireArray(args[1]);
+    requireSameLength(left, right);
+
+    if (left->kind == ARRAY_BOXED || right->kind == ARRAY_BOXED) {
+        Value sum = valueFromInt(0);
+        for (int64_t i = 0; i < left->length; i++) {
+            Value product = performArithmeticOperation(arrayGet(left, i), arrayGet(right, i), TOKEN_STAR);
+            sum = performArithmeticOperation(sum, product, TOKEN_PLUS);
+        }
+        return sum;
+    }
+
+    if (left->kind == ARRAY_INT && right->kind == ARRAY_INT) {
+        // No 64-bit vector multiply below AVX-512, so this stays scalar
+        int64_t sum = 0;
+        for (int64_t i = 0; i < left->length; i++) {
+            int64_t product = performIntegerOperation(left->ints[i], right->ints[i], TOKEN_STAR);
+            sum = performIntegerOperation(sum, product, TOKEN_PLUS);
+        }
+        return valueFromInt(sum);
+    }
+
+    int leftConverted, rightConverted;
+    double *leftData = arrayDoubles(left, &leftConverted);
+    double *rightData = arrayDoubles(right, &rightConverted);
+    double sum = vectorDotDouble(leftData, rightData, left->length);
+    if (leftConverted) free(leftData);
+    if (rightConverted) free(rightData);
+    return valueFromDouble(sum);
+}
@@ -0,0 +1,43 @@
+// vector.h
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <stdint.h>
+#include "lexer.h"
+#include "value.h"
+
+// Kernels over packed int64_t/double buffers. Each one uses AVX2 or SSE2 when
+// the CPU has it and a scalar loop otherwise. Integer kernels wrap on overflow;
+// callers use the scalar path in checked mode.
+#define VECTOR_SCALAR 0
+#define VECTOR_SSE2   1
+#define VECTOR_AVX2   2
+
+// The level the kernels dispatch on, -1 until detectVectorLevel sets it from
+// the CPU. The fuzzer lowers it to compare the levels, which must agree.
+extern int vectorLevel;
+int detectVectorLevel();
+
+int64_t vectorSumInt(const int64_t *data, int64_t length);
+double vectorSumDouble(const double *data, int64_t length);
+int64_t vectorMinInt(const int64_t *data, int64_t length);
+int64_t vectorMaxInt(const int64_t *data, int64_t length);
+double vectorMinDouble(const double *data, int64_t length);
+double vectorMaxDouble(const double *data, int64_t length);
+double vectorDotDouble(const double *left, const double *right, int64_t length);
+void vectorAddInt(const int64_t *left, const int64_t *right, int64_t *out, int64_t length);
+void vectorAddDouble(const double *left, const double *right, double *out, int64_t length);
+void vectorMapInt(const int64_t *data, TokenType operatorType, int64_t operand, int64_t *out, int64_t length);
+void vectorMapDouble(const double *data, TokenType operatorType, double operand, double *out, int64_t length);
+
+// Bulk array built-ins, with the same int/double promotion rules as
+// performArithmeticOperation
+Value builtinSum(Value *args);
+Value builtinMin(Value *args);
+Value builtinMax(Value *args);
+Value builtinScale(Value *args);
+Value builtinAddArrays(Value *args);
+Value builtinDot(Value *args);
+Value builtinMap(Value *args);
+
+#endif // VECTOR_H